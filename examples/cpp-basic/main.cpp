@@ -430,7 +430,7 @@ int main(int argc, const char *argv[]) {
   if (!win)
     return -ENOMEM;
 
-  r = resource_manager_new(cwd, &rm);
+  r = resource_manager_new(cwd, 0, &rm);
   if (r < 0)
     goto free;
 
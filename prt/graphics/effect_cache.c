@@ -0,0 +1,289 @@
+#include <prt/graphics/effect_cache.h>
+#include <sys/stat.h>
+#include <stdio.h>
+
+static const char effect_cache_magic[4] = {'P', 'R', 'T', 'E'};
+
+/* file layout: header, one `uint32_t` type per attribute and uniform, the
+ * NUL terminated vertex and fragment paths, attribute and uniform names,
+ * then the program binary
+ */
+struct effect_cache_header {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t type;
+  uint32_t format;
+  uint32_t num_attributes;
+  uint32_t num_uniforms;
+  uint64_t strings_size;
+  uint64_t binary_size;
+};
+
+/* @func `effect_cache_new`
+ * @desc Creates a cache storing its entries in `dir`, the directory is
+ *       created when missing
+ *
+ * @param(dir)       Cache directory
+ * @param(out_cache) Receives the cache
+ *
+ * @ret 0 on success or error code
+ */
+int effect_cache_new(const char *dir, EffectCache **out_cache) {
+  EffectCache *cache;
+  assert(dir);
+  assert(out_cache);
+
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+    return -errno;
+
+  cache = NEW0(EffectCache);
+  if (!cache)
+    return -ENOMEM;
+
+  cache->dir = strdup(dir);
+  if (!cache->dir) {
+    free((void *)cache);
+    return -ENOMEM;
+  }
+
+  *out_cache = cache;
+  return 0;
+}
+
+/* @func `effect_cache_key`
+ * @desc Hashes the contents of an effect description and its shaders
+ *
+ * @ret the key
+ */
+uint64_t effect_cache_key(const FileResource *json, const FileResource *vertex,
+                          const FileResource *fragment) {
+  uint64_t key;
+
+  key = murmur3_64(json->data, json->size, MURMUR64_SEED);
+  key = murmur3_64(vertex->data, vertex->size, key);
+  return murmur3_64(fragment->data, fragment->size, key);
+}
+
+/* cache file of the effect at `path`, `suffix` is appended */
+static int effect_cache_file(EffectCache *cache, const char *path,
+                             const char *suffix, char file[PATH_MAX]) {
+  int n;
+
+  n = snprintf(file, PATH_MAX, "%s/%016llx.effect%s", cache->dir,
+               (unsigned long long)murmur3_64(path, strlen(path),
+                                              MURMUR64_SEED),
+               suffix);
+  return n < 0 || n >= PATH_MAX ? -ENAMETOOLONG : 0;
+}
+
+/* takes the next NUL terminated string from `*s`, `NULL` past `end` */
+static const char *effect_cache_string(const char **s, const char *end) {
+  const char *str = *s, *nul;
+
+  nul = (const char *)memchr(str, 0, end - str);
+  if (!nul)
+    return NULL;
+  *s = nul + 1;
+  return str;
+}
+
+/* @func `effect_cache_read`
+ * @desc Reads the entry of the effect at `path`. The entry is only
+ *       checked for consistency, comparing its key and loading its binary
+ *       is up to the caller.
+ *
+ * @param(cache)     Effect cache
+ * @param(path)      Path of the effect description
+ * @param(out_entry) Receives the entry, release with
+ *                   `effect_cache_entry_unref`
+ *
+ * @ret 0 on success, -ENOENT when there's no entry, -EINVAL when it is
+ *      damaged or of another version or error code
+ */
+int effect_cache_read(EffectCache *cache, const char *path,
+                      EffectCacheEntry **out_entry) {
+  struct effect_cache_header header;
+  EffectCacheEntry *entry;
+  VariableBinding *variables;
+  const char *s, *end;
+  uint32_t *types;
+  char file[PATH_MAX], *data;
+  size_t size, count, i;
+  int r;
+  assert(cache);
+  assert(path);
+  assert(out_entry);
+
+  r = effect_cache_file(cache, path, "", file);
+  if (r < 0)
+    return r;
+
+  r = access(file, R_OK) < 0 ? -ENOENT : load_resource(file, &data, &size);
+  if (r < 0)
+    return r;
+
+  r = -EINVAL;
+  if (size < sizeof(header))
+    goto err;
+  memcpy(&header, data, sizeof(header));
+
+  if (memcmp(header.magic, effect_cache_magic, sizeof(header.magic)) ||
+      header.version != EFFECT_CACHE_VERSION)
+    goto err;
+
+  count = (size_t)header.num_attributes + header.num_uniforms;
+  if (count > size / sizeof(*types) || header.strings_size > size ||
+      header.binary_size > size ||
+      sizeof(header) + count * sizeof(*types) + header.strings_size +
+              header.binary_size !=
+          size)
+    goto err;
+
+  entry = (EffectCacheEntry *)calloc(1, sizeof(*entry) +
+                                            count * sizeof(*variables));
+  if (!entry) {
+    r = -ENOMEM;
+    goto err;
+  }
+  variables = (VariableBinding *)(entry + 1);
+
+  types = (uint32_t *)(data + sizeof(header));
+  s = (const char *)(types + count);
+  end = s + header.strings_size;
+
+  entry->vertex = effect_cache_string(&s, end);
+  entry->fragment = effect_cache_string(&s, end);
+  for (i = 0; i < count && entry->fragment; ++i) {
+    variables[i].name = effect_cache_string(&s, end);
+    if (!variables[i].name)
+      break;
+    memcpy(&variables[i].type, &types[i], sizeof(*types));
+  }
+  if (!entry->vertex || !entry->fragment || i != count || s != end) {
+    free((void *)entry);
+    goto err;
+  }
+
+  entry->key = header.key;
+  entry->type = (EffectType)header.type;
+  entry->binding.attributes = variables;
+  entry->binding.num_attributes = header.num_attributes;
+  entry->binding.uniforms = variables + header.num_attributes;
+  entry->binding.num_uniforms = header.num_uniforms;
+  entry->format = header.format;
+  entry->binary = end;
+  entry->binary_size = header.binary_size;
+  entry->data = data;
+
+  *out_entry = entry;
+  return 0;
+
+err:
+  free((void *)data);
+  return r;
+}
+
+/* @func `effect_cache_write`
+ * @desc Stores `entry` as the entry of the effect at `path`. The file is
+ *       written under a temporary name and renamed, readers never see a
+ *       partial entry.
+ *
+ * @param(cache) Effect cache
+ * @param(path)  Path of the effect description
+ * @param(entry) Entry to store, `data` is ignored
+ *
+ * @ret 0 on success or error code
+ */
+int effect_cache_write(EffectCache *cache, const char *path,
+                       const EffectCacheEntry *entry) {
+  struct effect_cache_header header;
+  const ShaderBinding *b;
+  const VariableBinding *v;
+  uint32_t type;
+  char file[PATH_MAX], tmp[PATH_MAX], pid[16];
+  FILE *fd;
+  size_t i, count;
+  int r;
+  assert(cache);
+  assert(path);
+  assert(entry);
+
+  b = &entry->binding;
+  count = b->num_attributes + b->num_uniforms;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, effect_cache_magic, sizeof(header.magic));
+  header.version = EFFECT_CACHE_VERSION;
+  header.key = entry->key;
+  header.type = entry->type;
+  header.format = entry->format;
+  header.num_attributes = b->num_attributes;
+  header.num_uniforms = b->num_uniforms;
+  header.strings_size = strlen(entry->vertex) + strlen(entry->fragment) + 2;
+  for (i = 0; i < count; ++i) {
+    v = i < b->num_attributes ? &b->attributes[i]
+                              : &b->uniforms[i - b->num_attributes];
+    header.strings_size += strlen(v->name) + 1;
+  }
+  header.binary_size = entry->binary_size;
+
+  snprintf(pid, sizeof(pid), ".%d", (int)getpid());
+  r = effect_cache_file(cache, path, "", file);
+  if (r < 0)
+    return r;
+  r = effect_cache_file(cache, path, pid, tmp);
+  if (r < 0)
+    return r;
+
+  fd = fopen(tmp, "wb");
+  if (!fd)
+    return -EIO;
+
+  fwrite(&header, sizeof(header), 1, fd);
+  for (i = 0; i < count; ++i) {
+    v = i < b->num_attributes ? &b->attributes[i]
+                              : &b->uniforms[i - b->num_attributes];
+    type = v->type;
+    fwrite(&type, sizeof(type), 1, fd);
+  }
+  fwrite(entry->vertex, strlen(entry->vertex) + 1, 1, fd);
+  fwrite(entry->fragment, strlen(entry->fragment) + 1, 1, fd);
+  for (i = 0; i < count; ++i) {
+    v = i < b->num_attributes ? &b->attributes[i]
+                              : &b->uniforms[i - b->num_attributes];
+    fwrite(v->name, strlen(v->name) + 1, 1, fd);
+  }
+  if (entry->binary_size)
+    fwrite(entry->binary, entry->binary_size, 1, fd);
+
+  if (ferror(fd) | fclose(fd) || rename(tmp, file) < 0) {
+    (void)unlink(tmp);
+    return -EIO;
+  }
+
+  return 0;
+}
+
+/* @func `effect_cache_entry_unref`
+ * @desc Releases an entry returned by `effect_cache_read`
+ */
+void effect_cache_entry_unref(EffectCacheEntry *entry) {
+  assert(entry);
+
+  free((void *)entry->data);
+  free((void *)entry);
+}
+
+/* @func `effect_cache_unref`
+ * @desc Releases the cache, its entries stay on disk
+ *
+ * @ret 0 on success or error code
+ */
+int effect_cache_unref(EffectCache *cache) {
+  assert(cache);
+
+  free((void *)cache->dir);
+  free((void *)cache);
+  return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <prt/shared/basic.h>
+#include <prt/graphics/shader.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* On-disk cache of linked effects. Every effect description gets one file
+ * in the cache directory, named after its path, holding the content hash
+ * of the description and both shader sources, the shader paths, the
+ * attribute and uniform binding and the driver's program binary.
+ */
+
+#define EFFECT_CACHE_VERSION 1
+
+typedef struct _EffectCache {
+  char *dir;
+} EffectCache;
+
+typedef struct _EffectCacheEntry {
+  /* `effect_cache_key` of the sources */
+  uint64_t key;
+  EffectType type;
+  /* paths of the shader sources, as in the description */
+  const char *vertex;
+  const char *fragment;
+  ShaderBinding binding;
+  /* `glGetProgramBinary` format and blob */
+  uint32_t format;
+  const void *binary;
+  size_t binary_size;
+  /* file contents the pointers above refer to, owned by read entries */
+  char *data;
+} EffectCacheEntry;
+
+int effect_cache_new(const char *dir, EffectCache **out_cache);
+uint64_t effect_cache_key(const FileResource *json, const FileResource *vertex,
+                          const FileResource *fragment);
+int effect_cache_read(EffectCache *cache, const char *path,
+                      EffectCacheEntry **out_entry);
+int effect_cache_write(EffectCache *cache, const char *path,
+                       const EffectCacheEntry *entry);
+void effect_cache_entry_unref(EffectCacheEntry *entry);
+int effect_cache_unref(EffectCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,7 +1,15 @@
 #include <prt/graphics/shader.h>
+#include <prt/graphics/effect_cache.h>
 #include <prt/shared/json.h>
+#include <prt/shared/json_bind.h>
+#include <stddef.h>
 #include <GLES3/gl31.h>
 
+/* GL_KHR_parallel_shader_compile */
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 /* @func `gl_shader_type`
  * @desc Converts `ShaderType` into GL shader type
  *
@@ -22,245 +30,295 @@ uint32_t gl_shader_type(ShaderType type) {
   }
 }
 
+static const char *const et_names[] = {
+    "solid-color", "solid-texture",     "depth-texture",
+    "gbuffer",     "cube-map",          "point-light",
+    "directional-light", NULL,
+};
+static const int et_values[] = {
+    ET_SOLID_COLOR, ET_SOLID_TEXTURE, ET_DEPTH_TEXTURE,     ET_GBUFFER,
+    ET_CUBE_MAP,    ET_POINT_LIGHT,   ET_DIRECTIONAL_LIGHT,
+};
+static JsonEnum et_enum = {
+    .names = et_names, .values = et_values, .fold_case = true};
+
+static const char *const svt_names[] = {
+    "float",    "float1", "float2",   "vec2f",    "float3", "vec3f",
+    "float4",   "vec4f",  "int",      "int1",     "texture", "int2",
+    "vec2i",    "int3",   "vec3i",    "int4",     "vec4i",  "float3x3",
+    "mat3f",    "float3x4", "float4x4", "mat4f",  NULL,
+};
+static const int svt_values[] = {
+    SVT_FLOAT1,     SVT_FLOAT1,     SVT_FLOAT2,     SVT_FLOAT2,
+    SVT_FLOAT3,     SVT_FLOAT3,     SVT_FLOAT4,     SVT_FLOAT4,
+    SVT_TEXTURE,    SVT_TEXTURE,    SVT_TEXTURE,    SVT_INT2,
+    SVT_INT2,       SVT_INT3,       SVT_INT3,       SVT_INT4,
+    SVT_INT4,       SVT_MATRIX_3X3, SVT_MATRIX_3X3, SVT_MATRIX_3X4,
+    SVT_MATRIX_4X4, SVT_MATRIX_4X4,
+};
+static JsonEnum svt_enum = {
+    .names = svt_names, .values = svt_values, .fold_case = true};
+
 /* @func `et_from_string`
- * @desc Converts `EffectType` from string representation
+ * @desc Converts `EffectType` from string representation, ignoring case
  *
  * @param(s)  String value
  *
  * @ret `EffectType` of the string
  */
 EffectType et_from_string(const char *s) {
-  __free_str char *p = str_to_lower(s);
-
-  if (streq(p, "solid-color"))
-    return ET_SOLID_COLOR;
-  else if (streq(p, "solid-texture"))
-    return ET_SOLID_TEXTURE;
-  else if (streq(p, "depth-texture"))
-    return ET_DEPTH_TEXTURE;
-  else if (streq(p, "gbuffer"))
-    return ET_GBUFFER;
-  else if (streq(p, "cube-map"))
-    return ET_CUBE_MAP;
-  else if (streq(p, "point-light"))
-    return ET_POINT_LIGHT;
-  else if (streq(p, "directional-light"))
-    return ET_DIRECTIONAL_LIGHT;
-
-  return ET_NONE;
+  int value;
+
+  if (json_enum_lookup(&et_enum, s, strlen(s), &value) < 0)
+    return ET_NONE;
+  return (EffectType)value;
 }
 
 /* @func `svt_from_string`
- * @desc Converts `ShaderVariableType` from string representation
+ * @desc Converts `ShaderVariableType` from string representation, ignoring
+ *       case
  *
  * @param(s)  String value
  *
  * @ret `ShaderVariableType` of the string
  */
 ShaderVariableType svt_from_string(const char *s) {
-  __free_str char *p = str_to_lower(s);
-
-  if (streq(p, "float") || streq(p, "float1"))
-    return SVT_FLOAT1;
-
-  if (streq(p, "float2") || streq(p, "vec2f"))
-    return SVT_FLOAT2;
-
-  if (streq(p, "float3") || streq(p, "vec3f"))
-    return SVT_FLOAT3;
-
-  if (streq(p, "float4") || streq(p, "vec4f"))
-    return SVT_FLOAT4;
+  int value;
 
-  if (streq(p, "int") || streq(p, "int1") || streq(p, "texture"))
-    return SVT_TEXTURE;
-
-  if (streq(p, "int2") || streq(p, "vec2i"))
-    return SVT_INT2;
-
-  if (streq(p, "int3") || streq(p, "vec3i"))
-    return SVT_INT3;
-
-  if (streq(p, "int4") || streq(p, "vec4i"))
-    return SVT_INT4;
+  if (json_enum_lookup(&svt_enum, s, strlen(s), &value) < 0)
+    return SVT_NONE;
+  return (ShaderVariableType)value;
+}
 
-  if (streq(p, "float3x3") || streq(p, "mat3f"))
-    return SVT_MATRIX_3X3;
+/* effect description as decoded from JSON */
+typedef struct _EffectDescription {
+  int version;
+  char *name;
+  char *vertex;
+  char *fragment;
+  ShaderBinding binding;
+} EffectDescription;
+
+static const JsonField variable_fields[] = {
+    {.key = "name",
+     .type = JSON_FIELD_STRING,
+     .offset = offsetof(VariableBinding, name),
+     .required = true},
+    {.key = "type",
+     .type = JSON_FIELD_ENUM,
+     .offset = offsetof(VariableBinding, type),
+     .required = true,
+     .names = &svt_enum},
+};
+static JsonSchema variable_schema = {.fields = variable_fields,
+                                     .num_fields = COUNT(variable_fields),
+                                     .size = sizeof(VariableBinding)};
+
+static const JsonField effect_fields[] = {
+    {.key = "version",
+     .type = JSON_FIELD_INT,
+     .offset = offsetof(EffectDescription, version),
+     .required = true},
+    {.key = "name",
+     .type = JSON_FIELD_STRING,
+     .offset = offsetof(EffectDescription, name),
+     .required = true},
+    {.key = "vertex",
+     .type = JSON_FIELD_STRING,
+     .offset = offsetof(EffectDescription, vertex),
+     .required = true},
+    {.key = "fragment",
+     .type = JSON_FIELD_STRING,
+     .offset = offsetof(EffectDescription, fragment),
+     .required = true},
+    {.key = "uniforms",
+     .type = JSON_FIELD_ARRAY,
+     .offset = offsetof(EffectDescription, binding.uniforms),
+     .required = true,
+     .schema = &variable_schema,
+     .count_offset = offsetof(EffectDescription, binding.num_uniforms)},
+    {.key = "attributes",
+     .type = JSON_FIELD_ARRAY,
+     .offset = offsetof(EffectDescription, binding.attributes),
+     .required = true,
+     .schema = &variable_schema,
+     .count_offset = offsetof(EffectDescription, binding.num_attributes)},
+};
+static JsonSchema effect_schema = {.fields = effect_fields,
+                                   .num_fields = COUNT(effect_fields),
+                                   .size = sizeof(EffectDescription)};
+
+/* loads `path` through `manager` when there is one */
+static int _load_effect_resource(ResourceManager *manager, const char *path,
+                                 FileResource **out_fr) {
+  if (!manager)
+    return file_resource_new(path, out_fr);
 
-  if (streq(p, "float3x4"))
-    return SVT_MATRIX_3X4;
+  /* concurrent loads of the same file share one resource */
+  return resource_manager_load(manager, path, out_fr);
+}
 
-  if (streq(p, "float4x4") || streq(p, "mat4f"))
-    return SVT_MATRIX_4X4;
+/* @func `_store_effect`
+ * @desc Stores the program binary of a freshly linked effect in `cache`,
+ *       failures only cost the next start a compilation
+ */
+static void _store_effect(EffectCache *cache, const char *frompath,
+                          FileResource *json, FileResource *fvert,
+                          FileResource *ffrag, EffectDescription *effect,
+                          Pass *pass) {
+  EffectCacheEntry entry = {0};
+  GLint size = 0;
+  GLenum format;
+  void *binary;
+  int r;
 
-  return SVT_NONE;
+  /* zero when the driver supports no binary formats */
+  glGetProgramiv(pass->shader_program, GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0)
+    return;
+
+  binary = malloc(size);
+  if (!binary)
+    return;
+  glGetProgramBinary(pass->shader_program, size, &size, &format, binary);
+
+  entry.key = effect_cache_key(json, fvert, ffrag);
+  entry.type = pass->type;
+  entry.vertex = effect->vertex;
+  entry.fragment = effect->fragment;
+  entry.binding = effect->binding;
+  entry.format = format;
+  entry.binary = binary;
+  entry.binary_size = size;
+
+  r = effect_cache_write(cache, frompath, &entry);
+  if (r < 0)
+    _Log(LL_WARN, "Error caching effect '%s': %i", frompath, r);
+  free(binary);
 }
 
-/* @func `_load_effect_binding`
- * @desc Loads uniform/attribute binding from JSON into generic
- *`VariableBinding`
+/* @func `_load_effect_cached`
+ * @desc Creates the effect from its cache entry when the entry was made
+ *       from the current description and shader sources
  *
- * @param(bindings)    JSON object describing the bindings
- * @param(out_binding) Created variable bindings
- * @param(out_size)    Size of the bindings
+ * @param(json)     Effect description
+ * @param(frompath) Path of the effect description
+ * @param(manager)  Resource manager, can be `NULL`
+ * @param(cache)    Effect cache
+ * @param(pool)     `StringPool` to use during linking, can be `NULL`
+ * @param(out_pass) Output shader pass, ready to be used
  *
- * @ret 0 on success or error code
+ * @ret 0 on success, -ESTALE when the sources changed or error code
  */
-int _load_effect_binding(JsonVariant *bindings, VariableBinding **out_binding,
-                         size_t *out_size) {
-  JsonVariant *e, *v;
-  VariableBinding *vb;
-  const char *name, *type;
-  ShaderVariableType u;
-  size_t i;
+static int _load_effect_cached(FileResource *json, const char *frompath,
+                               ResourceManager *manager, EffectCache *cache,
+                               StringPool *pool, Pass **out_pass) {
+  EffectCacheEntry *entry;
+  FileResource *fvert = NULL, *ffrag = NULL;
+  Pass *pass;
   int r;
-  assert(bindings);
 
-  name = NULL;
-  vb = (VariableBinding *)calloc(sizeof(VariableBinding), bindings->size);
-  if (!vb)
-    return -ENOMEM;
-
-  for (i = 0; i < bindings->size; ++i) {
-    v = json_variant_element(bindings, i);
-    if (!v)
-      goto err;
+  r = effect_cache_read(cache, frompath, &entry);
+  if (r < 0)
+    return r;
 
-    e = json_variant_value(v, "name");
-    if (!e)
-      goto err;
+  r = _load_effect_resource(manager, entry->vertex, &fvert);
+  if (r < 0)
+    goto out;
 
-    name = strdup(json_variant_string(e));
-    if (!name)
-      goto err;
+  r = _load_effect_resource(manager, entry->fragment, &ffrag);
+  if (r < 0)
+    goto out;
 
-    e = json_variant_value(v, "type");
-    if (!e)
-      goto err;
+  if (effect_cache_key(json, fvert, ffrag) != entry->key) {
+    r = -ESTALE;
+    goto out;
+  }
 
-    type = json_variant_string(e);
-    u = svt_from_string(type);
-    if (u == SVT_NONE)
-      goto err;
+  r = shader_pass_new(entry->type, &pass);
+  if (r < 0)
+    goto out;
 
-    vb[i].name = name;
-    vb[i].type = u;
-    name = NULL;
+  r = shader_pass_load_binary(pass, entry->format, entry->binary,
+                              entry->binary_size, &entry->binding, pool);
+  if (r < 0) {
+    free((void *)pass);
+    goto out;
   }
 
-  *out_binding = vb;
-  *out_size = bindings->size;
-
-  return 0;
+  *out_pass = pass;
+  Log("Effect '%s' (0x%x) loaded from cache", frompath, pass->type);
 
-err:
-  free((void *)name);
-  for (; i; --i)
-    free((void *)vb[i].name);
-  free((void *)vb);
-  return -EINVAL;
+out:
+  /* the manager keeps them for the uncached path or later effects */
+  if (!manager) {
+    if (fvert)
+      (void)file_resource_unref(fvert);
+    if (ffrag)
+      (void)file_resource_unref(ffrag);
+  }
+  effect_cache_entry_unref(entry);
+  return r;
 }
 
 /* @func `_load_effect_json`
  * @desc Parses JSON and evaluates description of effects
  *
  * @param(json)     JSON string data
+ * @param(frompath) Path of the description, names the cache entry
  * @param(manager)  Resource manager, can be `NULL`
+ * @param(cache)    Effect cache receiving the linked program, can be `NULL`
  * @param(pool)     `StringPool` to use during linking, can be `NULL`
  * @param(out_pass) Output shader pass, ready to be used
  *
  * @ret 0 on success or error code
  */
-int _load_effect_json(FileResource *json, ResourceManager *manager,
+int _load_effect_json(FileResource *json, const char *frompath,
+                      ResourceManager *manager, EffectCache *cache,
                       StringPool *pool, Pass **out_pass) {
-  JsonVariant *v, *e, *q, *n;
-  char *s, *vertex, *fragment, *name;
-  ShaderBinding *sb;
-  Pass *pass;
+  JsonDocument *doc;
+  EffectDescription effect = {0};
+  const char *vertex, *fragment, *name;
+  Pass *pass = NULL;
   Shader *vtx, *frg;
-  FileResource *fvert, *ffrag;
+  FileResource *fvert = NULL, *ffrag = NULL;
   EffectType type;
-  size_t numuniforms, numattrs;
   int r;
-  intmax_t version;
   assert(json);
 
-  sb = NEW0(ShaderBinding);
-  if (!sb)
-    return -ENOMEM;
-
-  r = json_parse(json->data, json->size, &v);
+  /* strings are views into `json`, which may be shared through the
+   * resource manager and therefore isn't modified
+   */
+  doc = NULL;
+  r = json_document_parse_view(json->data, json->size, &doc);
   if (r < 0) {
     _Log(LL_ERROR, "Invalid JSON");
     goto err;
   }
 
-  e = json_variant_value(v, "version");
-  if (!e) {
-    _Log(LL_ERROR, "Invalid `version` element");
+  r = json_bind(&effect_schema, &doc->root, &effect);
+  if (r < 0) {
+    _Log(LL_ERROR, "Invalid effect description");
     goto err;
   }
 
-  if (json_variant_integer(e) != 1) {
+  if (effect.version != 1) {
     _Log(LL_ERROR, "Invalid version number");
+    r = -EINVAL;
     goto err;
   }
 
-  e = json_variant_value(v, "name");
-  if (!e) {
-    _Log(LL_ERROR, "Invalid `name` element");
-    goto err;
-  }
-  name = json_variant_string(e);
-
-  e = json_variant_value(v, "vertex");
-  if (!e) {
-    _Log(LL_ERROR, "Invalid `vertex` element");
-    goto err;
-  }
-  vertex = json_variant_string(e);
-
-  e = json_variant_value(v, "fragment");
-  if (!e) {
-    _Log(LL_ERROR, "Invalid `fragment` element");
-    goto err;
-  }
-  fragment = json_variant_string(e);
+  name = effect.name;
+  vertex = effect.vertex;
+  fragment = effect.fragment;
 
-  e = json_variant_value(v, "uniforms");
-  if (!e) {
-    _Log(LL_ERROR, "Invalid `uniforms` element");
-    goto err;
-  }
-  r = _load_effect_binding(e, &sb->uniforms, &sb->num_uniforms);
-  if (r < 0) {
-    _Log(LL_ERROR, "Error creating uniform bindings");
-    goto err;
-  }
-  e = json_variant_value(v, "attributes");
-  if (!e) {
-    _Log(LL_ERROR, "Invalid `attributes` element");
-    goto err;
-  }
-  r = _load_effect_binding(e, &sb->attributes, &sb->num_attributes);
-  if (r < 0) {
-    _Log(LL_ERROR, "Error creating attribute bindings");
-    goto err;
-  }
-
-  if (manager)
-    r = resource_manager_load(manager, vertex, &fvert);
-  else
-    r = file_resource_new(vertex, &fvert);
+  r = _load_effect_resource(manager, vertex, &fvert);
   if (r < 0) {
     _Log(LL_ERROR, "Invalid vertex shader resource");
     goto resource_error;
   }
 
-  if (manager)
-    r = resource_manager_load(manager, fragment, &ffrag);
-  else
-    r = file_resource_new(fragment, &ffrag);
+  r = _load_effect_resource(manager, fragment, &ffrag);
   if (r < 0) {
     _Log(LL_ERROR, "Invalid fragment shader resource");
     goto resource_error;
@@ -309,22 +367,24 @@ int _load_effect_json(FileResource *json, ResourceManager *manager,
     goto free_frg;
   }
 
-  r = shader_pass_link(pass, sb, pool);
+  r = shader_pass_link(pass, &effect.binding, pool);
   if (r < 0) {
     _Log(LL_ERROR, "Error creating OpenGL program");
     goto free_frg;
   }
 
+  if (cache)
+    _store_effect(cache, frompath, json, fvert, ffrag, &effect, pass);
+
   if (!manager) {
     (void)file_resource_unref(fvert);
     (void)file_resource_unref(ffrag);
   }
 
-  free((void *)sb);
-
   *out_pass = pass;
   Log("Effect '%s' (0x%x) loaded", name, pass->type);
-  (void)json_variant_unref(v);
+  json_bind_free(&effect_schema, &effect);
+  (void)json_document_unref(doc);
 
   return 0;
 
@@ -336,47 +396,56 @@ free_vtx:
 
 resource_error:
   if (manager) {
-    (void)resource_manager_remove(manager, fvert);
-    (void)resource_manager_remove(manager, ffrag);
+    if (fvert)
+      (void)resource_manager_remove(manager, fvert);
+    if (ffrag)
+      (void)resource_manager_remove(manager, ffrag);
   } else {
-    (void)file_resource_unref(fvert);
-    (void)file_resource_unref(ffrag);
+    if (fvert)
+      (void)file_resource_unref(fvert);
+    if (ffrag)
+      (void)file_resource_unref(ffrag);
   }
 
 err:
-  free((void *)sb);
+  json_bind_free(&effect_schema, &effect);
   free((void *)pass);
-  json_variant_unref(v);
+  if (doc)
+    (void)json_document_unref(doc);
 
   return r;
 }
 
 /* @func `create_effect`
  * @desc Convenience function to load effect description from JSON object that
- *       can use @param(manager) as resource cache.
+ *       can use @param(manager) as resource cache. With @param(cache) the
+ *       linked program is taken from the effect cache as long as neither
+ *       the description nor the shader sources changed, skipping parsing
+ *       and compilation, and stored there otherwise.
  *
  * @param(frompath) Relative path to the resource
  * @param(manager)  Resource manager, can be `NULL`
+ * @param(cache)    Effect cache, can be `NULL`
  * @param(pool)     String pool to use during linking, can be `NULL`
  * @param(out_pass) New *linked* effect from specification
  *
  * @ret 0 on success or error code
  */
 int create_effect(const char *frompath, ResourceManager *manager,
-                  StringPool *pool, Pass **out_pass) {
+                  EffectCache *cache, StringPool *pool, Pass **out_pass) {
   FileResource *fr;
   int r;
   assert(frompath);
 
-  if (manager)
-    r = resource_manager_load(manager, frompath, &fr);
-  else
-    r = file_resource_new(frompath, &fr);
-
+  r = _load_effect_resource(manager, frompath, &fr);
   if (r < 0)
     return r;
 
-  r = _load_effect_json(fr, manager, pool, out_pass);
+  /* stale or unusable entries are replaced by the uncached path */
+  r = cache ? _load_effect_cached(fr, frompath, manager, cache, pool, out_pass)
+            : -ENOENT;
+  if (r < 0)
+    r = _load_effect_json(fr, frompath, manager, cache, pool, out_pass);
   if (r < 0) {
     if (manager)
       (void)resource_manager_remove(manager, fr);
@@ -462,6 +531,54 @@ int shader_new(ShaderType type, Shader **out_shader) {
   return 0;
 }
 
+/* @func `_shader_submit`
+ * @desc Hands the source of a shader to the driver and starts compiling it
+ *       without waiting for the result
+ *
+ * @ret the shader object or 0
+ */
+static uint32_t _shader_submit(ShaderType type, FileResource *fr) {
+  GLuint sh;
+  GLint size[] = {fr->size - 1};
+
+  sh = glCreateShader(gl_shader_type(type));
+  if (sh == 0)
+    return 0;
+
+  glShaderSource(sh, 1, (const char *const *)&fr->data, size);
+  glCompileShader(sh);
+
+  return sh;
+}
+
+/* @func `_shader_compiled`
+ * @desc Waits for the compilation of `sh` and prints its log on failure
+ *
+ * @ret 0 when compiled or error code, `sh` isn't deleted
+ */
+static int _shader_compiled(uint32_t sh) {
+  GLint compiled = 0;
+  GLint infolen = 0;
+  char *infolog;
+
+  glGetShaderiv(sh, GL_COMPILE_STATUS, &compiled);
+  if (compiled)
+    return 0;
+
+  glGetShaderiv(sh, GL_INFO_LOG_LENGTH, &infolen);
+  if (infolen > 1) {
+    infolog = (char *)malloc(infolen);
+    if (!infolog)
+      return -ENOMEM;
+
+    glGetShaderInfoLog(sh, infolen, NULL, infolog);
+    printf("Error compiling shader:\n%s\n", infolog);
+    free((void *)infolog);
+  }
+
+  return -EINVAL;
+}
+
 /* @func `shader_load_from`
  * @desc Loads shader source from given file resource `fr`
  *
@@ -471,38 +588,17 @@ int shader_new(ShaderType type, Shader **out_shader) {
  * @ret 0 on success or error code
  */
 int shader_load_from(Shader *shader, FileResource *fr) {
-  GLuint sh = 0;
-  GLint compiled = 0;
-  GLint size[] = {fr->size - 1};
-  GLenum type;
-
-  type = gl_shader_type(shader->type);
-  sh = glCreateShader(type);
+  GLuint sh;
+  int r;
 
+  sh = _shader_submit(shader->type, fr);
   if (sh == 0)
     return -EIO;
 
-  glShaderSource(sh, 1, (const char *const *)&fr->data, size);
-  glCompileShader(sh);
-  glGetShaderiv(sh, GL_COMPILE_STATUS, &compiled);
-  if (!compiled) {
-    GLint infolen = 0;
-
-    glGetShaderiv(sh, GL_INFO_LOG_LENGTH, &infolen);
-    if (infolen > 1) {
-      char *infolog = (char *)malloc(infolen);
-      if (!infolog) {
-        glDeleteShader(sh);
-        return -ENOMEM;
-      }
-
-      glGetShaderInfoLog(sh, infolen, NULL, infolog);
-      printf("Error compiling shader:\n%s\n", infolog);
-      free((void *)infolog);
-    }
-
+  r = _shader_compiled(sh);
+  if (r < 0) {
     glDeleteShader(sh);
-    return -EINVAL;
+    return r;
   }
 
   shader->program = sh;
@@ -576,67 +672,25 @@ int shader_pass_add_shader(Pass *pass, Shader *shader) {
   return 0;
 }
 
-/* @func `shader_pass_link`
- * @desc Links the shader effect pass shaders
+/* @func `_shader_pass_bind`
+ * @desc Looks up the uniform locations of the linked `program` and makes
+ *       it the program of `pass`
  *
- * @param(pass)    Effect pass to link
- * @param(binding) Attribute and uniform binding
- * @param(pool)    Optional `StringPool` where to store uniform names
- *
- * @ret 0 on success or error code
+ * @ret 0 on success or error code, `program` isn't deleted
  */
-int shader_pass_link(Pass *pass, ShaderBinding *binding, StringPool *pool) {
+static int _shader_pass_bind(Pass *pass, uint32_t program,
+                             ShaderBinding *binding, StringPool *pool) {
   FastHashBuilder *builder;
   FastHash *fh;
   UniformBinding ub;
   size_t *indices;
-  uint32_t program;
-  int32_t linked, location;
+  int32_t location;
   int r;
   size_t i, index;
-  assert(pass);
-  assert(binding);
 
-  if (!pass->fragment.program || !pass->vertex.program)
-    return -EINVAL;
-
-  program = glCreateProgram();
-  if (program == 0)
-    return -EIO;
-
-  glAttachShader(program, pass->vertex.program);
-  glAttachShader(program, pass->fragment.program);
-
-  for (i = 0; i < binding->num_attributes; ++i)
-    glBindAttribLocation(program, i, binding->attributes[i].name);
-
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &linked);
-  if (!linked) {
-    GLint infolen = 0;
-
-    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infolen);
-    if (infolen > 1) {
-      char *infolog = (char *)malloc(infolen);
-
-      if (!infolog) {
-        glDeleteProgram(program);
-        return -ENOMEM;
-      }
-
-      glGetProgramInfoLog(program, infolen, NULL, infolog);
-      printf("Error linking program:\n%s\n", infolog);
-      free((void *)infolog);
-    }
-
-    glDeleteProgram(program);
-    return -EINVAL;
-  }
-
-  i = 0;
   r = fasthash_builder_new(&builder);
   if (r < 0)
-    goto err;
+    return r;
 
   pass->shader_program = program;
   if (pool)
@@ -680,7 +734,139 @@ err:
     for (--i; i != (size_t)-1; --i)
       (void)string_pool_remove(pool, indices[i]);
   fasthash_builder_unref(builder);
-  glDeleteProgram(program);
+  return r;
+}
+
+/* @func `_program_submit`
+ * @desc Starts linking a program from two shaders without waiting for the
+ *       result
+ *
+ * @ret the program object or 0
+ */
+static uint32_t _program_submit(uint32_t vertex, uint32_t fragment,
+                                ShaderBinding *binding) {
+  uint32_t program;
+  size_t i;
+
+  program = glCreateProgram();
+  if (program == 0)
+    return 0;
+
+  glAttachShader(program, vertex);
+  glAttachShader(program, fragment);
+
+  for (i = 0; i < binding->num_attributes; ++i)
+    glBindAttribLocation(program, i, binding->attributes[i].name);
+
+  /* lets `create_effect` store the program in the effect cache */
+  glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(program);
+
+  return program;
+}
+
+/* @func `_program_linked`
+ * @desc Waits for linking of `program` and prints its log on failure
+ *
+ * @ret 0 when linked or error code, `program` isn't deleted
+ */
+static int _program_linked(uint32_t program) {
+  GLint linked = 0;
+  GLint infolen = 0;
+  char *infolog;
+
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (linked)
+    return 0;
+
+  glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infolen);
+  if (infolen > 1) {
+    infolog = (char *)malloc(infolen);
+    if (!infolog)
+      return -ENOMEM;
+
+    glGetProgramInfoLog(program, infolen, NULL, infolog);
+    printf("Error linking program:\n%s\n", infolog);
+    free((void *)infolog);
+  }
+
+  return -EINVAL;
+}
+
+/* @func `shader_pass_link`
+ * @desc Links the shader effect pass shaders
+ *
+ * @param(pass)    Effect pass to link
+ * @param(binding) Attribute and uniform binding
+ * @param(pool)    Optional `StringPool` where to store uniform names
+ *
+ * @ret 0 on success or error code
+ */
+int shader_pass_link(Pass *pass, ShaderBinding *binding, StringPool *pool) {
+  uint32_t program;
+  int r;
+  assert(pass);
+  assert(binding);
+
+  if (!pass->fragment.program || !pass->vertex.program)
+    return -EINVAL;
+
+  program =
+      _program_submit(pass->vertex.program, pass->fragment.program, binding);
+  if (program == 0)
+    return -EIO;
+
+  r = _program_linked(program);
+  if (r == 0)
+    r = _shader_pass_bind(pass, program, binding, pool);
+  if (r < 0) {
+    pass->shader_program = 0;
+    glDeleteProgram(program);
+  }
+  return r;
+}
+
+/* @func `shader_pass_load_binary`
+ * @desc Creates the program of the pass from a binary retrieved with
+ *       `glGetProgramBinary`, the pass needs no shaders
+ *
+ * @param(pass)    Effect pass
+ * @param(format)  Format of the binary
+ * @param(binary)  Program binary
+ * @param(size)    Size of the binary
+ * @param(binding) Attribute and uniform binding the program was linked with
+ * @param(pool)    Optional `StringPool` where to store uniform names
+ *
+ * @ret 0 on success, -EINVAL when the driver rejects the binary or error
+ *      code
+ */
+int shader_pass_load_binary(Pass *pass, uint32_t format, const void *binary,
+                            size_t size, ShaderBinding *binding,
+                            StringPool *pool) {
+  uint32_t program;
+  int32_t linked = 0;
+  int r;
+  assert(pass);
+  assert(binary);
+  assert(binding);
+
+  program = glCreateProgram();
+  if (program == 0)
+    return -EIO;
+
+  /* fails after driver updates, the caller falls back to compiling */
+  glProgramBinary(program, format, binary, size);
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    glDeleteProgram(program);
+    return -EINVAL;
+  }
+
+  r = _shader_pass_bind(pass, program, binding, pool);
+  if (r < 0) {
+    pass->shader_program = 0;
+    glDeleteProgram(program);
+  }
   return r;
 }
 
@@ -692,11 +878,10 @@ err:
  * @ret 0 when ready or error code
  */
 int shader_pass_ready(Pass *pass) {
-  if (pass->fragment.program == 0 || pass->vertex.program == 0)
-    return -EINVAL;
-
+  /* passes loaded from program binaries have no shaders */
   if (pass->shader_program == 0)
-    return -ENOENT;
+    return pass->fragment.program == 0 || pass->vertex.program == 0 ? -EINVAL
+                                                                    : -ENOENT;
 
   if (!pass->uniforms)
     return -EFAULT;
@@ -750,3 +935,519 @@ int shader_pass_unref(Pass *pass, StringPool *pool) {
   free((void *)pass);
   return 0;
 }
+
+enum effect_load_state {
+  /* sources are being loaded and parsed on a worker */
+  EFFECT_LOADING,
+  /* waiting to be handed to GL */
+  EFFECT_LOADED,
+  /* compiling and linking in the driver */
+  EFFECT_COMPILING,
+  EFFECT_DONE,
+};
+
+struct EffectLoad {
+  EffectBatch *batch;
+  char *path;
+  int state;
+  int result;
+  FileResource *json;
+  FileResource *fvert;
+  FileResource *ffrag;
+  EffectDescription effect;
+  /* cache entry matching the sources */
+  EffectCacheEntry *entry;
+  uint32_t vertex;
+  uint32_t fragment;
+  uint32_t program;
+};
+
+static bool _gl_has_extension(const char *name) {
+  GLint i, n = 0;
+  const char *ext;
+
+  glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+  for (i = 0; i < n; ++i) {
+    ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (ext && streq(ext, name))
+      return true;
+  }
+  return false;
+}
+
+/* drops everything the load holds besides GL objects */
+static void _effect_load_release(struct EffectLoad *load) {
+  if (!load->batch->manager) {
+    if (load->json)
+      (void)file_resource_unref(load->json);
+    if (load->fvert)
+      (void)file_resource_unref(load->fvert);
+    if (load->ffrag)
+      (void)file_resource_unref(load->ffrag);
+  }
+  load->json = load->fvert = load->ffrag = NULL;
+
+  json_bind_free(&effect_schema, &load->effect);
+  if (load->entry)
+    effect_cache_entry_unref(load->entry);
+  load->entry = NULL;
+}
+
+/* drops the shader sources, the manager keeps its own */
+static void _effect_load_drop_shaders(struct EffectLoad *load) {
+  if (!load->batch->manager) {
+    if (load->fvert)
+      (void)file_resource_unref(load->fvert);
+    if (load->ffrag)
+      (void)file_resource_unref(load->ffrag);
+  }
+  load->fvert = load->ffrag = NULL;
+}
+
+/* loads the shader sources, either from the description or the entry */
+static int _effect_load_shaders(struct EffectLoad *load, const char *vertex,
+                                const char *fragment) {
+  int r;
+
+  r = _load_effect_resource(load->batch->manager, vertex, &load->fvert);
+  if (r < 0) {
+    _Log(LL_ERROR, "Invalid vertex shader resource");
+    return r;
+  }
+
+  r = _load_effect_resource(load->batch->manager, fragment, &load->ffrag);
+  if (r < 0)
+    _Log(LL_ERROR, "Invalid fragment shader resource");
+  return r;
+}
+
+/* parses the description and loads the shaders it names */
+static int _effect_load_description(struct EffectLoad *load) {
+  JsonDocument *doc;
+  int r;
+
+  r = json_document_parse_view(load->json->data, load->json->size, &doc);
+  if (r < 0) {
+    _Log(LL_ERROR, "Invalid JSON");
+    return r;
+  }
+
+  r = json_bind(&effect_schema, &doc->root, &load->effect);
+  (void)json_document_unref(doc);
+  if (r < 0) {
+    _Log(LL_ERROR, "Invalid effect description");
+    return r;
+  }
+
+  if (load->effect.version != 1) {
+    _Log(LL_ERROR, "Invalid version number");
+    return -EINVAL;
+  }
+
+  return _effect_load_shaders(load, load->effect.vertex,
+                              load->effect.fragment);
+}
+
+/* @func `_effect_load_sources`
+ * @desc Worker part of `create_effects`: file I/O, hashing and JSON, no GL
+ *
+ * @ret 0 on success or error code
+ */
+static int _effect_load_sources(struct EffectLoad *load) {
+  EffectBatch *batch = load->batch;
+  int r;
+
+  r = _load_effect_resource(batch->manager, load->path, &load->json);
+  if (r < 0)
+    return r;
+
+  if (batch->cache &&
+      effect_cache_read(batch->cache, load->path, &load->entry) == 0) {
+    r = _effect_load_shaders(load, load->entry->vertex,
+                             load->entry->fragment);
+    if (r == 0 && effect_cache_key(load->json, load->fvert, load->ffrag) ==
+                      load->entry->key)
+      return 0;
+
+    /* stale, keep the description only */
+    _effect_load_drop_shaders(load);
+    effect_cache_entry_unref(load->entry);
+    load->entry = NULL;
+  }
+
+  return _effect_load_description(load);
+}
+
+static void _effect_load_job(void *context) {
+  struct EffectLoad *load = (struct EffectLoad *)context;
+  EffectBatch *batch = load->batch;
+
+  load->result = _effect_load_sources(load);
+  __atomic_store_n(&load->state, EFFECT_LOADED, __ATOMIC_RELEASE);
+
+  /* releasing the lock is the last access of the worker, after which
+   * `effect_batch_unref` may free the batch */
+  lock_acquire(&batch->lock);
+  batch->num_loaded++;
+  pthread_cond_broadcast(&batch->loaded);
+  lock_release(&batch->lock);
+}
+
+/* @func `_effect_resolve`
+ * @desc Hands the outcome of a load to the caller and releases the load
+ */
+static void _effect_resolve(struct EffectLoad *load, int r, Pass *pass) {
+  EffectBatch *batch = load->batch;
+
+  if (r == 0)
+    Log("Effect '%s' (0x%x) loaded", load->path, pass->type);
+  else {
+    _Log(LL_ERROR, "Error loading effect '%s': %i", load->path, r);
+    if (load->program)
+      glDeleteProgram(load->program);
+    if (load->vertex)
+      glDeleteShader(load->vertex);
+    if (load->fragment)
+      glDeleteShader(load->fragment);
+    pass = NULL;
+
+    /* like `create_effect`, the manager doesn't keep what failed; other
+     * users of the manager may still hold the resources, so they aren't
+     * freed */
+    if (batch->manager) {
+      if (load->json)
+        (void)resource_manager_remove(batch->manager, load->json);
+      if (load->fvert)
+        (void)resource_manager_remove(batch->manager, load->fvert);
+      if (load->ffrag)
+        (void)resource_manager_remove(batch->manager, load->ffrag);
+    }
+  }
+
+  load->program = load->vertex = load->fragment = 0;
+  load->result = r;
+  load->state = EFFECT_DONE;
+  batch->passes[load - batch->loads] = pass;
+  batch->num_pending--;
+
+  _effect_load_release(load);
+}
+
+/* @func `_effect_submit`
+ * @desc Starts compiling and linking a loaded effect without waiting for
+ *       the driver, cached effects are resolved right away
+ */
+static void _effect_submit(struct EffectLoad *load) {
+  EffectBatch *batch = load->batch;
+  Pass *pass;
+  int r;
+
+  r = load->result;
+  if (r < 0)
+    goto fail;
+
+  if (load->entry) {
+    r = shader_pass_new(load->entry->type, &pass);
+    if (r < 0)
+      goto fail;
+
+    r = shader_pass_load_binary(pass, load->entry->format, load->entry->binary,
+                                load->entry->binary_size,
+                                &load->entry->binding, batch->pool);
+    if (r == 0) {
+      _effect_resolve(load, 0, pass);
+      return;
+    }
+    free((void *)pass);
+
+    /* rejected by the driver, compile from the description, which loads
+     * the shaders again */
+    _effect_load_drop_shaders(load);
+    effect_cache_entry_unref(load->entry);
+    load->entry = NULL;
+    r = _effect_load_description(load);
+    if (r < 0)
+      goto fail;
+  }
+
+  load->vertex = _shader_submit(ST_VERTEX, load->fvert);
+  load->fragment = _shader_submit(ST_FRAGMENT, load->ffrag);
+  if (!load->vertex || !load->fragment) {
+    r = -EIO;
+    goto fail;
+  }
+
+  load->program =
+      _program_submit(load->vertex, load->fragment, &load->effect.binding);
+  if (!load->program) {
+    r = -EIO;
+    goto fail;
+  }
+
+  load->state = EFFECT_COMPILING;
+  return;
+
+fail:
+  _effect_resolve(load, r, NULL);
+}
+
+/* @func `_effect_finish`
+ * @desc Collects the compile and link status of a submitted effect and
+ *       creates its pass
+ */
+static void _effect_finish(struct EffectLoad *load) {
+  EffectBatch *batch = load->batch;
+  Pass *pass;
+  int r;
+
+  r = _shader_compiled(load->vertex);
+  if (r == 0)
+    r = _shader_compiled(load->fragment);
+  if (r == 0)
+    r = _program_linked(load->program);
+  if (r < 0)
+    goto fail;
+
+  r = shader_pass_new(et_from_string(load->effect.name), &pass);
+  if (r < 0)
+    goto fail;
+
+  r = _shader_pass_bind(pass, load->program, &load->effect.binding,
+                        batch->pool);
+  if (r < 0) {
+    free((void *)pass);
+    goto fail;
+  }
+
+  pass->vertex.program = load->vertex;
+  pass->vertex.type = ST_VERTEX;
+  pass->fragment.program = load->fragment;
+  pass->fragment.type = ST_FRAGMENT;
+
+  if (batch->cache)
+    _store_effect(batch->cache, load->path, load->json, load->fvert,
+                  load->ffrag, &load->effect, pass);
+
+  _effect_resolve(load, 0, pass);
+  return;
+
+fail:
+  _effect_resolve(load, r, NULL);
+}
+
+/* @func `_effect_batch_step`
+ * @desc Submits every loaded effect before querying the status of any, so
+ *       the driver can compile them in parallel, then resolves the
+ *       finished ones
+ *
+ * @param(batch) Effect batch
+ * @param(block) Wait for compilations still running in the driver
+ *
+ * @ret 0 when every effect is resolved or -EAGAIN
+ */
+static int _effect_batch_step(EffectBatch *batch, bool block) {
+  struct EffectLoad *load;
+  GLint done;
+  size_t i;
+
+  for (i = 0; i < batch->num_loads; ++i) {
+    load = &batch->loads[i];
+    if (__atomic_load_n(&load->state, __ATOMIC_ACQUIRE) == EFFECT_LOADED)
+      _effect_submit(load);
+  }
+
+  for (i = 0; i < batch->num_loads; ++i) {
+    load = &batch->loads[i];
+    if (__atomic_load_n(&load->state, __ATOMIC_ACQUIRE) != EFFECT_COMPILING)
+      continue;
+
+    if (!block && batch->parallel_compile) {
+      done = GL_FALSE;
+      glGetProgramiv(load->program, GL_COMPLETION_STATUS_KHR, &done);
+      if (!done)
+        continue;
+    }
+    _effect_finish(load);
+  }
+
+  return batch->num_pending ? -EAGAIN : 0;
+}
+
+/* first failure of the batch */
+static int _effect_batch_result(EffectBatch *batch) {
+  size_t i;
+
+  for (i = 0; i < batch->num_loads; ++i)
+    if (batch->loads[i].result < 0)
+      return batch->loads[i].result;
+  return 0;
+}
+
+/* @func `create_effects`
+ * @desc Creates many effects at once. Descriptions and shader sources are
+ *       loaded, hashed and parsed on @param(workers) while the GL thread
+ *       hands whatever is ready to the driver through `effect_batch_poll`
+ *       or `effect_batch_wait`. With GL_KHR_parallel_shader_compile polling
+ *       never blocks on the driver.
+ *
+ * @param(paths)      Relative paths of the effect descriptions
+ * @param(count)      Number of effects
+ * @param(manager)    Resource manager, can be `NULL`
+ * @param(cache)      Effect cache, can be `NULL`
+ * @param(pool)       String pool to use during linking, can be `NULL`
+ * @param(workers)    Thread pool for loading, `NULL` loads right away
+ * @param(out_passes) `count` passes, each set once its effect is resolved,
+ *                    `NULL` on failure
+ * @param(out_batch)  Receives the batch, must be used on the GL thread
+ *
+ * @ret 0 on success or error code
+ */
+int create_effects(const char *const *paths, size_t count,
+                   ResourceManager *manager, EffectCache *cache,
+                   StringPool *pool, ThreadPool *workers, Pass **out_passes,
+                   EffectBatch **out_batch) {
+  EffectBatch *batch;
+  struct EffectLoad *load;
+  size_t i;
+  assert(paths);
+  assert(out_passes);
+  assert(out_batch);
+
+  batch = NEW0(EffectBatch);
+  if (!batch)
+    return -ENOMEM;
+
+  batch->loads = NEW0N(struct EffectLoad, MAX(count, (size_t)1));
+  if (!batch->loads) {
+    free((void *)batch);
+    return -ENOMEM;
+  }
+
+  for (i = 0; i < count; ++i) {
+    load = &batch->loads[i];
+    load->batch = batch;
+    load->state = EFFECT_LOADING;
+    load->path = strdup(paths[i]);
+    if (!load->path) {
+      while (i--)
+        free((void *)batch->loads[i].path);
+      free((void *)batch->loads);
+      free((void *)batch);
+      return -ENOMEM;
+    }
+    out_passes[i] = NULL;
+  }
+
+  batch->manager = manager;
+  batch->cache = cache;
+  batch->pool = pool;
+  batch->passes = out_passes;
+  batch->num_loads = count;
+  batch->num_pending = count;
+  batch->parallel_compile = _gl_has_extension("GL_KHR_parallel_shader_compile");
+  /* condition variables need a non-recursive mutex */
+  lock_init_normal(&batch->lock);
+  pthread_cond_init(&batch->loaded, NULL);
+
+  for (i = 0; i < count; ++i)
+    if (!workers ||
+        thread_pool_submit(workers, _effect_load_job, &batch->loads[i]) < 0)
+      _effect_load_job(&batch->loads[i]);
+
+  *out_batch = batch;
+
+  return 0;
+}
+
+/* @func `effect_batch_poll`
+ * @desc Advances the batch without waiting for workers. Without
+ *       GL_KHR_parallel_shader_compile submitted effects are resolved in
+ *       the same call, which waits for the driver.
+ *
+ * @ret 0 when all effects succeeded, -EAGAIN while some are pending or the
+ *      error of the first failed effect
+ */
+int effect_batch_poll(EffectBatch *batch) {
+  int r;
+  assert(batch);
+
+  r = _effect_batch_step(batch, false);
+  return r < 0 ? r : _effect_batch_result(batch);
+}
+
+/* @func `effect_batch_wait`
+ * @desc Resolves every effect of the batch, handing effects to the driver
+ *       as their sources arrive
+ *
+ * @ret 0 when all effects succeeded or the error of the first failed effect
+ */
+int effect_batch_wait(EffectBatch *batch) {
+  size_t seen;
+  assert(batch);
+
+  for (;;) {
+    lock_acquire(&batch->lock);
+    seen = batch->num_loaded;
+    lock_release(&batch->lock);
+
+    if (_effect_batch_step(batch, false) != -EAGAIN)
+      break;
+
+    if (seen == batch->num_loads) {
+      /* every load was submitted, only the driver is left */
+      (void)_effect_batch_step(batch, true);
+      break;
+    }
+
+    /* sleep until a worker finishes another load */
+    lock_acquire(&batch->lock);
+    while (batch->num_loaded == seen)
+      pthread_cond_wait(&batch->loaded, &batch->lock);
+    lock_release(&batch->lock);
+  }
+
+  return _effect_batch_result(batch);
+}
+
+/* @func `effect_batch_result`
+ * @desc Outcome of a single effect of the batch
+ *
+ * @ret 0 when the pass was created, -EAGAIN while pending or error code
+ */
+int effect_batch_result(EffectBatch *batch, size_t index) {
+  assert(batch);
+  assert(index < batch->num_loads);
+
+  if (__atomic_load_n(&batch->loads[index].state, __ATOMIC_ACQUIRE) !=
+      EFFECT_DONE)
+    return -EAGAIN;
+  return batch->loads[index].result;
+}
+
+/* @func `effect_batch_unref`
+ * @desc Resolves what is still pending and releases the batch, the passes
+ *       belong to the caller
+ *
+ * @ret 0 on success or error code
+ */
+int effect_batch_unref(EffectBatch *batch) {
+  size_t i;
+  assert(batch);
+
+  (void)effect_batch_wait(batch);
+
+  /* the workers may not have released the lock yet */
+  lock_acquire(&batch->lock);
+  while (batch->num_loaded < batch->num_loads)
+    pthread_cond_wait(&batch->loaded, &batch->lock);
+  lock_release(&batch->lock);
+  pthread_cond_destroy(&batch->loaded);
+  lock_unref(&batch->lock);
+
+  for (i = 0; i < batch->num_loads; ++i)
+    free((void *)batch->loads[i].path);
+  free((void *)batch->loads);
+  free((void *)batch);
+
+  return 0;
+}
@@ -4,6 +4,7 @@
 #include <prt/shared/fast_hash.h>
 #include <prt/shared/pool.h>
 #include <prt/runtime/resource_manager.h>
+#include <prt/runtime/thread_pool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -93,13 +94,43 @@ typedef struct _ShaderBinding {
   size_t num_uniforms;
 } ShaderBinding;
 
+struct _EffectCache;
+struct EffectLoad;
+
+/* Effects created together by `create_effects` */
+typedef struct _EffectBatch {
+  ResourceManager *manager;
+  struct _EffectCache *cache;
+  StringPool *pool;
+  struct EffectLoad *loads;
+  size_t num_loads;
+  size_t num_pending;
+  /* receives the passes as effects are resolved */
+  Pass **passes;
+  /* loads finished by the workers, guarded by `lock` */
+  Lock lock;
+  pthread_cond_t loaded;
+  size_t num_loaded;
+  /* GL_KHR_parallel_shader_compile, status queries don't block */
+  bool parallel_compile;
+} EffectBatch;
+
 EffectType et_from_string(const char *s);
 ShaderVariableType svt_from_string(const char *s);
 uint32_t gl_shader_type(ShaderType type);
 
 int set_uniform(ShaderVariableType type, int32_t location, void *value);
 int create_effect(const char *frompath, ResourceManager *manager,
-                  StringPool *pool, Pass **out_pass);
+                  struct _EffectCache *cache, StringPool *pool,
+                  Pass **out_pass);
+int create_effects(const char *const *paths, size_t count,
+                   ResourceManager *manager, struct _EffectCache *cache,
+                   StringPool *pool, ThreadPool *workers, Pass **out_passes,
+                   EffectBatch **out_batch);
+int effect_batch_poll(EffectBatch *batch);
+int effect_batch_wait(EffectBatch *batch);
+int effect_batch_result(EffectBatch *batch, size_t index);
+int effect_batch_unref(EffectBatch *batch);
 
 int shader_new(ShaderType type, Shader **out_shader);
 int shader_load_from(Shader *shader, FileResource *fr);
@@ -110,6 +141,9 @@ int shader_pass_new(EffectType type, Pass **out_pass);
 /* deletes the incoming `shader` argument */
 int shader_pass_add_shader(Pass *pass, Shader *shader);
 int shader_pass_link(Pass *pass, ShaderBinding *binding, StringPool *pool);
+int shader_pass_load_binary(Pass *pass, uint32_t format, const void *binary,
+                            size_t size, ShaderBinding *binding,
+                            StringPool *pool);
 int shader_pass_ready(Pass *pass);
 int shader_pass_set_uniform(Pass *pass, Id name, void *value);
 int shader_pass_unref(Pass *pass, StringPool *pool);
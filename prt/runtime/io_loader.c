@@ -0,0 +1,733 @@
+#include <prt/runtime/io_loader.h>
+#include <prt/runtime/lock.h>
+#include <prt/shared/list.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+
+/* ring entries when no depth is given */
+#define IO_LOADER_DEPTH 256
+/* `user_data` of the wakeup read, files use their address */
+#define IO_LOADER_WAKEUP 1
+
+/* glibc only declares it for _GNU_SOURCE */
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000
+#endif
+
+enum io_file_state {
+  IO_FILE_OPEN,
+  IO_FILE_STAT,
+  IO_FILE_READ,
+  IO_FILE_CLOSE,
+};
+
+struct IoFile {
+  struct list_head list;
+  enum io_file_state state;
+  char *path;
+  IoLoadFunc func;
+  void *context;
+  size_t index;
+  int fd;
+  int result;
+  struct statx stx;
+  char *data;
+  size_t size;
+  size_t capacity;
+  /* the size is known, no need to read up to EOF */
+  bool sized;
+  bool mapped;
+};
+
+struct _IoLoader {
+  int ring;
+  /* submission queue */
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  /* tail including entries not yet handed to the kernel */
+  unsigned sq_local;
+  /* completion queue */
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  /* mappings of the rings */
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  /* files handed over by `io_loader_submit` */
+  Lock lock;
+  struct list_head queue;
+  bool stopping;
+  /* files on the ring, owned by the I/O thread */
+  struct list_head active;
+  /* runs the completion functions, can be `NULL` */
+  ThreadPool *completions;
+  /* written to wake the I/O thread */
+  int wakeup;
+  uint64_t wakeup_value;
+  unsigned depth;
+  unsigned in_flight;
+  pthread_t thread;
+};
+
+static int _ring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _ring_enter(int ring, unsigned to_submit, unsigned min_complete,
+                       unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, ring, to_submit, min_complete,
+                      flags, NULL, 0);
+}
+
+/* opens, size queries, reads and closes must all go through the ring */
+static bool _ring_supported(int ring) {
+  static const uint8_t ops[] = {IORING_OP_OPENAT, IORING_OP_STATX,
+                                IORING_OP_READ, IORING_OP_CLOSE};
+  struct io_uring_probe *probe;
+  size_t i, n = 256;
+  bool supported = false;
+
+  probe = (struct io_uring_probe *)calloc(
+      1, sizeof(*probe) + n * sizeof(struct io_uring_probe_op));
+  if (!probe)
+    return false;
+
+  if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe,
+              n) == 0) {
+    supported = true;
+    for (i = 0; i < COUNT(ops); ++i)
+      if (ops[i] > probe->last_op ||
+          !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+        supported = false;
+  }
+
+  free((void *)probe);
+  return supported;
+}
+
+/* @func `_ring_map`
+ * @desc Maps the submission and completion rings set up by the kernel
+ *
+ * @ret 0 on success or error code
+ */
+static int _ring_map(IoLoader *l, struct io_uring_params *p) {
+  uint8_t *sq, *cq;
+
+  l->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  l->cq_ring_size =
+      p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+    l->sq_ring_size = l->cq_ring_size = MAX(l->sq_ring_size, l->cq_ring_size);
+
+  l->sq_ring = mmap(NULL, l->sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, l->ring, IORING_OFF_SQ_RING);
+  if (l->sq_ring == MAP_FAILED)
+    return -errno;
+
+  if (p->features & IORING_FEAT_SINGLE_MMAP)
+    l->cq_ring = l->sq_ring;
+  else {
+    l->cq_ring = mmap(NULL, l->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, l->ring, IORING_OFF_CQ_RING);
+    if (l->cq_ring == MAP_FAILED) {
+      (void)munmap(l->sq_ring, l->sq_ring_size);
+      return -errno;
+    }
+  }
+
+  l->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+  l->sqes = (struct io_uring_sqe *)mmap(NULL, l->sqes_size,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, l->ring,
+                                        IORING_OFF_SQES);
+  if (l->sqes == MAP_FAILED) {
+    if (l->cq_ring != l->sq_ring)
+      (void)munmap(l->cq_ring, l->cq_ring_size);
+    (void)munmap(l->sq_ring, l->sq_ring_size);
+    return -errno;
+  }
+
+  sq = (uint8_t *)l->sq_ring;
+  l->sq_head = (unsigned *)(sq + p->sq_off.head);
+  l->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+  l->sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+  l->sq_array = (unsigned *)(sq + p->sq_off.array);
+
+  cq = (uint8_t *)l->cq_ring;
+  l->cq_head = (unsigned *)(cq + p->cq_off.head);
+  l->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+  l->cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+  l->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+
+  return 0;
+}
+
+static void _ring_unmap(IoLoader *l) {
+  (void)munmap(l->sqes, l->sqes_size);
+  if (l->cq_ring != l->sq_ring)
+    (void)munmap(l->cq_ring, l->cq_ring_size);
+  (void)munmap(l->sq_ring, l->sq_ring_size);
+}
+
+/* next free submission entry, zeroed; the ring has room for every file in
+ * flight plus the wakeup read
+ */
+static struct io_uring_sqe *_ring_sqe(IoLoader *l, uint64_t user_data) {
+  struct io_uring_sqe *sqe;
+  unsigned index;
+
+  index = l->sq_local++ & l->sq_mask;
+  sqe = &l->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = user_data;
+  l->sq_array[index] = index;
+
+  return sqe;
+}
+
+/* @func `_ring_submit`
+ * @desc Publishes the queued entries and waits for at least one
+ *       completion, entries the kernel didn't consume stay queued for the
+ *       next call
+ *
+ * @ret 0 on success or error code
+ */
+static int _ring_submit(IoLoader *l) {
+  unsigned to_submit;
+  int r;
+
+  __atomic_store_n(l->sq_tail, l->sq_local, __ATOMIC_RELEASE);
+  to_submit = l->sq_local - __atomic_load_n(l->sq_head, __ATOMIC_ACQUIRE);
+
+  do
+    r = _ring_enter(l->ring, to_submit, 1, IORING_ENTER_GETEVENTS);
+  while (r < 0 && errno == EINTR);
+
+  return r < 0 ? -errno : 0;
+}
+
+static void _arm_wakeup(IoLoader *l) {
+  struct io_uring_sqe *sqe;
+
+  sqe = _ring_sqe(l, IO_LOADER_WAKEUP);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = l->wakeup;
+  sqe->addr = (uint64_t)(uintptr_t)&l->wakeup_value;
+  sqe->len = sizeof(l->wakeup_value);
+}
+
+static void _queue_open(IoLoader *l, struct IoFile *f) {
+  struct io_uring_sqe *sqe;
+
+  f->state = IO_FILE_OPEN;
+  sqe = _ring_sqe(l, (uint64_t)(uintptr_t)f);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)f->path;
+  sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+static void _queue_stat(IoLoader *l, struct IoFile *f) {
+  struct io_uring_sqe *sqe;
+
+  f->state = IO_FILE_STAT;
+  sqe = _ring_sqe(l, (uint64_t)(uintptr_t)f);
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = f->fd;
+  sqe->addr = (uint64_t)(uintptr_t) "";
+  sqe->len = STATX_TYPE | STATX_SIZE;
+  sqe->off = (uint64_t)(uintptr_t)&f->stx;
+  sqe->statx_flags = AT_EMPTY_PATH;
+}
+
+static void _queue_read(IoLoader *l, struct IoFile *f) {
+  struct io_uring_sqe *sqe;
+
+  f->state = IO_FILE_READ;
+  sqe = _ring_sqe(l, (uint64_t)(uintptr_t)f);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = f->fd;
+  sqe->addr = (uint64_t)(uintptr_t)(f->data + f->size);
+  sqe->len = MIN(f->capacity - f->size, (size_t)INT_MAX);
+  /* pipes and devices have no offset, read at their position */
+  sqe->off = f->sized ? f->size : (uint64_t)-1;
+}
+
+static void _queue_close(IoLoader *l, struct IoFile *f, int result) {
+  struct io_uring_sqe *sqe;
+
+  f->result = result;
+  f->state = IO_FILE_CLOSE;
+  sqe = _ring_sqe(l, (uint64_t)(uintptr_t)f);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = f->fd;
+}
+
+/* outcome of a file on its way to the completion pool */
+struct IoCompletion {
+  IoLoadFunc func;
+  void *context;
+  FileResource *fr;
+  int result;
+  size_t index;
+};
+
+static void _completion_job(void *context) {
+  struct IoCompletion *c = (struct IoCompletion *)context;
+
+  c->func(c->fr, c->result, c->index, c->context);
+  free((void *)c);
+}
+
+/* @func `_io_complete`
+ * @desc Hands the outcome of a file to its completion function on the
+ *       completion pool, so slow or blocking functions don't hold up the
+ *       ring. Runs it right away when there is no pool or it refuses work.
+ */
+static void _io_complete(IoLoader *l, struct IoFile *f, FileResource *fr,
+                         int result) {
+  struct IoCompletion *c;
+
+  if (l->completions) {
+    c = NEW0(struct IoCompletion);
+    if (c) {
+      c->func = f->func;
+      c->context = f->context;
+      c->fr = fr;
+      c->result = result;
+      c->index = f->index;
+      if (thread_pool_submit(l->completions, _completion_job, c) == 0)
+        return;
+      free((void *)c);
+    }
+  }
+
+  f->func(fr, result, f->index, f->context);
+}
+
+static void _file_free(struct IoFile *f) {
+  if (f->data) {
+    if (f->mapped)
+      (void)munmap(f->data, f->size);
+    else
+      free((void *)f->data);
+  }
+  free((void *)f->path);
+  free((void *)f);
+}
+
+/* @func `_file_done`
+ * @desc Hands the outcome of a file to its owner and releases it
+ */
+static void _file_done(IoLoader *l, struct IoFile *f, int result) {
+  FileResource *fr = NULL;
+
+  if (result == 0) {
+    fr = NEW0(FileResource);
+    if (fr) {
+      fr->data = f->data;
+      fr->size = f->size;
+      fr->path = f->path;
+      fr->mapped = f->mapped;
+      f->data = NULL;
+      f->path = NULL;
+    } else
+      result = -ENOMEM;
+  }
+
+  _io_complete(l, f, fr, result);
+
+  l->in_flight--;
+  list_del(&f->list);
+  _file_free(f);
+}
+
+/* @func `_file_stated`
+ * @desc Chooses between mapping and reading once the size is known
+ */
+static void _file_stated(IoLoader *l, struct IoFile *f) {
+  bool regular = (f->stx.stx_mode & S_IFMT) == S_IFREG;
+  int r;
+
+  if (regular && f->stx.stx_size >= PRT_MAP_THRESHOLD) {
+    f->size = f->stx.stx_size;
+    r = map_resource(f->fd, f->size, &f->data);
+    if (r == 0) {
+      f->mapped = true;
+      _queue_close(l, f, 0);
+      return;
+    }
+  }
+
+  /* procfs and sysfs report 0 for files with contents, those are read
+   * up to EOF like files of unknown size, as `load_resource` does */
+  f->sized = regular && f->stx.stx_size > 0;
+  f->size = 0;
+  f->capacity = f->sized ? f->stx.stx_size : PRT_READ_BUFFER_SIZE + 1;
+  f->data = (char *)malloc(f->capacity);
+  if (!f->data) {
+    _queue_close(l, f, -ENOMEM);
+    return;
+  }
+
+  _queue_read(l, f);
+}
+
+/* @func `_file_read`
+ * @desc Continues short reads and grows the buffer of files of unknown
+ *       size until EOF
+ */
+static void _file_read(IoLoader *l, struct IoFile *f, int res) {
+  char *grown;
+
+  if (res == 0) {
+    _queue_close(l, f, 0);
+    return;
+  }
+
+  f->size += res;
+  if (f->size == f->capacity) {
+    if (f->sized) {
+      _queue_close(l, f, 0);
+      return;
+    }
+
+    grown = (char *)realloc(f->data, f->capacity * 2);
+    if (!grown) {
+      _queue_close(l, f, -ENOMEM);
+      return;
+    }
+    f->data = grown;
+    f->capacity *= 2;
+  }
+
+  _queue_read(l, f);
+}
+
+/* @func `_complete`
+ * @desc Advances a file by one step for a completion of the ring
+ */
+static void _complete(IoLoader *l, struct io_uring_cqe *cqe) {
+  struct IoFile *f;
+
+  if (cqe->user_data == IO_LOADER_WAKEUP) {
+    _arm_wakeup(l);
+    return;
+  }
+
+  f = (struct IoFile *)(uintptr_t)cqe->user_data;
+  switch (f->state) {
+  case IO_FILE_OPEN:
+    if (cqe->res < 0) {
+      _file_done(l, f, -EIO);
+      return;
+    }
+    f->fd = cqe->res;
+    _queue_stat(l, f);
+    break;
+
+  case IO_FILE_STAT:
+    if (cqe->res < 0)
+      _queue_close(l, f, -EIO);
+    else
+      _file_stated(l, f);
+    break;
+
+  case IO_FILE_READ:
+    if (cqe->res == -EINTR || cqe->res == -EAGAIN)
+      _queue_read(l, f);
+    else if (cqe->res < 0)
+      _queue_close(l, f, -EIO);
+    else
+      _file_read(l, f, cqe->res);
+    break;
+
+  case IO_FILE_CLOSE:
+    _file_done(l, f, f->result);
+    break;
+  }
+}
+
+/* @func `_io_fail`
+ * @desc Shuts the loader down after the ring failed. Queued and in-flight
+ *       files complete with an error. The kernel may still refer to the
+ *       buffers of in-flight files, so they stay on `active` until the
+ *       ring is closed.
+ */
+static void _io_fail(IoLoader *l, int error) {
+  struct list_head queued, *h, *t;
+  struct IoFile *f;
+
+  _Log(LL_ERROR, "io_uring_enter failed: %i", error);
+
+  /* later submissions are refused and go elsewhere */
+  INIT_LIST_HEAD(&queued);
+  lock_acquire(&l->lock);
+  l->stopping = true;
+  list_for_each_safe(h, t, &l->queue) {
+    list_del(h);
+    list_add_tail(h, &queued);
+  }
+  lock_release(&l->lock);
+
+  list_for_each_safe(h, t, &queued) {
+    f = (struct IoFile *)h;
+    _io_complete(l, f, NULL, -EIO);
+    _file_free(f);
+  }
+
+  list_for_each(h, &l->active) {
+    f = (struct IoFile *)h;
+    _io_complete(l, f, NULL, -EIO);
+  }
+}
+
+/* @func `_io_thread`
+ * @desc Starts queued files while fewer than `depth` are in flight,
+ *       submits all pending steps at once and sleeps in the kernel until
+ *       one completes or `io_loader_submit` writes the wakeup eventfd
+ *
+ * @ret `NULL`
+ */
+static void *_io_thread(void *p) {
+  IoLoader *l = (IoLoader *)p;
+  struct IoFile *f;
+  unsigned head;
+  bool stopping;
+  int r;
+
+  _arm_wakeup(l);
+
+  for (;;) {
+    lock_acquire(&l->lock);
+    while (l->in_flight < l->depth && !list_empty(&l->queue)) {
+      f = (struct IoFile *)l->queue.next;
+      list_del(&f->list);
+      list_add_tail(&f->list, &l->active);
+      l->in_flight++;
+      _queue_open(l, f);
+    }
+    stopping = l->stopping && list_empty(&l->queue);
+    lock_release(&l->lock);
+
+    if (stopping && !l->in_flight)
+      break;
+
+    r = _ring_submit(l);
+    if (r < 0 && r != -EBUSY) {
+      _io_fail(l, r);
+      break;
+    }
+
+    head = *l->cq_head;
+    while (head != __atomic_load_n(l->cq_tail, __ATOMIC_ACQUIRE)) {
+      _complete(l, &l->cqes[head & l->cq_mask]);
+      head++;
+      __atomic_store_n(l->cq_head, head, __ATOMIC_RELEASE);
+    }
+  }
+
+  return NULL;
+}
+
+/* @func `io_loader_new`
+ * @desc Sets up a ring and starts the I/O thread
+ *
+ * @param(depth)       Files in flight at once, 0 for the default
+ * @param(completions) Runs the completion functions, `NULL` runs them on
+ *                     the I/O thread; must outlive the loader
+ * @param(out_loader)  Receives the loader
+ *
+ * @ret 0 on success, -ENOSYS when io_uring can't be used or error code
+ */
+int io_loader_new(unsigned depth, ThreadPool *completions,
+                  IoLoader **out_loader) {
+  struct io_uring_params params;
+  IoLoader *l;
+  int r;
+  assert(out_loader);
+
+  l = NEW0(IoLoader);
+  if (!l)
+    return -ENOMEM;
+
+  depth = depth ? depth : IO_LOADER_DEPTH;
+  memset(&params, 0, sizeof(params));
+  /* every file has at most one step queued, plus the wakeup read */
+  l->ring = _ring_setup(depth + 1, &params);
+  if (l->ring < 0) {
+    free((void *)l);
+    return -ENOSYS;
+  }
+
+  r = _ring_supported(l->ring) ? _ring_map(l, &params) : -ENOSYS;
+  if (r < 0)
+    goto err;
+  l->depth = params.sq_entries - 1;
+
+  l->wakeup = eventfd(0, EFD_CLOEXEC);
+  if (l->wakeup < 0) {
+    r = -errno;
+    goto unmap;
+  }
+
+  l->completions = completions;
+  lock_init_normal(&l->lock);
+  INIT_LIST_HEAD(&l->queue);
+  INIT_LIST_HEAD(&l->active);
+
+  r = pthread_create(&l->thread, NULL, _io_thread, l);
+  if (r != 0) {
+    r = -r;
+    lock_unref(&l->lock);
+    close(l->wakeup);
+    goto unmap;
+  }
+
+  *out_loader = l;
+  return 0;
+
+unmap:
+  _ring_unmap(l);
+err:
+  close(l->ring);
+  free((void *)l);
+  return r;
+}
+
+static void _wake(IoLoader *l) {
+  uint64_t one = 1;
+
+  (void)!write(l->wakeup, &one, sizeof(one));
+}
+
+/* @func `io_loader_submit`
+ * @desc Queues `count` files and wakes the I/O thread, `func` is called
+ *       once per file
+ *
+ * @param(loader)  I/O loader
+ * @param(paths)   Paths to load
+ * @param(count)   Number of paths
+ * @param(func)    Completion function
+ * @param(context) Passed to `func`
+ *
+ * @ret 0 on success, -ESHUTDOWN once the loader stops or failed or error
+ *      code, nothing is queued on failure
+ */
+int io_loader_submit(IoLoader *loader, const char *const *paths, size_t count,
+                     IoLoadFunc func, void *context) {
+  struct list_head files, *h, *t;
+  struct IoFile *f;
+  size_t i;
+  int r = -ENOMEM;
+  assert(loader);
+  assert(paths);
+  assert(func);
+
+  INIT_LIST_HEAD(&files);
+  for (i = 0; i < count; ++i) {
+    f = NEW0(struct IoFile);
+    if (!f)
+      goto err;
+    list_add_tail(&f->list, &files);
+
+    f->path = strdup(paths[i]);
+    if (!f->path)
+      goto err;
+    f->func = func;
+    f->context = context;
+    f->index = i;
+    f->fd = -1;
+  }
+
+  lock_acquire(&loader->lock);
+  if (loader->stopping) {
+    lock_release(&loader->lock);
+    r = -ESHUTDOWN;
+    goto err;
+  }
+  list_for_each_safe(h, t, &files) {
+    list_del(h);
+    list_add_tail(h, &loader->queue);
+  }
+  lock_release(&loader->lock);
+
+  _wake(loader);
+  return 0;
+
+err:
+  list_for_each_safe(h, t, &files) {
+    f = (struct IoFile *)h;
+    free((void *)f->path);
+    free((void *)f);
+  }
+  return r;
+}
+
+/* @func `io_loader_unref`
+ * @desc Completes every queued file, stops the I/O thread and tears down
+ *       the ring
+ *
+ * @ret 0 on success or error code
+ */
+int io_loader_unref(IoLoader *loader) {
+  struct list_head *h, *t;
+  struct IoFile *f;
+  assert(loader);
+
+  lock_acquire(&loader->lock);
+  loader->stopping = true;
+  lock_release(&loader->lock);
+  _wake(loader);
+
+  pthread_join(loader->thread, NULL);
+
+  _ring_unmap(loader);
+  close(loader->ring);
+  close(loader->wakeup);
+
+  /* left by `_io_fail`, already completed; a queued close may have run */
+  list_for_each_safe(h, t, &loader->active) {
+    f = (struct IoFile *)h;
+    if (f->fd >= 0 && f->state != IO_FILE_CLOSE)
+      close(f->fd);
+    _file_free(f);
+  }
+
+  lock_unref(&loader->lock);
+  free((void *)loader);
+
+  return 0;
+}
+
+#else
+
+int io_loader_new(unsigned depth, ThreadPool *completions,
+                  IoLoader **out_loader) {
+  return -ENOSYS;
+}
+
+int io_loader_submit(IoLoader *loader, const char *const *paths, size_t count,
+                     IoLoadFunc func, void *context) {
+  return -ENOSYS;
+}
+
+int io_loader_unref(IoLoader *loader) { return -ENOSYS; }
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <prt/shared/basic.h>
+#include <prt/runtime/resources.h>
+#include <prt/runtime/thread_pool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bulk file loading on a dedicated thread through io_uring. Opens, size
+ * queries, reads and closes of many files are queued on one ring and
+ * submitted together, keeping up to `depth` files in flight. The thread
+ * only submits and reaps, completions are handed to a thread pool.
+ */
+
+/* receives the resource or `NULL` and the error for the path at `index` of
+ * its submission, runs on the completion pool or, without one, on the I/O
+ * thread
+ */
+typedef void (*IoLoadFunc)(FileResource *fr, int result, size_t index,
+                           void *context);
+
+typedef struct _IoLoader IoLoader;
+
+/* -ENOSYS when the kernel or the build lacks io_uring */
+int io_loader_new(unsigned depth, ThreadPool *completions,
+                  IoLoader **out_loader);
+/* queues loads without blocking, `paths` are copied */
+int io_loader_submit(IoLoader *loader, const char *const *paths, size_t count,
+                     IoLoadFunc func, void *context);
+/* finishes queued loads and joins the I/O thread, completions handed to the
+ * pool may still be running */
+int io_loader_unref(IoLoader *loader);
+
+#ifdef __cplusplus
+}
+#endif
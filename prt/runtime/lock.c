@@ -71,6 +71,36 @@ void lock_unref(Lock *p) {
   pthread_mutex_destroy(p);
 }
 
+void rwlock_init(RwLock *p) {
+  assert(p);
+
+  pthread_rwlock_init(p, NULL);
+}
+
+void rwlock_acquire_read(RwLock *p) {
+  assert(p);
+
+  pthread_rwlock_rdlock(p);
+}
+
+void rwlock_acquire_write(RwLock *p) {
+  assert(p);
+
+  pthread_rwlock_wrlock(p);
+}
+
+void rwlock_release(RwLock *p) {
+  assert(p);
+
+  pthread_rwlock_unlock(p);
+}
+
+void rwlock_unref(RwLock *p) {
+  assert(p);
+
+  pthread_rwlock_destroy(p);
+}
+
 int waithandle_wait_timed(WaitHandle *wh, uint64_t msec) {
   struct timespec t, sum, toadd;
   int r;
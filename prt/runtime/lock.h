@@ -14,6 +14,7 @@ void time_from_ms(struct timespec *ts, uint64_t msec);
 
 typedef sem_t WaitHandle;
 typedef pthread_mutex_t Lock;
+typedef pthread_rwlock_t RwLock;
 
 void lock_init(Lock *p);
 void lock_init_normal(Lock *p);
@@ -22,6 +23,13 @@ void lock_release(Lock *p);
 void lock_unref(Lock *p);
 int lock_acquire_timed(Lock *p, uint64_t msecs);
 
+/* many readers or a single writer; not recursive for writers */
+void rwlock_init(RwLock *p);
+void rwlock_acquire_read(RwLock *p);
+void rwlock_acquire_write(RwLock *p);
+void rwlock_release(RwLock *p);
+void rwlock_unref(RwLock *p);
+
 #define waithandle_init(wh)                                                    \
   ({                                                                           \
     assert(wh);                                                                \
@@ -1,14 +1,70 @@
 #include <prt/runtime/resource_manager.h>
+#include <prt/shared/list.h>
+
+struct RmWaiter;
+typedef void (*RmWaiterFunc)(struct RmWaiter *, FileResource *);
+
+/* a request for a resource that is being loaded */
+struct RmWaiter {
+  struct list_head list;
+  RmWaiterFunc done;
+};
+
+/* a resource being loaded, entry of `loading` */
+struct RmPending {
+  ResourceManager *rm;
+  /* absolute path, the key */
+  char *path;
+  struct list_head waiters;
+};
+
+/* outcome of `_rm_acquire` */
+enum rm_acquire_result {
+  RM_CACHED,
+  RM_ATTACHED,
+  RM_LEADER,
+};
 
 struct LoadArgs {
+  struct RmWaiter waiter;
   ResourceManager *rm;
   const char *path;
   RmLoadCallback callback;
   WaitHandle *waithandle;
-  struct LoadThread *thread;
   void *cbcontext;
 };
 
+struct SyncLoad {
+  struct RmWaiter waiter;
+  WaitHandle wh;
+  FileResource *fr;
+};
+
+struct BatchArgs;
+
+/* a path of a batch that isn't cached yet */
+struct BatchSlot {
+  struct RmWaiter waiter;
+  struct BatchArgs *batch;
+  /* position in the batch */
+  size_t index;
+};
+
+struct BatchArgs {
+  ResourceManager *rm;
+  RmBatchCallback callback;
+  WaitHandle *waithandle;
+  void *cbcontext;
+  FileResource **resources;
+  size_t count;
+  struct BatchSlot *slots;
+  /* loads started by this batch */
+  struct RmPending **leaders;
+  size_t num_leaders;
+  /* slots still loading, plus one while the batch is being set up */
+  size_t remaining;
+};
+
 /* @func `_free_file_resource`
  * @desc Releases file resource object
  *
@@ -18,51 +74,162 @@ struct LoadArgs {
  */
 void _free_file_resource(FileResource *fr) { (void)file_resource_unref(fr); }
 
-/* @func `_resource_loader`
- * @desc Used to asynchronously load resource
+/* @func `_rm_acquire`
+ * @desc Looks `path` up in the cache, otherwise attaches `waiter` to the
+ *       load of `path` in flight or starts one. The first requester of a
+ *       path becomes the leader: it loads the resource and passes it to
+ *       `_rm_complete`, which hands it to every attached waiter, the
+ *       leader's own included.
  *
- * @param(load_args) Load arguments
+ * @param(manager)     Resource manager object
+ * @param(path)        Absolute path to the resource
+ * @param(waiter)      Notified when the resource is loaded, unless cached
+ * @param(out_fr)      Receives the cached resource
+ * @param(out_pending) Receives the load the leader has to carry out
  *
- * @ret `NULL`
+ * @ret `RM_CACHED`, `RM_ATTACHED`, `RM_LEADER` or error code
  */
-void *_resource_loader(void *load_args) {
-  struct LoadArgs *args;
-  FileResource *fr;
-  RmLoadCallback loadcb;
-  void *loadcb_context;
-  WaitHandle *handle;
-  const char *path, *duppath;
+static int _rm_acquire(ResourceManager *manager, const char *path,
+                       struct RmWaiter *waiter, FileResource **out_fr,
+                       struct RmPending **out_pending) {
+  struct RmPending *pending;
   int r;
 
-  args = (struct LoadArgs *)load_args;
-  path = strjoina(args->rm->work_dir, "/", args->path);
-  /* search cache first */
-  r = hashtable_find(args->rm->resources, HASH(path), (void *)path,
-                     (void **)&fr);
-  if (r == 0)
-    goto out;
+  /* cache hits don't need the lock */
+  if (hashtable_find(manager->resources, HASH(path), (void *)path,
+                     (void **)out_fr) == 0)
+    return RM_CACHED;
 
-  r = file_resource_new(path, &fr);
-  if (r < 0) {
-    Log("async_resource_loader error: %i\n", r);
-    fr = NULL;
+  lock_acquire(&manager->loading_lock);
+
+  /* completed since the lookup above */
+  if (hashtable_find(manager->resources, HASH(path), (void *)path,
+                     (void **)out_fr) == 0) {
+    lock_release(&manager->loading_lock);
+    return RM_CACHED;
+  }
+
+  if (hashtable_find(manager->loading, HASH(path), (void *)path,
+                     (void **)&pending) == 0) {
+    list_add_tail(&waiter->list, &pending->waiters);
+    lock_release(&manager->loading_lock);
+    return RM_ATTACHED;
+  }
+
+  r = -ENOMEM;
+  pending = NEW0(struct RmPending);
+  if (!pending)
     goto out;
+
+  pending->rm = manager;
+  pending->path = strdup(path);
+  if (!pending->path)
+    goto err;
+
+  INIT_LIST_HEAD(&pending->waiters);
+  list_add_tail(&waiter->list, &pending->waiters);
+
+  r = hashtable_add_str(manager->loading, pending->path, (void *)pending);
+  if (r < 0)
+    goto err;
+
+  *out_pending = pending;
+  r = RM_LEADER;
+  goto out;
+
+err:
+  free((void *)pending->path);
+  free((void *)pending);
+out:
+  lock_release(&manager->loading_lock);
+  return r;
+}
+
+/* @func `_rm_complete`
+ * @desc Caches the resource of a load in flight and hands it, or `NULL`
+ *       when loading failed, to every waiter. A resource added by
+ *       `resource_manager_add` meanwhile wins over ours.
+ *
+ * @param(pending) Load started by `_rm_acquire`, released here
+ * @param(fr)      Loaded resource or `NULL`
+ *
+ * @ret nothing
+ */
+static void _rm_complete(struct RmPending *pending, FileResource *fr) {
+  ResourceManager *manager = pending->rm;
+  struct list_head waiters, *h, *t;
+  struct RmWaiter *waiter;
+  FileResource *cached;
+  int r;
+
+  __sync_fetch_and_add(&manager->num_reads, 1);
+
+  lock_acquire(&manager->loading_lock);
+
+  if (fr) {
+    r = hashtable_add_str(manager->resources, fr->path, (void *)fr);
+    if (r == -EEXIST &&
+        hashtable_find(manager->resources, HASH(fr->path), (void *)fr->path,
+                       (void **)&cached) == 0) {
+      file_resource_unref(fr);
+      fr = cached;
+    } else if (r < 0) {
+      Log("resource loader add error: %i\n", r);
+      file_resource_unref(fr);
+      fr = NULL;
+    }
+  }
+
+  (void)hashtable_remove(manager->loading, HASH(pending->path),
+                         (void *)pending->path, NULL);
+
+  /* later requests find the resource in the cache */
+  INIT_LIST_HEAD(&waiters);
+  list_for_each_safe(h, t, &pending->waiters) {
+    list_del(h);
+    list_add_tail(h, &waiters);
   }
 
-  r = hashtable_add_str(args->rm->resources, fr->path, (void *)fr);
+  lock_release(&manager->loading_lock);
+
+  list_for_each_safe(h, t, &waiters) {
+    waiter = (struct RmWaiter *)h;
+    list_del(h);
+    waiter->done(waiter, fr);
+  }
+
+  free((void *)pending->path);
+  free((void *)pending);
+}
+
+/* @func `_rm_load`
+ * @desc Loads the resource of a leader and completes its waiters
+ *
+ * @ret nothing
+ */
+static void _rm_load(struct RmPending *pending) {
+  FileResource *fr;
+  int r;
+
+  r = file_resource_new(pending->path, &fr);
   if (r < 0) {
-    file_resource_unref(fr);
-    Log("async_resource_loader add error: %i\n", r);
+    Log("resource loader error: %i\n", r);
     fr = NULL;
   }
+  _rm_complete(pending, fr);
+}
 
-out:
-  /* lock, remove our thread from job list, release memory, unlock */
-  lock_acquire(&args->rm->loads_lock);
-  list_del(&args->thread->list);
-  free((void *)args->thread);
-  lock_release(&args->rm->loads_lock);
-  /* unlocked */
+/* @func `_async_done`
+ * @desc Completes an asynchronous load, invokes the callback and signals
+ *       the waiter
+ *
+ * @ret nothing
+ */
+static void _async_done(struct RmWaiter *waiter, FileResource *fr) {
+  struct LoadArgs *args = (struct LoadArgs *)waiter;
+  RmLoadCallback loadcb;
+  void *loadcb_context;
+  WaitHandle *handle;
 
   __sync_fetch_and_sub(&args->rm->num_loads, 1);
 
@@ -82,12 +249,97 @@ out:
   /* we're done, signal the waiter */
   if (handle)
     waithandle_signal(handle);
+}
 
-  return NULL;
+/* @func `_resource_loader`
+ * @desc Used to asynchronously load resource, runs on the worker pool.
+ *       Loads of a path already in flight attach to it and return, the
+ *       worker is free for other loads meanwhile.
+ *
+ * @param(load_args) Load arguments
+ *
+ * @ret nothing
+ */
+void _resource_loader(void *load_args) {
+  struct LoadArgs *args;
+  struct RmPending *pending;
+  FileResource *fr = NULL;
+  const char *path;
+  int r;
+
+  args = (struct LoadArgs *)load_args;
+  args->waiter.done = _async_done;
+  path = strjoina(args->rm->work_dir, "/", args->path);
+
+  r = _rm_acquire(args->rm, path, &args->waiter, &fr, &pending);
+  if (r == RM_LEADER)
+    _rm_load(pending);
+  else if (r != RM_ATTACHED) {
+    if (r < 0)
+      Log("async_resource_loader error: %i\n", r);
+    _async_done(&args->waiter, fr);
+  }
+}
+
+/* @func `_get_workers`
+ * @desc Returns the worker pool, starting it on first use
+ *
+ * @ret 0 on success or error code
+ */
+static int _get_workers(ResourceManager *manager, ThreadPool **out_workers) {
+  ThreadPool *workers;
+  int r = 0;
+
+  workers = __atomic_load_n(&manager->workers, __ATOMIC_ACQUIRE);
+  if (!workers) {
+    lock_acquire(&manager->loads_lock);
+    workers = manager->workers;
+    r = workers ? 0 : thread_pool_new(manager->num_workers, &workers);
+    if (r == 0)
+      __atomic_store_n(&manager->workers, workers, __ATOMIC_RELEASE);
+    lock_release(&manager->loads_lock);
+  }
+
+  *out_workers = workers;
+  return r;
+}
+
+/* @func `_get_io`
+ * @desc Returns the io_uring loader, starting it on first use
+ *
+ * @ret the loader or `NULL` when batches have to use the worker pool
+ */
+static IoLoader *_get_io(ResourceManager *manager) {
+  ThreadPool *workers;
+  IoLoader *io;
+  int r;
+
+  io = __atomic_load_n(&manager->io, __ATOMIC_ACQUIRE);
+  if (io)
+    return io;
+
+  /* completions run on the workers, the ring thread only does I/O */
+  if (_get_workers(manager, &workers) < 0)
+    workers = NULL;
+
+  lock_acquire(&manager->loads_lock);
+  io = manager->io;
+  if (!io && !manager->io_unavailable) {
+    r = io_loader_new(0, workers, &io);
+    if (r == 0)
+      __atomic_store_n(&manager->io, io, __ATOMIC_RELEASE);
+    else {
+      Log("io_uring unavailable, batches use the worker pool: %i\n", r);
+      manager->io_unavailable = true;
+    }
+  }
+  lock_release(&manager->loads_lock);
+
+  return io;
 }
 
 /* @func `_insert_thread`
- * @desc Creates a new workload based on pthreads
+ * @desc Queues a load on the worker pool, which is started on first use
  *
  * @param(manager)    Resource manager object
  * @param(path)       Relative path to the resource
@@ -100,45 +352,32 @@ out:
 int _insert_thread(ResourceManager *manager, const char *path,
                    RmLoadCallback cb, void *cbcontext, WaitHandle *waithandle) {
   struct LoadArgs *args;
-  struct LoadThread *thread;
+  ThreadPool *workers;
   int r;
 
-  thread = NEW0(struct LoadThread);
-  if (!thread)
-    return -ENOMEM;
+  r = _get_workers(manager, &workers);
+  if (r < 0)
+    return r;
 
   args = NEW0(struct LoadArgs);
-  if (!args) {
-    free((void *)thread);
+  if (!args)
     return -ENOMEM;
-  }
 
   args->callback = cb;
   args->path = path;
   args->rm = manager;
   args->waithandle = waithandle;
   args->cbcontext = cbcontext;
-  args->thread = thread;
 
-  /* lock `manager` and insert a new thread into the list */
-  lock_acquire(&manager->loads_lock);
-  list_add_tail(&thread->list, &manager->loads);
-  lock_release(&manager->loads_lock);
-  /* unlocked */
+  __sync_fetch_and_add(&manager->num_loads, 1);
 
-  r = pthread_create(&thread->thread, NULL, _resource_loader, args);
+  r = thread_pool_submit(workers, _resource_loader, args);
   if (r < 0) {
-    lock_acquire(&manager->loads_lock);
-    list_del(&thread->list);
-    lock_release(&manager->loads_lock);
-
+    __sync_fetch_and_sub(&manager->num_loads, 1);
     free((void *)args);
-    free((void *)thread);
     return r;
   }
 
-  __sync_fetch_and_add(&manager->num_loads, 1);
-
   return 0;
 }
 
@@ -146,11 +385,14 @@ int _insert_thread(ResourceManager *manager, const char *path,
  * @desc Creates a new resource manager object
  *
  * @param(workdir)     Absolute working directory path
+ * @param(workers)     Number of threads for asynchronous loads, 0 for one
+ *                     per online CPU
  * @param(out_manager) Receives the created object
  *
  * @ret 0 on success or error code
  */
-int resource_manager_new(const char *workdir, ResourceManager **out_manager) {
+int resource_manager_new(const char *workdir, size_t workers,
+                         ResourceManager **out_manager) {
   ResourceManager *manager;
   int r;
   assert(workdir);
@@ -172,7 +414,17 @@ int resource_manager_new(const char *workdir, ResourceManager **out_manager) {
     return r;
   }
 
-  INIT_LIST_HEAD(&manager->loads);
+  r = hashtable_new(127, &manager->loading);
+  if (r < 0) {
+    (void)hashtable_unref(manager->resources);
+    free((void *)manager->work_dir);
+    free((void *)manager);
+    return r;
+  }
+
+  lock_init(&manager->loads_lock);
+  lock_init_normal(&manager->loading_lock);
+  manager->num_workers = workers;
   manager->destructor = _free_file_resource;
   *out_manager = manager;
 
@@ -181,15 +433,32 @@ int resource_manager_new(const char *workdir, ResourceManager **out_manager) {
 
 /* add fails on duplicate insert */
 int resource_manager_add(ResourceManager *manager, FileResource *fr) {
+  int r;
   assert(manager);
   assert(fr);
 
-  return hashtable_add_str(manager->resources, fr->path, fr);
+  /* the hashtable's own check for duplicates doesn't hold the lock */
+  lock_acquire(&manager->loading_lock);
+  r = hashtable_add_str(manager->resources, fr->path, fr);
+  lock_release(&manager->loading_lock);
+
+  return r;
 }
 
-/* either loads from path or returns a cached file resource */
+static void _sync_done(struct RmWaiter *waiter, FileResource *fr) {
+  struct SyncLoad *load = (struct SyncLoad *)waiter;
+
+  load->fr = fr;
+  waithandle_signal(&load->wh);
+}
+
+/* either loads from path or returns a cached file resource, a load of the
+ * same path in flight is waited for; don't call it from load callbacks
+ * for paths that may still be loading, those run on the loading threads */
 int resource_manager_load(ResourceManager *manager, const char *path,
                           FileResource **out_fr) {
+  struct RmPending *pending;
+  struct SyncLoad load;
   const char *p;
   FileResource *fr;
   int r;
@@ -197,28 +466,38 @@ int resource_manager_load(ResourceManager *manager, const char *path,
   assert(path);
 
   p = strjoina(manager->work_dir, "/", path);
-  r = hashtable_find(manager->resources, HASH(p), (void *)p, (void **)&fr);
-  if (!r) {
+  load.waiter.done = _sync_done;
+  load.fr = NULL;
+  waithandle_init(&load.wh);
+
+  r = _rm_acquire(manager, p, &load.waiter, &fr, &pending);
+  if (r == RM_CACHED) {
     /* cache hit, update `out_fr` if not null */
     if (out_fr)
       *out_fr = fr;
-    return 0;
+    r = 0;
+    goto out;
   }
-
-  r = file_resource_new(p, &fr);
   if (r < 0)
-    return r;
+    goto out;
 
-  r = resource_manager_add(manager, fr);
-  if (r < 0) {
-    file_resource_unref(fr);
-    return r;
+  if (r == RM_LEADER) {
+    r = file_resource_new(p, &fr);
+    _rm_complete(pending, r < 0 ? NULL : fr);
   }
 
-  if (out_fr)
-    *out_fr = fr;
+  /* the leader's own waiter was notified by `_rm_complete` */
+  waithandle_wait(&load.wh);
+  if (load.fr) {
+    if (out_fr)
+      *out_fr = load.fr;
+    r = 0;
+  } else if (r >= 0)
+    r = -EIO;
 
-  return 0;
+out:
+  waithandle_unref(&load.wh);
+  return r;
 }
 
 /* waithandle is signalled after cb is invoked */
@@ -233,6 +512,189 @@ int resource_manager_load_async(ResourceManager *manager, const char *path,
   return _insert_thread(manager, path, cb, cbcontext, waithandle);
 }
 
+static void _batch_free(struct BatchArgs *batch) {
+  free((void *)batch->leaders);
+  free((void *)batch->slots);
+  free((void *)batch->resources);
+  free((void *)batch);
+}
+
+/* @func `_batch_finish`
+ * @desc Hands the resources of a complete batch to its callback, then
+ *       signals the waiter
+ *
+ * @param(batch) Batch arguments, released here
+ *
+ * @ret nothing
+ */
+static void _batch_finish(void *batch_args) {
+  struct BatchArgs *batch = (struct BatchArgs *)batch_args;
+
+  __sync_fetch_and_sub(&batch->rm->num_loads, 1);
+
+  if (batch->callback)
+    batch->callback(batch->resources, batch->count, batch->cbcontext);
+  if (batch->waithandle)
+    waithandle_signal(batch->waithandle);
+
+  _batch_free(batch);
+}
+
+/* stores the outcome of a slot, the last one finishes the batch */
+static void _batch_done(struct RmWaiter *waiter, FileResource *fr) {
+  struct BatchSlot *slot = (struct BatchSlot *)waiter;
+  struct BatchArgs *batch = slot->batch;
+
+  batch->resources[slot->index] = fr;
+  if (__sync_sub_and_fetch(&batch->remaining, 1) == 0)
+    _batch_finish(batch);
+}
+
+/* completion of the io_uring loader, runs on the worker pool */
+static void _batch_io_loaded(FileResource *fr, int result, size_t index,
+                             void *context) {
+  struct BatchArgs *batch = (struct BatchArgs *)context;
+
+  if (result < 0)
+    Log("batch resource loader error: %i\n", result);
+  _rm_complete(batch->leaders[index], fr);
+}
+
+/* fallback for a single load, runs on the worker pool */
+static void _batch_job(void *context) {
+  _rm_load((struct RmPending *)context);
+}
+
+/* @func `_batch_submit`
+ * @desc Starts the loads a batch leads, in one io_uring submission when
+ *       possible and as one worker pool job per load otherwise. Loads that
+ *       can't be started fail, their waiters receive `NULL`.
+ *
+ * @ret nothing
+ */
+static void _batch_submit(ResourceManager *manager, struct BatchArgs *batch) {
+  ThreadPool *workers;
+  const char **paths;
+  IoLoader *io;
+  size_t i, n = batch->num_leaders;
+  int r;
+
+  if (!n)
+    return;
+
+  io = _get_io(manager);
+  if (io) {
+    paths = (const char **)malloc(n * sizeof(*paths));
+    r = -ENOMEM;
+    if (paths) {
+      for (i = 0; i < n; ++i)
+        paths[i] = batch->leaders[i]->path;
+      r = io_loader_submit(io, paths, n, _batch_io_loaded, batch);
+      free((void *)paths);
+    }
+    if (r == 0)
+      return;
+  }
+
+  r = _get_workers(manager, &workers);
+  for (i = 0; i < n; ++i) {
+    if (r == 0)
+      r = thread_pool_submit(workers, _batch_job, batch->leaders[i]);
+    if (r < 0) {
+      Log("batch resource loader submit error: %i\n", r);
+      _rm_complete(batch->leaders[i], NULL);
+    }
+  }
+}
+
+/* @func `resource_manager_load_batch`
+ * @desc Loads many resources at once. Cached resources are taken from the
+ *       cache, paths already loading wait for those loads and the others
+ *       are opened and read together through io_uring and added to it.
+ *       Neither blocks the caller.
+ *
+ * @param(manager)    Resource manager object
+ * @param(paths)      Relative paths to the resources, copied
+ * @param(count)      Number of paths
+ * @param(cb)         Optional callback receiving the resources, `NULL`
+ *                    for those that failed to load
+ * @param(cbcontext)  Optional callback context to be passed
+ * @param(waithandle) Signalled after `cb` is invoked
+ *
+ * @ret 0 on success or error code
+ */
+int resource_manager_load_batch(ResourceManager *manager,
+                                const char *const *paths, size_t count,
+                                RmBatchCallback cb, void *cbcontext,
+                                WaitHandle *waithandle) {
+  struct BatchArgs *batch;
+  struct BatchSlot *slot;
+  struct RmPending *pending;
+  ThreadPool *workers;
+  FileResource *fr;
+  char *path;
+  size_t i, len;
+  int r;
+  assert(manager);
+  assert(paths || !count);
+
+  waithandle_init(waithandle);
+
+  batch = NEW0(struct BatchArgs);
+  if (!batch)
+    return -ENOMEM;
+
+  batch->rm = manager;
+  batch->callback = cb;
+  batch->cbcontext = cbcontext;
+  batch->waithandle = waithandle;
+  batch->count = count;
+  batch->resources = NEW0N(FileResource *, MAX(count, (size_t)1));
+  batch->slots = NEW0N(struct BatchSlot, MAX(count, (size_t)1));
+  batch->leaders = NEW0N(struct RmPending *, MAX(count, (size_t)1));
+  if (!batch->resources || !batch->slots || !batch->leaders) {
+    _batch_free(batch);
+    return -ENOMEM;
+  }
+
+  __sync_fetch_and_add(&manager->num_loads, 1);
+
+  /* slots may complete while later ones are still acquired */
+  batch->remaining = 1;
+  for (i = 0; i < count; ++i) {
+    len = strlen(manager->work_dir) + strlen(paths[i]) + 2;
+    path = (char *)malloc(len);
+    if (!path)
+      continue;
+    snprintf(path, len, "%s/%s", manager->work_dir, paths[i]);
+
+    slot = &batch->slots[i];
+    slot->waiter.done = _batch_done;
+    slot->batch = batch;
+    slot->index = i;
+    __sync_fetch_and_add(&batch->remaining, 1);
+
+    r = _rm_acquire(manager, path, &slot->waiter, &fr, &pending);
+    if (r == RM_LEADER)
+      batch->leaders[batch->num_leaders++] = pending;
+    else if (r != RM_ATTACHED) {
+      batch->resources[i] = r < 0 ? NULL : fr;
+      __sync_fetch_and_sub(&batch->remaining, 1);
+    }
+    free((void *)path);
+  }
+
+  _batch_submit(manager, batch);
+
+  /* the callback never runs on the caller, unless the pool is unusable */
+  if (__sync_sub_and_fetch(&batch->remaining, 1) == 0 &&
+      (_get_workers(manager, &workers) < 0 ||
+       thread_pool_submit(workers, _batch_finish, batch) < 0))
+    _batch_finish(batch);
+
+  return 0;
+}
+
 int resource_manager_remove(ResourceManager *manager, FileResource *fr) {
   return hashtable_remove(manager->resources, HASH(fr->path), (void *)fr->path,
                           NULL);
@@ -241,16 +703,21 @@ int resource_manager_remove(ResourceManager *manager, FileResource *fr) {
 int resource_manager_unref(ResourceManager *manager) {
   HtIterator *it;
   void *resource;
-  size_t i, loads;
   int r;
-  struct list_head *h, *t;
   assert(manager);
 
-  loads = manager->num_loads;
-
-  /* wait for queued jobs to finish */
-  list_for_each_safe(h, t, &manager->loads)
-      assert(pthread_join(((struct LoadThread *)h)->thread, NULL) == 0);
+  /* the I/O thread hands its last completions to the workers, so it stops
+   * first; the workers then run everything queued to completion and batches
+   * started meanwhile fail instead of using the stopped loader */
+  if (manager->io) {
+    (void)io_loader_unref(manager->io);
+    lock_acquire(&manager->loads_lock);
+    manager->io = NULL;
+    manager->io_unavailable = true;
+    lock_release(&manager->loads_lock);
+  }
+  if (manager->workers)
+    (void)thread_pool_unref(manager->workers);
 
   /* check that we are race-free */
   assert(manager->num_loads == 0);
@@ -262,12 +729,20 @@ int resource_manager_unref(ResourceManager *manager) {
     while (hashtable_iterator_next(it, NULL, &resource)) {
       manager->destructor(resource);
     }
+    (void)hashtable_iterator_unref(it);
   }
 
   r = hashtable_unref(manager->resources);
   if (r < 0)
     return r;
 
+  r = hashtable_unref(manager->loading);
+  if (r < 0)
+    return r;
+
+  lock_unref(&manager->loading_lock);
+  lock_unref(&manager->loads_lock);
+  free((void *)manager->work_dir);
   free((void *)manager);
 
   return 0;
@@ -3,8 +3,9 @@
 #include <prt/shared/basic.h>
 #include <prt/shared/hashtable.h>
 #include <prt/runtime/resources.h>
+#include <prt/runtime/io_loader.h>
 #include <prt/runtime/lock.h>
-#include <prt/shared/list.h>
+#include <prt/runtime/thread_pool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,28 +13,46 @@ extern "C" {
 
 typedef void (*RmFreeItem)(FileResource *);
 typedef void (*RmLoadCallback)(FileResource *, void *);
-
-struct LoadThread {
-  struct list_head list;
-  pthread_t thread;
-};
+/* receives one resource or `NULL` per requested path, in request order */
+typedef void (*RmBatchCallback)(FileResource **, size_t, void *);
 
 typedef struct _ResourceManager {
   char *work_dir;
   Hashtable *resources;
+  /* loads in flight by absolute path, requests for those attach to them
+   * instead of loading again */
+  Hashtable *loading;
+  /* guards `loading` and additions to `resources` */
+  Lock loading_lock;
+  /* guards the creation of `workers` and `io` */
   Lock loads_lock;
-  struct list_head loads;
+  /* runs asynchronous loads, started by the first one */
+  ThreadPool *workers;
+  /* runs batched loads, started by the first one; batches go to `workers`
+   * when io_uring is unavailable */
+  IoLoader *io;
+  bool io_unavailable;
+  size_t num_workers;
   size_t num_loads;
+  /* loads that went to the file system, requests attached to a load in
+   * flight or served from the cache don't count */
+  size_t num_reads;
   RmFreeItem destructor;
 } ResourceManager;
 
-int resource_manager_new(const char *workdir, ResourceManager **out_manager);
+/* 0 workers means one per online CPU */
+int resource_manager_new(const char *workdir, size_t workers,
+                         ResourceManager **out_manager);
 int resource_manager_add(ResourceManager *manager, FileResource *fr);
 int resource_manager_load(ResourceManager *manager, const char *path,
                           FileResource **out_fr);
 int resource_manager_load_async(ResourceManager *manager, const char *path,
                                 RmLoadCallback cb, void *cbcontext,
                                 WaitHandle *waithandle);
+int resource_manager_load_batch(ResourceManager *manager,
+                                const char *const *paths, size_t count,
+                                RmBatchCallback cb, void *cbcontext,
+                                WaitHandle *waithandle);
 int resource_manager_remove(ResourceManager *manager, FileResource *fr);
 int resource_manager_unref(ResourceManager *manager);
 
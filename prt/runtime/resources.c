@@ -1,67 +1,161 @@
 #include <prt/runtime/resources.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* @func `_read_fd`
+ * @desc Reads `fd` to the end. Regular files are read into a buffer of
+ *       their size, anything else grows the buffer as data arrives.
+ *
+ * @param(fd)       Open file
+ * @param(hint)     Size of the file or 0 when unknown
+ * @param(out_data) Receives the contents, to be freed
+ * @param(out_size) Receives the size of the contents
+ *
+ * @ret 0 on success or error code
+ */
+static int _read_fd(int fd, size_t hint, char **out_data, size_t *out_size) {
+  char *d, *grown;
+  size_t size = 0, capacity;
+  ssize_t n;
+
+  capacity = hint ? hint : PRT_READ_BUFFER_SIZE + 1;
+  d = (char *)malloc(capacity);
+  if (!d)
+    return -ENOMEM;
+
+  for (;;) {
+    if (size == capacity) {
+      /* the whole file is in, files growing meanwhile are cut here */
+      if (hint)
+        break;
+
+      capacity = ADD_WRAP_SAFE(capacity, capacity);
+      grown = (char *)realloc(d, capacity);
+      if (!grown) {
+        free((void *)d);
+        return -ENOMEM;
+      }
+      d = grown;
+    }
+
+    n = read(fd, d + size, capacity - size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      free((void *)d);
+      return -EIO;
+    }
+    if (n == 0)
+      break;
+    size += n;
+  }
+
+  *out_data = d;
+  *out_size = size;
+
+  return 0;
+}
 
 int load_resource(const char *name, char **out_data, size_t *out_size) {
-  char buf[PRT_READ_BUFFER_SIZE] = {0};
-  char *fp = NULL;
-  FILE *fd = NULL;
-  char *d = NULL, *dup = NULL;
-  size_t read = 0, total = 0;
-
-  fd = fopen(name, "rb");
-  if (!fd)
+  struct stat st;
+  int fd, r;
+
+  fd = open(name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
     return -EIO;
 
-  read = fread(buf, 1, sizeof(buf), fd);
-  do {
-    total += read;
-    d = (char *)realloc(d, total);
-    if (!d)
-      goto nomem;
-    memcpy(d + (total - read), buf, read);
-  } while ((read = fread(buf, 1, sizeof(buf), fd)) > 0);
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -EIO;
+  }
 
-  fclose(fd);
+  r = _read_fd(fd, S_ISREG(st.st_mode) ? (size_t)st.st_size : 0, out_data,
+               out_size);
+  close(fd);
 
-  *out_data = d;
-  *out_size = total;
+  return r;
+}
+
+/* @func `map_resource`
+ * @desc Maps a large regular file privately and read-only, pages are
+ *       read on first access. Resources are shared by every requester, so
+ *       none of them may modify the contents.
+ *
+ * @param(fd)       Open file
+ * @param(size)     Size of the file
+ * @param(out_data) Receives the mapping, release with `munmap`
+ *
+ * @ret 0 on success or error code
+ */
+int map_resource(int fd, size_t size, char **out_data) {
+  void *d;
+
+  d = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (d == MAP_FAILED)
+    return -errno;
+
+  /* resources are consumed front to back right after loading */
+  (void)madvise(d, size, MADV_SEQUENTIAL);
+  (void)madvise(d, size, MADV_WILLNEED);
 
+  *out_data = (char *)d;
   return 0;
-nomem:
-  free((void *)dup);
-  free((void *)d);
-  fclose(fd);
-  return -ENOMEM;
 }
 
 int file_resource_new(const char *path, FileResource **out_fre) {
   FileResource *fr;
-  int r;
+  struct stat st;
+  int fd, r;
   assert(path);
 
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -EIO;
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -EIO;
+  }
+
+  r = -ENOMEM;
   fr = NEW0(FileResource);
   if (!fr)
-    return -ENOMEM;
+    goto out;
 
   fr->path = strdup(path);
-  if (!fr->path) {
-    free((void *)fr);
-    return -ENOMEM;
-  }
+  if (!fr->path)
+    goto err;
 
-  r = load_resource(path, &fr->data, &fr->size);
-  if (r < 0) {
-    free((void *)fr->path);
-    free((void *)fr);
-    return r;
+  /* small files are cheaper to copy than to map and unmap */
+  if (S_ISREG(st.st_mode) && st.st_size >= PRT_MAP_THRESHOLD) {
+    fr->size = st.st_size;
+    fr->mapped = map_resource(fd, fr->size, &fr->data) == 0;
   }
 
+  r = 0;
+  if (!fr->mapped)
+    r = _read_fd(fd, S_ISREG(st.st_mode) ? (size_t)st.st_size : 0, &fr->data,
+                 &fr->size);
+  if (r < 0)
+    goto err;
+
   *out_fre = fr;
+  goto out;
 
-  return 0;
+err:
+  free((void *)fr->path);
+  free((void *)fr);
+out:
+  close(fd);
+  return r;
 }
 
 int file_resource_unref(FileResource *fr) {
-  free((void *)fr->data);
+  if (fr->mapped)
+    (void)munmap(fr->data, fr->size);
+  else
+    free((void *)fr->data);
   free((void *)fr->path);
   free((void *)fr);
   return 0;
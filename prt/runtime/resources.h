@@ -10,11 +10,16 @@ typedef struct _FileResource {
   char *data;
   size_t size;
   const char *path;
+  /* `data` is a read-only private file mapping instead of heap memory */
+  bool mapped;
 } FileResource;
 
 #define PRT_READ_BUFFER_SIZE 0x3fff
+/* files of at least this size are mapped rather than read */
+#define PRT_MAP_THRESHOLD 0x40000
 
 int load_resource(const char *name, char **out_data, size_t *out_size);
+int map_resource(int fd, size_t size, char **out_data);
 int file_resource_new(const char *path, FileResource **out_fr);
 int file_resource_unref(FileResource *fr);
 
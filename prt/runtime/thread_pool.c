@@ -0,0 +1,145 @@
+#include <prt/runtime/thread_pool.h>
+
+/* @func `_pool_worker`
+ * @desc Worker thread body, pops and runs jobs until the pool is stopping
+ *       and the queue is drained
+ *
+ * @param(p) Thread pool
+ *
+ * @ret `NULL`
+ */
+static void *_pool_worker(void *p) {
+  ThreadPool *pool = (ThreadPool *)p;
+  struct PoolJob *job;
+
+  for (;;) {
+    lock_acquire(&pool->lock);
+    while (list_empty(&pool->jobs) && !pool->stopping)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+
+    if (list_empty(&pool->jobs)) {
+      lock_release(&pool->lock);
+      return NULL;
+    }
+
+    job = (struct PoolJob *)pool->jobs.next;
+    list_del(&job->list);
+    pool->num_jobs--;
+    lock_release(&pool->lock);
+
+    job->func(job->context);
+    free((void *)job);
+  }
+}
+
+/* @func `thread_pool_new`
+ * @desc Creates a pool with a fixed number of worker threads
+ *
+ * @param(threads)  Number of workers, 0 for one per online CPU
+ * @param(out_pool) Receives the created pool
+ *
+ * @ret 0 on success or error code
+ */
+int thread_pool_new(size_t threads, ThreadPool **out_pool) {
+  ThreadPool *pool;
+  long cpus;
+  size_t i;
+  int r;
+  assert(out_pool);
+
+  if (!threads) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (size_t)cpus : 1;
+  }
+
+  pool = NEW0(ThreadPool);
+  if (!pool)
+    return -ENOMEM;
+
+  pool->threads = NEW0N(pthread_t, threads);
+  if (!pool->threads) {
+    free((void *)pool);
+    return -ENOMEM;
+  }
+
+  /* condition variables need a non-recursive mutex */
+  lock_init_normal(&pool->lock);
+  pthread_cond_init(&pool->cond, NULL);
+  INIT_LIST_HEAD(&pool->jobs);
+
+  for (i = 0; i < threads; ++i) {
+    r = pthread_create(&pool->threads[i], NULL, _pool_worker, pool);
+    if (r != 0) {
+      pool->num_threads = i;
+      (void)thread_pool_unref(pool);
+      return -r;
+    }
+  }
+
+  pool->num_threads = threads;
+  *out_pool = pool;
+
+  return 0;
+}
+
+/* @func `thread_pool_submit`
+ * @desc Queues `func` to be called with `context` on one of the workers
+ *
+ * @param(pool)    Thread pool
+ * @param(func)    Job function
+ * @param(context) Job argument
+ *
+ * @ret 0 on success or error code
+ */
+int thread_pool_submit(ThreadPool *pool, TpJobFunc func, void *context) {
+  struct PoolJob *job;
+  assert(pool);
+  assert(func);
+
+  job = NEW0(struct PoolJob);
+  if (!job)
+    return -ENOMEM;
+
+  job->func = func;
+  job->context = context;
+
+  lock_acquire(&pool->lock);
+  if (pool->stopping) {
+    lock_release(&pool->lock);
+    free((void *)job);
+    return -ESHUTDOWN;
+  }
+  list_add_tail(&job->list, &pool->jobs);
+  pool->num_jobs++;
+  pthread_cond_signal(&pool->cond);
+  lock_release(&pool->lock);
+
+  return 0;
+}
+
+/* @func `thread_pool_unref`
+ * @desc Finishes all queued jobs, joins the workers and releases the pool
+ *
+ * @param(pool) Thread pool
+ *
+ * @ret 0 on success or error code
+ */
+int thread_pool_unref(ThreadPool *pool) {
+  size_t i;
+  assert(pool);
+
+  lock_acquire(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->cond);
+  lock_release(&pool->lock);
+
+  for (i = 0; i < pool->num_threads; ++i)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->cond);
+  lock_unref(&pool->lock);
+  free((void *)pool->threads);
+  free((void *)pool);
+
+  return 0;
+}
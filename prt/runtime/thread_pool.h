@@ -0,0 +1,38 @@
+#pragma once
+
+#include <prt/shared/basic.h>
+#include <prt/shared/list.h>
+#include <prt/runtime/lock.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*TpJobFunc)(void *);
+
+struct PoolJob {
+  struct list_head list;
+  TpJobFunc func;
+  void *context;
+};
+
+/* Fixed number of worker threads consuming a FIFO job queue */
+typedef struct _ThreadPool {
+  pthread_t *threads;
+  size_t num_threads;
+  Lock lock;
+  pthread_cond_t cond;
+  struct list_head jobs;
+  size_t num_jobs;
+  bool stopping;
+} ThreadPool;
+
+/* 0 threads means one per online CPU */
+int thread_pool_new(size_t threads, ThreadPool **out_pool);
+int thread_pool_submit(ThreadPool *pool, TpJobFunc func, void *context);
+/* runs queued jobs to completion and joins the workers */
+int thread_pool_unref(ThreadPool *pool);
+
+#ifdef __cplusplus
+}
+#endif
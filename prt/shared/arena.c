@@ -0,0 +1,105 @@
+#include <prt/shared/arena.h>
+
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* @func `arena_new`
+ * @desc Creates an empty arena, the first block is allocated on demand
+ *
+ * @param(block_size) Minimal size of the blocks, 0 for a default
+ * @param(out_arena)  Receives the arena
+ *
+ * @ret 0 on success or error code
+ */
+int arena_new(size_t block_size, Arena **out_arena) {
+  Arena *arena;
+  assert(out_arena);
+
+  arena = NEW0(Arena);
+  if (!arena)
+    return -ENOMEM;
+
+  arena->block_size = block_size ? block_size : 4096;
+  *out_arena = arena;
+
+  return 0;
+}
+
+/* @func `arena_alloc`
+ * @desc Allocates `size` bytes aligned to `ARENA_ALIGN`. Memory is not
+ *       zeroed.
+ *
+ * @ret pointer to the memory or `NULL` if out of memory
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+  ArenaBlock *block;
+  void *p;
+  assert(arena);
+
+  size = ARENA_ROUND(size);
+  block = arena->blocks;
+  if (!block || block->size - block->used < size) {
+    block = (ArenaBlock *)malloc(sizeof(ArenaBlock) +
+                                 MAX(arena->block_size, size));
+    if (!block)
+      return NULL;
+
+    block->size = MAX(arena->block_size, size);
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  p = block->data + block->used;
+  block->used += size;
+
+  return p;
+}
+
+char *arena_strndup(Arena *arena, const char *s, size_t n) {
+  char *d;
+  assert(s);
+
+  d = (char *)arena_alloc(arena, n + 1);
+  if (!d)
+    return NULL;
+
+  memcpy(d, s, n);
+  d[n] = 0;
+
+  return d;
+}
+
+/* @func `arena_reset`
+ * @desc Invalidates all allocations but keeps the newest block for reuse
+ */
+int arena_reset(Arena *arena) {
+  ArenaBlock *block, *next;
+  assert(arena);
+
+  if (!arena->blocks)
+    return 0;
+
+  for (block = arena->blocks->next; block; block = next) {
+    next = block->next;
+    free((void *)block);
+  }
+
+  arena->blocks->next = NULL;
+  arena->blocks->used = 0;
+
+  return 0;
+}
+
+int arena_unref(Arena *arena) {
+  ArenaBlock *block, *next;
+  assert(arena);
+
+  for (block = arena->blocks; block; block = next) {
+    next = block->next;
+    free((void *)block);
+  }
+
+  free((void *)arena);
+
+  return 0;
+}
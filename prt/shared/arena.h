@@ -0,0 +1,35 @@
+#pragma once
+
+#include <prt/shared/basic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bump allocator. Allocations are carved out of large blocks and can't be
+ * freed individually, the whole arena is released with `arena_unref`.
+ */
+#define ARENA_ALIGN 16
+
+typedef struct _ArenaBlock {
+  struct _ArenaBlock *next;
+  size_t size;
+  size_t used;
+  uint8_t data[] __attribute__((aligned(ARENA_ALIGN)));
+} ArenaBlock;
+
+typedef struct _Arena {
+  ArenaBlock *blocks;
+  /* minimal size of a new block */
+  size_t block_size;
+} Arena;
+
+int arena_new(size_t block_size, Arena **out_arena);
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strndup(Arena *arena, const char *s, size_t n);
+int arena_reset(Arena *arena);
+int arena_unref(Arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
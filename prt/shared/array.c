@@ -63,6 +63,13 @@ int array_remove(Array *array, size_t start, size_t num) {
   return 0;
 }
 
+/* drops all items but keeps the capacity for reuse */
+int array_clear(Array *array) {
+  assert(array);
+  array->occupied = 0;
+  return 0;
+}
+
 int array_num_items(Array *array, size_t item_size, size_t *out_num) {
   assert(array);
   assert(item_size);
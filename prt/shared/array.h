@@ -29,6 +29,7 @@ typedef int (*ArSort)(const void *, const void *);
 int array_new(Array **out_array);
 int array_add(Array *array, const char *p, size_t size);
 int array_remove(Array *array, size_t start, size_t num);
+int array_clear(Array *array);
 int array_num_items(Array *array, size_t item_size, size_t *out_num);
 int array_sort(Array *array, ArSort comparer, size_t element_size);
 int array_unref(Array *array);
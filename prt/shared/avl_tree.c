@@ -10,7 +10,7 @@ int binary_tree_new(BTCompare comparison, BinaryTree **out_tree) {
 
   t->compare = comparison;
 #ifdef BTREE_SYNCHRONIZED
-  lock_init(&t->lock);
+  rwlock_init(&t->lock);
 #endif
 
   *out_tree = t;
@@ -30,6 +30,8 @@ static int create_node(BinaryTreeNode *parent, void *key, void *data,
   n->parent = parent;
   n->key = key;
   n->data = data;
+  n->height = 1;
+  n->size = 1;
 
   *out_node = n;
 
@@ -63,6 +65,9 @@ static int find_insertion_point(BinaryTree *tree, void *key, int *last_compare,
   return -EINVAL;
 }
 
+#define SUBTREE_SIZE(n) ((n) ? (n)->size : 0)
+
+/* also refreshes the subtree size used by rank/select */
 static int recalculate_height(BinaryTreeNode *node) {
   assert(node);
 
@@ -75,6 +80,8 @@ static int recalculate_height(BinaryTreeNode *node) {
   else
     node->height = 1;
 
+  node->size = SUBTREE_SIZE(node->left) + SUBTREE_SIZE(node->right) + 1;
+
   return 0;
 }
 
@@ -244,7 +251,7 @@ int binary_tree_insert(BinaryTree *tree, void *key, void *value) {
   assert(tree);
 
 #ifdef BTREE_SYNCHRONIZED
-  lock_acquire(&tree->lock);
+  rwlock_acquire_write(&tree->lock);
 #endif
 
   /* first node */
@@ -260,10 +267,8 @@ int binary_tree_insert(BinaryTree *tree, void *key, void *value) {
   }
 
   r = find_insertion_point(tree, key, &comparison, &i);
-  if (r < 0) {
-    free((void *)n);
+  if (r < 0)
     goto out;
-  }
 
   if (comparison < 0) {
     r = create_node(i, key, value, &i->left);
@@ -282,7 +287,7 @@ int binary_tree_insert(BinaryTree *tree, void *key, void *value) {
   r = balance_up(tree, i);
 out:
 #ifdef BTREE_SYNCHRONIZED
-  lock_release(&tree->lock);
+  rwlock_release(&tree->lock);
 #endif
   return r;
 }
@@ -295,17 +300,26 @@ int binary_tree_find(BinaryTree *tree, void *key, void **out_data) {
   assert(out_data);
 
 #ifdef BTREE_SYNCHRONIZED
-  lock_acquire(&tree->lock);
+  rwlock_acquire_read(&tree->lock);
 #endif
 
+  r = -ENOENT;
+  if (!tree->root)
+    goto out;
+
   r = find_insertion_point(tree, key, &comparison, &c);
-  if (r < 0 || comparison != 0)
+  if (r < 0)
+    goto out;
+
+  if (comparison != 0) {
+    r = -ENOENT;
     goto out;
+  }
 
   *out_data = c->data;
 out:
 #ifdef BTREE_SYNCHRONIZED
-  lock_release(&tree->lock);
+  rwlock_release(&tree->lock);
 #endif
   return r;
 }
@@ -318,12 +332,21 @@ int binary_tree_delete_key(BinaryTree *tree, void *key, void **out_data) {
   assert(out_data);
 
 #ifdef BTREE_SYNCHRONIZED
-  lock_acquire(&tree->lock);
+  rwlock_acquire_write(&tree->lock);
 #endif
 
+  r = -ENOENT;
+  if (!tree->root)
+    goto out;
+
   r = find_insertion_point(tree, key, &comparison, &c);
-  if (r < 0 || comparison != 0)
+  if (r < 0)
+    goto out;
+
+  if (comparison != 0) {
+    r = -ENOENT;
     goto out;
+  }
 
   data = c->data;
 
@@ -342,12 +365,12 @@ int binary_tree_delete_key(BinaryTree *tree, void *key, void **out_data) {
   *out_data = data;
 out:
 #ifdef BTREE_SYNCHRONIZED
-  lock_release(&tree->lock);
+  rwlock_release(&tree->lock);
 #endif
   return r;
 }
 
-int binary_tree_delete_node(BinaryTree *tree, BinaryTreeNode *node) {
+static int delete_node(BinaryTree *tree, BinaryTreeNode *node) {
   BinaryTreeNode *swap;
   assert(tree);
   assert(node);
@@ -365,14 +388,29 @@ int binary_tree_delete_node(BinaryTree *tree, BinaryTreeNode *node) {
   return delete_leaf_node(tree, node);
 }
 
+int binary_tree_delete_node(BinaryTree *tree, BinaryTreeNode *node) {
+  int r;
+  assert(tree);
+  assert(node);
+
+#ifdef BTREE_SYNCHRONIZED
+  rwlock_acquire_write(&tree->lock);
+#endif
+  r = delete_node(tree, node);
+#ifdef BTREE_SYNCHRONIZED
+  rwlock_release(&tree->lock);
+#endif
+  return r;
+}
+
 int binary_tree_unref(BinaryTree *tree) {
   assert(tree);
 
   while (tree->root)
-    binary_tree_delete_node(tree, tree->root);
+    (void)delete_node(tree, tree->root);
 
 #ifdef BTREE_SYNCHRONIZED
-  lock_unref(&tree->lock);
+  rwlock_unref(&tree->lock);
 #endif
 
   free((void *)tree);
@@ -452,7 +490,7 @@ static int in_order_previous(BinaryTreeNode *node, BinaryTreeNode **out_node) {
   return 0;
 }
 
-/* locks the tree */
+/* read-locks the tree */
 int binary_tree_enum_new(BinaryTree *tree, BinaryTreeEnum **out_enum) {
   BinaryTreeEnum *en;
   assert(tree);
@@ -465,7 +503,7 @@ int binary_tree_enum_new(BinaryTree *tree, BinaryTreeEnum **out_enum) {
   en->tree = tree;
 
 #ifdef BTREE_SYNCHRONIZED
-  lock_acquire(&tree->lock);
+  rwlock_acquire_read(&tree->lock);
 #endif
   *out_enum = en;
   return 0;
@@ -522,7 +560,7 @@ int binary_tree_enum_next(BinaryTreeEnum *enu, void **out_data) {
 
 /* same as above but returns both key/values for use when serializing the tree
  */
-static int binary_tree_enum_next_kv(BinaryTreeEnum *enu, void **out_key,
+int binary_tree_enum_next_kv(BinaryTreeEnum *enu, void **out_key,
                                     void **out_data) {
   BinaryTreeNode *n;
   assert(enu);
@@ -576,11 +614,11 @@ int binary_tree_enum_reset(BinaryTreeEnum *enu) {
   return 0;
 }
 
-/* unlocks the tree */
+/* releases the read lock taken by `binary_tree_enum_new` */
 int binary_tree_enum_unref(BinaryTreeEnum *enu) {
   assert(enu);
 #ifdef BTREE_SYNCHRONIZED
-  lock_unref(&enu->tree->lock);
+  rwlock_release(&enu->tree->lock);
 #endif
   free((void *)enu);
   return 0;
@@ -617,3 +655,334 @@ int binary_tree_to_array(BinaryTree *tree, void **out_array, size_t *out_size) {
 
   return binary_tree_enum_unref(en);
 }
+
+/* @func `free_subtree`
+ * @desc Releases all nodes below and including `node`
+ */
+static void free_subtree(BinaryTreeNode *node) {
+  if (!node)
+    return;
+
+  free_subtree(node->left);
+  free_subtree(node->right);
+  free((void *)node);
+}
+
+/* @func `build_balanced`
+ * @desc Builds perfectly balanced subtree out of interleaved key/value pairs
+ *       in range [`lo`, `hi`) taking the midpoint as the root
+ */
+static int build_balanced(void **items, size_t lo, size_t hi,
+                          BinaryTreeNode *parent, BinaryTreeNode **out_node) {
+  BinaryTreeNode *n;
+  size_t mid;
+  int r;
+  assert(items);
+  assert(out_node);
+
+  if (lo >= hi) {
+    *out_node = NULL;
+    return 0;
+  }
+
+  mid = lo + (hi - lo) / 2;
+  r = create_node(parent, items[mid * 2 + 0], items[mid * 2 + 1], &n);
+  if (r < 0)
+    return r;
+
+  r = build_balanced(items, lo, mid, n, &n->left);
+  if (r < 0)
+    goto err;
+
+  r = build_balanced(items, mid + 1, hi, n, &n->right);
+  if (r < 0)
+    goto err;
+
+  (void)recalculate_height(n);
+  *out_node = n;
+
+  return 0;
+err:
+  free_subtree(n->left);
+  free((void *)n);
+  return r;
+}
+
+/* @func `binary_tree_bulk_load`
+ * @desc Creates a tree from interleaved key/value pairs in O(n), the layout
+ *       is the same one `binary_tree_to_array` produces, so items have to be
+ *       in enumeration order without duplicates
+ *
+ * @param(comparison) Key comparison function
+ * @param(items)      Interleaved keys and values
+ * @param(size)       Number of entries in `items` (2 * number of pairs)
+ * @param(out_tree)   Receives the created tree
+ *
+ * @ret 0 on success or error code
+ */
+int binary_tree_bulk_load(BTCompare comparison, void **items, size_t size,
+                          BinaryTree **out_tree) {
+  BinaryTree *t;
+  size_t i, n;
+  int r;
+  assert(out_tree);
+  assert(items || size == 0);
+
+  if (size & 1)
+    return -EINVAL;
+
+  n = size / 2;
+  /* in enumeration order each key lies to the right of its predecessor */
+  for (i = 1; i < n; ++i)
+    if (comparison(items[(i - 1) * 2], items[i * 2]) <= 0)
+      return -EINVAL;
+
+  r = binary_tree_new(comparison, &t);
+  if (r < 0)
+    return r;
+
+  r = build_balanced(items, 0, n, NULL, &t->root);
+  if (r < 0) {
+    (void)binary_tree_unref(t);
+    return r;
+  }
+
+  t->num_items = n;
+  *out_tree = t;
+
+  return 0;
+}
+
+/* @func `bound_node`
+ * @desc Finds first node in enumeration order that is not before `key`,
+ *       or strictly after it when `strict` is set
+ */
+static BinaryTreeNode *bound_node(BinaryTree *tree, void *key, bool strict) {
+  BinaryTreeNode *n, *best;
+  int c;
+  assert(tree);
+
+  best = NULL;
+  n = tree->root;
+  while (n) {
+    c = tree->compare(n->key, key);
+    /* `key` would be inserted left of `n`, so `n` comes after it */
+    if (c < 0 || (c == 0 && !strict)) {
+      best = n;
+      n = n->left;
+    } else
+      n = n->right;
+  }
+
+  return best;
+}
+
+static int bound(BinaryTree *tree, void *key, bool strict, void **out_key,
+                 void **out_data) {
+  BinaryTreeNode *n;
+  int r = 0;
+  assert(tree);
+
+#ifdef BTREE_SYNCHRONIZED
+  rwlock_acquire_read(&tree->lock);
+#endif
+
+  n = bound_node(tree, key, strict);
+  if (!n) {
+    r = -ENOENT;
+    goto out;
+  }
+
+  if (out_key)
+    *out_key = n->key;
+  if (out_data)
+    *out_data = n->data;
+out:
+#ifdef BTREE_SYNCHRONIZED
+  rwlock_release(&tree->lock);
+#endif
+  return r;
+}
+
+/* @func `binary_tree_lower_bound`
+ * @desc Finds the first item in enumeration order that is not before `key`
+ *
+ * @param(tree)     Tree to search
+ * @param(key)      Key to search for
+ * @param(out_key)  Optional, receives the key of the item
+ * @param(out_data) Optional, receives the data of the item
+ *
+ * @ret 0 on success, -ENOENT if all items come before `key`
+ */
+int binary_tree_lower_bound(BinaryTree *tree, void *key, void **out_key,
+                            void **out_data) {
+  return bound(tree, key, false, out_key, out_data);
+}
+
+/* @func `binary_tree_upper_bound`
+ * @desc Finds the first item in enumeration order that comes after `key`
+ *
+ * @param(tree)     Tree to search
+ * @param(key)      Key to search for
+ * @param(out_key)  Optional, receives the key of the item
+ * @param(out_data) Optional, receives the data of the item
+ *
+ * @ret 0 on success, -ENOENT if no item comes after `key`
+ */
+int binary_tree_upper_bound(BinaryTree *tree, void *key, void **out_key,
+                            void **out_data) {
+  return bound(tree, key, true, out_key, out_data);
+}
+
+/* @func `binary_tree_rank`
+ * @desc Counts the items that come before `key` in enumeration order,
+ *       which is the index `key` has or would have in `binary_tree_to_array`
+ *
+ * @param(tree)     Tree to search
+ * @param(key)      Key to rank
+ * @param(out_rank) Receives the rank
+ *
+ * @ret 0 on success or error code
+ */
+int binary_tree_rank(BinaryTree *tree, void *key, size_t *out_rank) {
+  BinaryTreeNode *n;
+  size_t rank;
+  assert(tree);
+  assert(out_rank);
+
+#ifdef BTREE_SYNCHRONIZED
+  rwlock_acquire_read(&tree->lock);
+#endif
+
+  rank = 0;
+  n = tree->root;
+  while (n) {
+    if (tree->compare(n->key, key) > 0) {
+      rank += SUBTREE_SIZE(n->left) + 1;
+      n = n->right;
+    } else
+      n = n->left;
+  }
+
+#ifdef BTREE_SYNCHRONIZED
+  rwlock_release(&tree->lock);
+#endif
+
+  *out_rank = rank;
+
+  return 0;
+}
+
+static BinaryTreeNode *select_node(BinaryTree *tree, size_t index) {
+  BinaryTreeNode *n;
+  size_t left;
+  assert(tree);
+
+  n = tree->root;
+  while (n) {
+    left = SUBTREE_SIZE(n->left);
+    if (index < left)
+      n = n->left;
+    else if (index > left) {
+      index -= left + 1;
+      n = n->right;
+    } else
+      break;
+  }
+
+  return n;
+}
+
+/* @func `binary_tree_select`
+ * @desc Retrieves the item at `index` in enumeration order in O(log n)
+ *
+ * @param(tree)     Tree to search
+ * @param(index)    Zero based index of the item
+ * @param(out_key)  Optional, receives the key of the item
+ * @param(out_data) Optional, receives the data of the item
+ *
+ * @ret 0 on success, -ENOENT if `index` is out of range
+ */
+int binary_tree_select(BinaryTree *tree, size_t index, void **out_key,
+                       void **out_data) {
+  BinaryTreeNode *n;
+  int r = 0;
+  assert(tree);
+
+#ifdef BTREE_SYNCHRONIZED
+  rwlock_acquire_read(&tree->lock);
+#endif
+
+  n = select_node(tree, index);
+  if (!n) {
+    r = -ENOENT;
+    goto out;
+  }
+
+  if (out_key)
+    *out_key = n->key;
+  if (out_data)
+    *out_data = n->data;
+out:
+#ifdef BTREE_SYNCHRONIZED
+  rwlock_release(&tree->lock);
+#endif
+  return r;
+}
+
+/* @func `binary_tree_enum_seek`
+ * @desc Positions the enumerator on the first item that is not before
+ *       `key`, subsequent `binary_tree_enum_next` calls continue from there
+ *
+ * @param(enu)      Tree enumerator
+ * @param(key)      Key to seek to
+ * @param(out_data) Receives data of the item or `NULL` past the end
+ *
+ * @ret 0 on success or error code
+ */
+int binary_tree_enum_seek(BinaryTreeEnum *enu, void *key, void **out_data) {
+  BinaryTreeNode *n;
+  assert(enu);
+  assert(out_data);
+
+  /* the enumerator already holds the read lock */
+  n = bound_node(enu->tree, key, false);
+  if (!n) {
+    (void)rightmost(enu->tree, &enu->node);
+    *out_data = NULL;
+    return 0;
+  }
+
+  enu->node = n;
+  *out_data = n->data;
+
+  return 0;
+}
+
+/* @func `binary_tree_enum_seek_index`
+ * @desc Positions the enumerator on the item at `index` in enumeration order
+ *
+ * @param(enu)      Tree enumerator
+ * @param(index)    Zero based index of the item
+ * @param(out_data) Receives data of the item or `NULL` past the end
+ *
+ * @ret 0 on success or error code
+ */
+int binary_tree_enum_seek_index(BinaryTreeEnum *enu, size_t index,
+                                void **out_data) {
+  BinaryTreeNode *n;
+  assert(enu);
+  assert(out_data);
+
+  n = select_node(enu->tree, index);
+  if (!n) {
+    (void)rightmost(enu->tree, &enu->node);
+    *out_data = NULL;
+    return 0;
+  }
+
+  enu->node = n;
+  *out_data = n->data;
+
+  return 0;
+}
@@ -19,6 +19,8 @@ typedef struct _BinaryTreeNode {
   struct _BinaryTreeNode *parent;
 
   uint32_t height;
+  /* number of nodes in this subtree, including the node itself */
+  size_t size;
 } BinaryTreeNode;
 
 typedef int (*BTCompare)(const void *, const void *);
@@ -28,7 +30,7 @@ typedef struct _BinaryTree {
   BinaryTreeNode *root;
   BTCompare compare;
 #ifdef BTREE_SYNCHRONIZED
-  Lock lock;
+  RwLock lock;
 #endif
 } BinaryTree;
 
@@ -38,25 +40,40 @@ typedef struct _BTreeEnum {
 } BinaryTreeEnum;
 
 int binary_tree_new(BTCompare, BinaryTree **);
+/* builds a balanced tree from `binary_tree_to_array` formatted items */
+int binary_tree_bulk_load(BTCompare, void **, size_t, BinaryTree **);
 int binary_tree_unref(BinaryTree *);
 
-/* all functions below lock/unlock */
+/* writers, take the tree lock exclusively */
 int binary_tree_insert(BinaryTree *, void *, void *);
-int binary_tree_find(BinaryTree *, void *, void **);
 int binary_tree_delete_key(BinaryTree *, void *, void **);
 int binary_tree_delete_node(BinaryTree *, BinaryTreeNode *);
 
-/* lock tree */
+/* readers, any number of these can run in parallel */
+int binary_tree_find(BinaryTree *, void *, void **);
+
+/* ordered queries, positions are in enumeration order */
+int binary_tree_lower_bound(BinaryTree *, void *, void **, void **);
+int binary_tree_upper_bound(BinaryTree *, void *, void **, void **);
+int binary_tree_rank(BinaryTree *, void *, size_t *);
+int binary_tree_select(BinaryTree *, size_t, void **, void **);
+
+/* read-lock tree; the tree must not be modified from the
+ * enumerating thread until the enumerator is released */
 int binary_tree_enum_new(BinaryTree *, BinaryTreeEnum **);
-/* unlock tree */
+/* release the read lock */
 int binary_tree_enum_unref(BinaryTreeEnum *);
 
 int binary_tree_enum_next(BinaryTreeEnum *, void **);
+int binary_tree_enum_next_kv(BinaryTreeEnum *, void **, void **);
 int binary_tree_enum_previous(BinaryTreeEnum *, void **);
 int binary_tree_enum_end(BinaryTreeEnum *, void **);
 int binary_tree_enum_reset(BinaryTreeEnum *);
 int binary_tree_enum_first(BinaryTreeEnum *, void **);
 int binary_tree_enum_last(BinaryTreeEnum *, void **);
+/* range iteration, `enum_next` continues after the sought item */
+int binary_tree_enum_seek(BinaryTreeEnum *, void *, void **);
+int binary_tree_enum_seek_index(BinaryTreeEnum *, size_t, void **);
 
 int binary_tree_to_array(BinaryTree *, void **, size_t *);
 
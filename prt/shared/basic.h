@@ -62,7 +62,7 @@ typedef uint32_t Id;
     size_t _c_ = 0, _i_ = 0, _s_ = sizeof(_x_) / sizeof(_x_[0]);               \
     for (; _i_ < _s_ && _x_[_i_]; _i_++)                                       \
       _c_ = ADD_WRAP_SAFE(_c_, strlen(_x_[_i_]));                              \
-    _b_ = _d_ = (char *)alloca(_c_);                                           \
+    _b_ = _d_ = (char *)alloca(_c_ + 1);                                       \
     for (_i_ = 0; _i_ < _s_ && _x_[_i_]; _i_++)                                \
       _d_ = stpcpy(_d_, _x_[_i_]);                                             \
     _b_;                                                                       \
@@ -180,19 +180,20 @@ int bitvector_count_bits(BitVector *vector, size_t max, size_t *out_count) {
 }
 
 int bitvector_next_set_bit(BitVector *vector, size_t index, size_t *out_index) {
-  size_t offset, shift, mask;
+  size_t offset, shift, rest;
   int p, r;
   assert(vector);
   assert(out_index);
 
   offset = index >> 6;
   shift = index & 63;
-  mask = ((1ull << (shift + 1)) - 1);
+  /* first erase the lower bits so we hit the first upper bit set */
+  rest = shift == 63 ? 0
+                     : vector->items[offset] & ((uint64_t)BV_INT_MAX << (shift + 1));
 
   /* next bit is in current item */
-  if (vector->items[offset] >= mask) {
-    /* first erase the lower bits so we hit the first upper bit set */
-    p = __builtin_ffsll(vector->items[offset] & (BV_INT_MAX ^ mask));
+  if (rest) {
+    p = __builtin_ffsll(rest);
     *out_index = (offset << 6) + (p - 1);
     return 0;
   }
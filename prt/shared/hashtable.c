@@ -59,6 +59,10 @@ static int _hashtable_resize_and_rehash(Hashtable *hash) {
     return r;
 
   new_buckets = (Bucket *)calloc(sizeof(Bucket), new_size);
+  if (!new_buckets) {
+    bitvector_unref(vector);
+    return -ENOMEM;
+  }
 
   for (i = 0; i < old_size; ++i) {
     for (j = 0; j < hash->buckets[i].num_items; ++j) {
@@ -74,15 +78,18 @@ static int _hashtable_resize_and_rehash(Hashtable *hash) {
     }
   }
 
+  for (i = 0; i < old_size; ++i)
+    free((void *)hash->buckets[i].items);
   free((void *)hash->buckets);
   hash->buckets = new_buckets;
-  free((void *)hash->vector);
+  hash->num_buckets = new_size;
+  bitvector_unref(hash->vector);
   hash->vector = vector;
 
   return 0;
 err_insert:
-  /* the current insert failed, so move one back */
-  for (--i; i != BV_INT_MAX; --i)
+  /* the old buckets are untouched, drop everything moved so far */
+  for (i = 0; i < new_size; ++i)
     free((void *)new_buckets[i].items);
   free((void *)new_buckets);
   bitvector_unref(vector);
@@ -238,10 +245,15 @@ int hashtable_remove(Hashtable *hash, Id id, void *key, void **out_value) {
 
   for (i = 0; i < hash->buckets[index].num_items; ++i) {
     if (hash->key_cmp(hash->buckets[index].items[i].key, key) == 0) {
+      /* the slot is overwritten or released below */
+      if (out_value)
+        *out_value = hash->buckets[index].items[i].value;
+
       if (hash->buckets[index].num_items == 1) {
         /* guaranteed to not reallocate */
         (void)bitvector_set_bit(hash->vector, index, false);
         free((void *)hash->buckets[index].items);
+        hash->buckets[index].items = NULL;
       } else {
         last = hash->buckets[index].num_items - 1;
 
@@ -260,9 +272,6 @@ int hashtable_remove(Hashtable *hash, Id id, void *key, void **out_value) {
         }
       }
 
-      if (out_value)
-        *out_value = hash->buckets[index].items[i].value;
-
       hash->num_items--;
       hash->buckets[index].num_items--;
 
@@ -280,12 +289,15 @@ out:
 }
 
 int hashtable_unref(Hashtable *hash) {
+  size_t i;
   assert(hash);
 
 #ifdef HASH_SYNCHRONIZED
   lock_unref(&hash->lock);
 #endif
   bitvector_unref(hash->vector);
+  for (i = 0; i < hash->num_buckets; ++i)
+    free((void *)hash->buckets[i].items);
   free((void *)hash->buckets);
   free((void *)hash);
 
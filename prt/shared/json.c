@@ -16,8 +16,18 @@
 #define _GNU_SOURCE
 
 #include <sys/types.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <prt/shared/basic.h>
 #include <prt/shared/json.h>
+#include <prt/runtime/resources.h>
+
+#if defined(PRT_INTEL) && defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(PRT_ARM) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 int json_variant_new(JsonVariant **ret, JsonVariantType type) {
   JsonVariant *v;
@@ -37,10 +47,13 @@ static int json_variant_deep_copy(JsonVariant *ret, JsonVariant *variant) {
   assert(variant);
 
   ret->type = variant->type;
+  ret->flags = 0;
   ret->size = variant->size;
+  ret->index = NULL;
 
   if (variant->type == JSON_VARIANT_STRING) {
-    ret->string = memdup(variant->string, variant->size + 1);
+    /* views aren't terminated, the copy always owns a terminated string */
+    ret->string = strndup(variant->string, variant->size);
     if (!ret->string)
       return -ENOMEM;
   } else if (variant->type == JSON_VARIANT_ARRAY ||
@@ -100,6 +113,7 @@ static JsonVariant *json_object_unref(JsonVariant *variant) {
     json_variant_unref_inner(&variant->objects[i]);
 
   free(variant->objects);
+  free(variant->index);
   return NULL;
 }
 
@@ -148,10 +162,38 @@ JsonVariant *json_variant_unref(JsonVariant *variant) {
 char *json_variant_string(JsonVariant *variant) {
   assert(variant);
   assert(variant->type == JSON_VARIANT_STRING);
+  /* views must go through `json_variant_string_view` */
+  assert(!(variant->flags & JSON_STRING_UNTERMINATED));
+
+  return variant->string;
+}
+
+/* @func `json_variant_string_view`
+ * @desc Returns the string bytes of any string variant, including the
+ *       unterminated views created by `json_document_parse_view`
+ *
+ * @param(size) Receives the length in bytes, can be `NULL`
+ *
+ * @ret pointer to the first byte
+ */
+const char *json_variant_string_view(JsonVariant *variant, size_t *size) {
+  assert(variant);
+  assert(variant->type == JSON_VARIANT_STRING);
 
+  if (size)
+    *size = variant->size;
   return variant->string;
 }
 
+bool json_variant_string_equal(JsonVariant *variant, const char *s) {
+  assert(variant);
+  assert(s);
+
+  return variant->type == JSON_VARIANT_STRING &&
+         strlen(s) == variant->size &&
+         memcmp(variant->string, s, variant->size) == 0;
+}
+
 bool json_variant_bool(JsonVariant *variant) {
   assert(variant);
   assert(variant->type == JSON_VARIANT_BOOLEAN);
@@ -183,18 +225,158 @@ JsonVariant *json_variant_element(JsonVariant *variant, unsigned index) {
   return &variant->objects[index];
 }
 
+/* open addressing table over the key/value pairs of one object */
+struct json_key_index {
+  size_t mask;
+  struct json_key_slot {
+    Id hash;
+    /* pair number + 1, 0 marks an empty slot */
+    size_t pair;
+  } slots[];
+};
+
+#ifdef PRT_ARCH64
+#define JSON_HASH(s, n) murmur2_64(s, n)
+#else
+#define JSON_HASH(s, n) murmur2_32(s, n)
+#endif
+
+static inline bool json_key_equal(const JsonVariant *key, const char *s,
+                                  size_t n) {
+  return key->type == JSON_VARIANT_STRING && key->size == n &&
+         memcmp(key->string, s, n) == 0;
+}
+
+/* keeps the load factor at or below one half */
+static size_t json_key_index_capacity(size_t pairs) {
+  size_t capacity = 1;
+
+  while (capacity < pairs * 2)
+    capacity <<= 1;
+  return capacity;
+}
+
+static size_t json_key_index_size(size_t pairs) {
+  return sizeof(struct json_key_index) +
+         json_key_index_capacity(pairs) * sizeof(struct json_key_slot);
+}
+
+/* @func `json_key_index_fill`
+ * @desc Hashes every key of `variant` into `index`, which must be zeroed
+ *       and sized by `json_key_index_size`. Duplicate keys keep the first
+ *       pair, as the linear lookup does.
+ */
+static void json_key_index_fill(JsonVariant *variant,
+                                struct json_key_index *index) {
+  struct json_key_slot *slot;
+  JsonVariant *key, *other;
+  size_t i, pair;
+  Id hash;
+
+  index->mask = json_key_index_capacity(variant->size / 2) - 1;
+
+  for (pair = 0; pair < variant->size / 2; ++pair) {
+    key = &variant->objects[2 * pair];
+    if (key->type != JSON_VARIANT_STRING)
+      continue;
+
+    hash = JSON_HASH(key->string, key->size);
+    for (i = hash & index->mask;; i = (i + 1) & index->mask) {
+      slot = &index->slots[i];
+      if (!slot->pair) {
+        slot->hash = hash;
+        slot->pair = pair + 1;
+        break;
+      }
+      other = &variant->objects[2 * (slot->pair - 1)];
+      if (slot->hash == hash && json_key_equal(other, key->string, key->size))
+        break;
+    }
+  }
+}
+
+/* @func `json_key_index_build`
+ * @desc Lazily indexes a heap allocated object, concurrent lookups may race
+ *       to build it and all but one copy is dropped
+ *
+ * @ret the published index or `NULL` when out of memory
+ */
+static struct json_key_index *json_key_index_build(JsonVariant *variant) {
+  struct json_key_index *index, *expected = NULL;
+
+  index = (struct json_key_index *)calloc(1, json_key_index_size(variant->size / 2));
+  if (!index)
+    return NULL;
+  json_key_index_fill(variant, index);
+
+  if (!__atomic_compare_exchange_n(&variant->index, &expected, index, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free((void *)index);
+    return expected;
+  }
+  return index;
+}
+
+/* @func `json_variant_value_hashed`
+ * @desc Looks up `key` in an object given its precomputed `HASH(key)`.
+ *       Objects with `JSON_INDEX_KEYS` keys or more are searched through
+ *       their key index, smaller ones linearly.
+ *
+ * @ret value of the first pair with that key or `NULL`
+ */
+JsonVariant *json_variant_value_hashed(JsonVariant *variant, Id hash,
+                                       const char *key) {
+  struct json_key_index *index;
+  struct json_key_slot *slot;
+  size_t i, n;
+
+  assert(variant);
+  assert(variant->type == JSON_VARIANT_OBJECT);
+  assert(key);
+
+  n = strlen(key);
+  if (variant->size / 2 < JSON_INDEX_KEYS) {
+    for (i = 0; i < variant->size; i += 2)
+      if (json_key_equal(&variant->objects[i], key, n))
+        return &variant->objects[i + 1];
+    return NULL;
+  }
+
+  index = __atomic_load_n(&variant->index, __ATOMIC_ACQUIRE);
+  if (!index)
+    index = json_key_index_build(variant);
+  if (!index) {
+    for (i = 0; i < variant->size; i += 2)
+      if (json_key_equal(&variant->objects[i], key, n))
+        return &variant->objects[i + 1];
+    return NULL;
+  }
+
+  for (i = hash & index->mask;; i = (i + 1) & index->mask) {
+    slot = &index->slots[i];
+    if (!slot->pair)
+      return NULL;
+    if (slot->hash == hash &&
+        json_key_equal(&variant->objects[2 * (slot->pair - 1)], key, n))
+      return &variant->objects[2 * slot->pair - 1];
+  }
+}
+
 JsonVariant *json_variant_value(JsonVariant *variant, const char *key) {
-  size_t i;
+  size_t i, n;
 
   assert(variant);
   assert(variant->type == JSON_VARIANT_OBJECT);
-  assert(variant->objects);
+  assert(key);
+
+  /* only hash when the object is large enough to be indexed */
+  if (variant->size / 2 >= JSON_INDEX_KEYS)
+    return json_variant_value_hashed(variant, HASH(key), key);
 
-  for (i = 0; i < variant->size; i += 2) {
-    JsonVariant *p = &variant->objects[i];
-    if (p->type == JSON_VARIANT_STRING && streq(key, p->string))
+  n = strlen(key);
+  for (i = 0; i < variant->size; i += 2)
+    if (json_key_equal(&variant->objects[i], key, n))
       return &variant->objects[i + 1];
-  }
 
   return NULL;
 }
@@ -384,88 +566,382 @@ static int json_parse_string(const char **p, char **ret) {
   }
 }
 
-static int json_parse_number(const char **p, union json_value *ret) {
-  bool negative = false, exponent_negative = false, is_double = false;
-  double x = 0.0, y = 0.0, exponent = 0.0, shift = 1.0;
-  intmax_t i = 0;
-  const char *c;
+/* exponents covered by the power of five table of the Eisel-Lemire path */
+#define JSON_POW5_MIN -342
+#define JSON_POW5_MAX 308
+#define JSON_POW5_SIZE (JSON_POW5_MAX - JSON_POW5_MIN + 1)
 
-  assert(p);
-  assert(*p);
-  assert(ret);
+/* fits 2^1791, enough for the division of every negative power below */
+#define JSON_BIG_LIMBS 56
 
-  c = *p;
+struct json_big {
+  uint32_t limbs[JSON_BIG_LIMBS];
+  int size;
+};
 
-  if (*c == '-') {
-    negative = true;
-    c++;
+static uint64_t json_pow5[JSON_POW5_SIZE][2];
+static pthread_once_t json_pow5_once = PTHREAD_ONCE_INIT;
+
+static void json_big_mul5(struct json_big *b) {
+  uint64_t carry = 0;
+  int i;
+
+  for (i = 0; i < b->size; ++i) {
+    carry += (uint64_t)b->limbs[i] * 5;
+    b->limbs[i] = (uint32_t)carry;
+    carry >>= 32;
   }
+  if (carry)
+    b->limbs[b->size++] = (uint32_t)carry;
+}
 
-  if (*c == '0')
-    c++;
-  else {
-    if (!strchr("123456789", *c) || *c == 0)
-      return -EINVAL;
+static void json_big_div5(struct json_big *b) {
+  uint64_t rest = 0;
+  int i;
 
-    do {
-      if (!is_double) {
-        int64_t t;
+  for (i = b->size - 1; i >= 0; --i) {
+    rest = rest << 32 | b->limbs[i];
+    b->limbs[i] = (uint32_t)(rest / 5);
+    rest %= 5;
+  }
+  while (b->size && !b->limbs[b->size - 1])
+    b->size--;
+}
 
-        t = 10 * i + (*c - '0');
-        if (t < i) /* overflow */
-          is_double = false;
-        else
-          i = t;
-      }
+static int json_big_bits(const struct json_big *b) {
+  return b->size ? 32 * b->size - __builtin_clz(b->limbs[b->size - 1]) : 0;
+}
 
-      x = 10.0 * x + (*c - '0');
-      c++;
-    } while (strchr("0123456789", *c) && *c != 0);
+/* the 64 bits of `b` starting at bit `at`, bits below 0 read as zero */
+static uint64_t json_big_word(const struct json_big *b, int at) {
+  uint64_t w = 0;
+  int i, bit;
+
+  for (i = 0; i < 64; ++i) {
+    bit = at + i;
+    if (bit >= 0 && bit / 32 < b->size && b->limbs[bit / 32] >> (bit % 32) & 1)
+      w |= 1ULL << i;
   }
+  return w;
+}
 
-  if (*c == '.') {
-    is_double = true;
+/* @func `json_pow5_init`
+ * @desc Fills `json_pow5` with the 128 bit significands of 5^q, the same
+ *       values as the fast_float tables: truncated for q >= 0, and for
+ *       q < 0 floor(2^b / 5^-q) + 1 with b chosen as in the reference
+ *       generator, truncated to 128 bits
+ */
+static void json_pow5_init(void) {
+  struct json_big big = {.size = 0}, shifted;
+  struct json_big power = {.limbs = {1}, .size = 1};
+  int q, i, bits, z, b, shift;
+  uint64_t carry;
+
+  /* positive powers by repeated multiplication */
+  for (q = 0; q <= JSON_POW5_MAX; ++q) {
+    bits = json_big_bits(&power);
+    json_pow5[q - JSON_POW5_MIN][0] = json_big_word(&power, bits - 64);
+    json_pow5[q - JSON_POW5_MIN][1] = json_big_word(&power, bits - 128);
+    json_big_mul5(&power);
+  }
+
+  /* negative powers as floor(2^1791 / 5^-q) by repeated floor division */
+  big.size = JSON_BIG_LIMBS;
+  big.limbs[JSON_BIG_LIMBS - 1] = 1U << 31;
+  power.limbs[0] = 1;
+  power.size = 1;
+  for (q = -1; q >= JSON_POW5_MIN; --q) {
+    json_big_div5(&big);
+    json_big_mul5(&power);
+
+    z = json_big_bits(&power);
+    b = q >= -27 ? z + 127 : 2 * z + 128;
+    shift = 32 * JSON_BIG_LIMBS - 1 - b;
+
+    /* floor(2^b / 5^-q) + 1 */
+    shifted.size = JSON_BIG_LIMBS;
+    for (i = 0; i < JSON_BIG_LIMBS; ++i)
+      shifted.limbs[i] = (uint32_t)json_big_word(&big, shift + 32 * i);
+    while (shifted.size && !shifted.limbs[shifted.size - 1])
+      shifted.size--;
+    carry = 1;
+    for (i = 0; carry && i < shifted.size; ++i) {
+      carry += shifted.limbs[i];
+      shifted.limbs[i] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    if (carry)
+      shifted.limbs[shifted.size++] = (uint32_t)carry;
+
+    bits = json_big_bits(&shifted);
+    json_pow5[q - JSON_POW5_MIN][0] = json_big_word(&shifted, bits - 64);
+    json_pow5[q - JSON_POW5_MIN][1] = json_big_word(&shifted, bits - 128);
+  }
+}
+
+static inline void json_mul128(uint64_t a, uint64_t b, uint64_t *hi,
+                               uint64_t *lo) {
+  unsigned __int128 r = (unsigned __int128)a * b;
+
+  *hi = (uint64_t)(r >> 64);
+  *lo = (uint64_t)r;
+}
+
+/* @func `json_eisel_lemire`
+ * @desc Correctly rounded w * 10^q for w != 0 with at most 19 digits
+ *
+ * @ret true with `*out` set, false when the product is too close to a
+ *      rounding boundary and the caller has to fall back
+ */
+static bool json_eisel_lemire(uint64_t w, int64_t q, double *out) {
+  uint64_t hi, lo, hi2, lo2, mantissa, bits;
+  int64_t power2;
+  int lz, upper, shift;
+
+  if (q < JSON_POW5_MIN) {
+    *out = 0.0;
+    return true;
+  }
+  if (q > JSON_POW5_MAX) {
+    *out = INFINITY;
+    return true;
+  }
+
+  (void)pthread_once(&json_pow5_once, json_pow5_init);
+
+  lz = __builtin_clzll(w);
+  w <<= lz;
+
+  json_mul128(w, json_pow5[q - JSON_POW5_MIN][0], &hi, &lo);
+  /* refine with the lower half when the bits that matter may carry */
+  if ((hi & 0x1ff) == 0x1ff) {
+    json_mul128(w, json_pow5[q - JSON_POW5_MIN][1], &hi2, &lo2);
+    lo += hi2;
+    if (hi2 > lo)
+      hi++;
+    if (lo == UINT64_MAX && (q < -27 || q > 55))
+      return false;
+  }
+
+  upper = (int)(hi >> 63);
+  shift = upper + 9;
+  mantissa = hi >> shift;
+  power2 = (((152170 + 65536) * q) >> 16) + 63 + upper - lz + 1023;
+
+  if (power2 <= 0) {
+    /* subnormal */
+    if (-power2 + 1 >= 64) {
+      *out = 0.0;
+      return true;
+    }
+    mantissa >>= -power2 + 1;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    power2 = mantissa < (1ULL << 52) ? 0 : 1;
+  } else {
+    /* exactly halfway between two doubles, round to even */
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+        mantissa << shift == hi)
+      mantissa &= ~1ULL;
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= 2ULL << 52) {
+      mantissa = 1ULL << 52;
+      power2++;
+    }
+    mantissa &= ~(1ULL << 52);
+
+    if (power2 >= 0x7ff) {
+      *out = INFINITY;
+      return true;
+    }
+  }
+
+  bits = mantissa | (uint64_t)power2 << 52;
+  memcpy(out, &bits, sizeof(bits));
+  return true;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static inline bool json_eight_digits(const char *c, uint64_t *out) {
+  uint64_t v;
+
+  memcpy(&v, c, sizeof(v));
+  if (((v + 0x4646464646464646ULL) | (v - 0x3030303030303030ULL)) &
+      0x8080808080808080ULL)
+    return false;
+
+  /* pairs, then quads, then all eight digits */
+  v -= 0x3030303030303030ULL;
+  v = v * 10 + (v >> 8);
+  v = (((v & 0x000000ff000000ffULL) * 0x000f424000000064ULL) +
+       (((v >> 16) & 0x000000ff000000ffULL) * 0x0000271000000001ULL)) >>
+      32;
+  *out = (uint32_t)v;
+  return true;
+}
+#else
+static inline bool json_eight_digits(const char *c, uint64_t *out) {
+  return false;
+}
+#endif
+
+/* @func `json_scan_digits`
+ * @desc Accumulates the decimal digits at `c` into `*w`, eight at a time
+ *       when possible, wrapping on overflow
+ *
+ * @ret pointer past the last digit
+ */
+static const char *json_scan_digits(const char *c, const char *end,
+                                    uint64_t *w) {
+  uint64_t eight;
+
+  while (end - c >= 8 && json_eight_digits(c, &eight)) {
+    *w = *w * 100000000 + eight;
+    c += 8;
+  }
+  while (c < end && *c >= '0' && *c <= '9')
+    *w = *w * 10 + (*c++ - '0');
+
+  return c;
+}
+
+/* @func `json_scan_number`
+ * @desc Parses a JSON number in `[c, end)`. Integers that fit `intmax_t`
+ *       stay integers, everything else becomes a correctly rounded double:
+ *       exact fast path for small values, Eisel-Lemire otherwise, and
+ *       `strtod` for more than 19 significant digits or ambiguous cases.
+ *
+ * @param(next) Receives the first byte after the number
+ *
+ * @ret JSON_REAL or JSON_INTEGER, or error code
+ */
+static int json_scan_number(const char *c, const char *end, const char **next,
+                            union json_value *ret) {
+  static const double exact[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *start = c, *digits, *p;
+  bool negative = false, is_double = false, exponent_negative = false;
+  int64_t exponent = 0, e = 0;
+  uint64_t w = 0;
+  size_t n;
+  char buf[128], *copy;
+  double d;
+
+  if (c < end && *c == '-') {
+    negative = true;
     c++;
+  }
 
-    if (!strchr("0123456789", *c) || *c == 0)
-      return -EINVAL;
+  digits = c;
+  if (c < end && *c == '0')
+    c++;
+  else if (c < end && *c >= '1' && *c <= '9')
+    c = json_scan_digits(c, end, &w);
+  else
+    return -EINVAL;
+  n = c - digits;
 
-    do {
-      y = 10.0 * y + (*c - '0');
-      shift = 10.0 * shift;
-      c++;
-    } while (strchr("0123456789", *c) && *c != 0);
+  if (c < end && *c == '.') {
+    is_double = true;
+    p = ++c;
+    c = json_scan_digits(c, end, &w);
+    if (c == p)
+      return -EINVAL;
+    n += c - p;
+    exponent = -(int64_t)(c - p);
   }
 
-  if (*c == 'e' || *c == 'E') {
+  if (c < end && (*c == 'e' || *c == 'E')) {
     is_double = true;
     c++;
 
-    if (*c == '-') {
-      exponent_negative = true;
-      c++;
-    } else if (*c == '+')
-      c++;
+    if (c < end && (*c == '-' || *c == '+'))
+      exponent_negative = *c++ == '-';
 
-    if (!strchr("0123456789", *c) || *c == 0)
+    if (c >= end || *c < '0' || *c > '9')
       return -EINVAL;
 
-    do {
-      exponent = 10.0 * exponent + (*c - '0');
-      c++;
-    } while (strchr("0123456789", *c) && *c != 0);
+    /* saturate, anything this large is zero or infinity anyway */
+    for (; c < end && *c >= '0' && *c <= '9'; ++c)
+      if (e < 0x10000000)
+        e = e * 10 + (*c - '0');
+    exponent += exponent_negative ? -e : e;
   }
 
-  *p = c;
+  *next = c;
 
-  if (is_double) {
-    ret->real = ((negative ? -1.0 : 1.0) * (x + (y / shift))) *
-                exp10f((exponent_negative ? -1.0 : 1.0) * exponent);
-    return JSON_REAL;
-  } else {
-    ret->integer = negative ? -i : i;
-    return JSON_INTEGER;
+  /* leading zeros don't count towards the 19 digits that fit `w` */
+  if (n > 19) {
+    for (p = digits; p < c && (*p == '0' || *p == '.'); ++p)
+      if (*p == '0')
+        n--;
+  }
+
+  if (!is_double && n <= 19) {
+    if (!negative && w <= INTMAX_MAX) {
+      ret->integer = (intmax_t)w;
+      return JSON_INTEGER;
+    }
+    if (negative && w <= (uint64_t)INTMAX_MAX + 1) {
+      ret->integer = (intmax_t)(0 - w);
+      return JSON_INTEGER;
+    }
+  }
+
+  if (n <= 19) {
+    if (w == 0) {
+      ret->real = negative ? -0.0 : 0.0;
+      return JSON_REAL;
+    }
+
+    /* both operands exact, a single rounding */
+    if (w <= 1ULL << 53 && exponent >= -22 && exponent <= 22) {
+      d = (double)w;
+      d = exponent < 0 ? d / exact[-exponent] : d * exact[exponent];
+      ret->real = negative ? -d : d;
+      return JSON_REAL;
+    }
+
+    if (json_eisel_lemire(w, exponent, &d)) {
+      ret->real = negative ? -d : d;
+      return JSON_REAL;
+    }
   }
+
+  n = c - start;
+  copy = n < sizeof(buf) ? buf : strndup(start, n);
+  if (!copy)
+    return -ENOMEM;
+  if (copy == buf) {
+    memcpy(buf, start, n);
+    buf[n] = 0;
+  }
+  ret->real = strtod(copy, NULL);
+  if (copy != buf)
+    free((void *)copy);
+
+  return JSON_REAL;
+}
+
+static int json_parse_number(const char **p, union json_value *ret) {
+  const char *c;
+  int r;
+
+  assert(p);
+  assert(*p);
+  assert(ret);
+
+  c = *p;
+  r = json_scan_number(c, c + strspn(c, "+-.eE0123456789"), &c, ret);
+  if (r < 0)
+    return r;
+
+  *p = c;
+  return r;
 }
 
 int json_tokenize(const char **p, char **ret_string,
@@ -877,3 +1353,1195 @@ int json_parse(const char *string, size_t size, JsonVariant **rv) {
   *rv = v;
   return 0;
 }
+
+/* documents at least this large get a structural index before parsing */
+#ifndef JSON_INDEX_MIN
+#define JSON_INDEX_MIN 4096
+#endif
+
+/* byte classes of a 64 byte block, bit `i` describes byte `i` */
+struct json_block {
+  uint64_t quote;
+  uint64_t backslash;
+  uint64_t space;
+  uint64_t op;
+};
+
+#if defined(PRT_INTEL) && defined(__AVX2__)
+static inline uint64_t json_mask32(__m256i v, char c) {
+  return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+static void json_classify(const uint8_t *p, struct json_block *b) {
+  __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+  __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+
+#define JSON_MASK(c) (json_mask32(lo, c) | json_mask32(hi, c) << 32)
+  b->quote = JSON_MASK('"');
+  b->backslash = JSON_MASK('\\');
+  b->space = JSON_MASK(' ') | JSON_MASK('\n') | JSON_MASK('\r') | JSON_MASK('\t');
+  b->op = JSON_MASK('{') | JSON_MASK('}') | JSON_MASK('[') | JSON_MASK(']') |
+          JSON_MASK(':') | JSON_MASK(',');
+#undef JSON_MASK
+}
+#elif defined(PRT_INTEL) && defined(__SSE2__)
+static inline uint64_t json_mask16(__m128i v, char c) {
+  return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+static void json_classify(const uint8_t *p, struct json_block *b) {
+  __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+  __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+  __m128i v2 = _mm_loadu_si128((const __m128i *)(p + 32));
+  __m128i v3 = _mm_loadu_si128((const __m128i *)(p + 48));
+
+#define JSON_MASK(c)                                                           \
+  (json_mask16(v0, c) | json_mask16(v1, c) << 16 | json_mask16(v2, c) << 32 | \
+   json_mask16(v3, c) << 48)
+  b->quote = JSON_MASK('"');
+  b->backslash = JSON_MASK('\\');
+  b->space = JSON_MASK(' ') | JSON_MASK('\n') | JSON_MASK('\r') | JSON_MASK('\t');
+  b->op = JSON_MASK('{') | JSON_MASK('}') | JSON_MASK('[') | JSON_MASK(']') |
+          JSON_MASK(':') | JSON_MASK(',');
+#undef JSON_MASK
+}
+#elif defined(PRT_ARM) && defined(__ARM_NEON) && defined(__aarch64__)
+/* NEON has no movemask, weight each lane by its bit and add pairwise */
+static inline uint64_t json_movemask(uint8x16_t m0, uint8x16_t m1,
+                                     uint8x16_t m2, uint8x16_t m3) {
+  static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                      1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t w = vld1q_u8(weights), s0, s1;
+
+  s0 = vpaddq_u8(vandq_u8(m0, w), vandq_u8(m1, w));
+  s1 = vpaddq_u8(vandq_u8(m2, w), vandq_u8(m3, w));
+  s0 = vpaddq_u8(s0, s1);
+  s0 = vpaddq_u8(s0, s0);
+  return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+}
+
+static void json_classify(const uint8_t *p, struct json_block *b) {
+  uint8x16_t v0 = vld1q_u8(p), v1 = vld1q_u8(p + 16);
+  uint8x16_t v2 = vld1q_u8(p + 32), v3 = vld1q_u8(p + 48);
+
+#define JSON_EQ(v, c) vceqq_u8(v, vdupq_n_u8(c))
+#define JSON_MASK(c)                                                           \
+  json_movemask(JSON_EQ(v0, c), JSON_EQ(v1, c), JSON_EQ(v2, c), JSON_EQ(v3, c))
+  b->quote = JSON_MASK('"');
+  b->backslash = JSON_MASK('\\');
+  b->space = JSON_MASK(' ') | JSON_MASK('\n') | JSON_MASK('\r') | JSON_MASK('\t');
+  b->op = JSON_MASK('{') | JSON_MASK('}') | JSON_MASK('[') | JSON_MASK(']') |
+          JSON_MASK(':') | JSON_MASK(',');
+#undef JSON_MASK
+#undef JSON_EQ
+}
+#else
+static void json_classify(const uint8_t *p, struct json_block *b) {
+  uint64_t bit;
+  int i;
+
+  memset(b, 0, sizeof(*b));
+  for (i = 0; i < 64; ++i) {
+    bit = 1ULL << i;
+    if (p[i] == '"')
+      b->quote |= bit;
+    else if (p[i] == '\\')
+      b->backslash |= bit;
+    else if (in_set(p[i], ' ', '\n', '\r', '\t'))
+      b->space |= bit;
+    else if (in_set(p[i], '{', '}', '[', ']', ':', ','))
+      b->op |= bit;
+  }
+}
+#endif
+
+/* @func `json_escaped`
+ * @desc Marks the bytes escaped by an odd run of backslashes, `carry` tells
+ *       whether the previous block ended in such a run
+ */
+static inline uint64_t json_escaped(uint64_t backslash, uint64_t *carry) {
+  const uint64_t even = 0x5555555555555555ULL, odd = ~even;
+  uint64_t starts, even_starts, odd_starts, even_ends, odd_ends, sum;
+  uint64_t even_mask = even ^ *carry;
+  bool overflow;
+
+  starts = backslash & ~(backslash << 1);
+  even_starts = starts & even_mask;
+  odd_starts = starts & ~even_mask;
+
+  even_ends = (backslash + even_starts) & ~backslash;
+  overflow = __builtin_add_overflow(backslash, odd_starts, &sum);
+  odd_ends = (sum | *carry) & ~backslash;
+  *carry = overflow;
+
+  return (even_ends & odd) | (odd_ends & even);
+}
+
+/* inclusive prefix xor, turns quote bits into an inside-string mask */
+static inline uint64_t json_prefix_xor(uint64_t x) {
+#if defined(PRT_INTEL) && defined(__PCLMUL__)
+  return _mm_cvtsi128_si64(_mm_clmulepi64_si128(
+      _mm_set_epi64x(0, x), _mm_set1_epi8((char)0xff), 0));
+#else
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+#endif
+}
+
+/* @func `json_structural_index`
+ * @desc First stage of `json_document_parse` for large documents. Bytes are
+ *       classified a block of 64 at a time and the offsets of every
+ *       structural character outside strings, every unescaped quote and the
+ *       first byte of every other token are collected, so the parser jumps
+ *       between tokens instead of stepping over whitespace and string
+ *       bodies byte by byte.
+ *
+ * @param(string)    JSON text
+ * @param(size)      Length of `string`, below 4 GiB
+ * @param(out_index) Receives the offsets, ascending, free with `free`
+ * @param(out_count) Receives the number of offsets
+ *
+ * @ret 0 on success or error code, -EINVAL on an unterminated string
+ */
+static int json_structural_index(const char *string, size_t size,
+                                 uint32_t **out_index, size_t *out_count) {
+  uint64_t escape_carry = 0, string_carry = 0, scalar_carry = 0;
+  uint64_t escaped, quote, in_string, scalar, bits;
+  struct json_block b;
+  uint8_t tail[64];
+  uint32_t *index, *p;
+  size_t offset, allocated, count = 0;
+
+  assert(size < UINT32_MAX);
+
+  allocated = size / 8 + 64;
+  index = (uint32_t *)malloc(allocated * sizeof(uint32_t));
+  if (!index)
+    return -ENOMEM;
+
+  for (offset = 0; offset < size; offset += 64) {
+    if (size - offset >= 64)
+      json_classify((const uint8_t *)string + offset, &b);
+    else {
+      /* pad the last block with whitespace */
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, string + offset, size - offset);
+      json_classify(tail, &b);
+    }
+
+    escaped = json_escaped(b.backslash, &escape_carry);
+    quote = b.quote & ~escaped;
+    in_string = json_prefix_xor(quote) ^ string_carry;
+    string_carry = (uint64_t)((int64_t)in_string >> 63);
+
+    /* anything else outside strings belongs to a number or literal */
+    scalar = ~(b.op | b.space | b.quote) & ~in_string;
+    bits = (b.op & ~in_string) | quote | (scalar & ~(scalar << 1 | scalar_carry));
+    scalar_carry = scalar >> 63;
+
+    if (allocated - count < 64) {
+      allocated *= 2;
+      p = (uint32_t *)reallocarray(index, allocated, sizeof(uint32_t));
+      if (!p) {
+        free((void *)index);
+        return -ENOMEM;
+      }
+      index = p;
+    }
+
+    for (; bits; bits &= bits - 1)
+      index[count++] = (uint32_t)(offset + __builtin_ctzll(bits));
+  }
+
+  if (string_carry) {
+    free((void *)index);
+    return -EINVAL;
+  }
+
+  *out_index = index;
+  *out_count = count;
+  return 0;
+}
+
+enum json_parser_mode {
+  /* strings are copied into the arena */
+  JSON_PARSER_COPY,
+  /* strings without escapes point into the source */
+  JSON_PARSER_VIEW,
+  /* strings are decoded and terminated inside the source */
+  JSON_PARSER_INSITU,
+};
+
+struct json_parser {
+  const char *c;
+  const char *end;
+  const char *begin;
+  enum json_parser_mode mode;
+  /* token offsets from `json_structural_index`, `NULL` for small input */
+  const uint32_t *index;
+  size_t index_pos;
+  size_t index_count;
+  Arena *arena;
+  /* children of all open containers, moved into the arena on close */
+  JsonVariant *stack;
+  size_t stack_size;
+  size_t stack_allocated;
+  unsigned depth;
+};
+
+static inline bool json_is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+/* moves the index cursor to the first token at or after `ps->c` */
+static inline void json_parser_sync(struct json_parser *ps) {
+  size_t offset = ps->c - ps->begin;
+
+  while (ps->index_pos < ps->index_count &&
+         ps->index[ps->index_pos] < offset)
+    ps->index_pos++;
+}
+
+static void json_parser_skip_space(struct json_parser *ps) {
+  if (ps->index) {
+    /* whitespace only ever ends at a token or the end of input */
+    if (ps->c < ps->end && json_is_space(*ps->c)) {
+      json_parser_sync(ps);
+      ps->c = ps->index_pos < ps->index_count
+                  ? ps->begin + ps->index[ps->index_pos]
+                  : ps->end;
+    }
+    return;
+  }
+
+  while (ps->c < ps->end && json_is_space(*ps->c))
+    ps->c++;
+}
+
+static int json_parser_push(struct json_parser *ps, const JsonVariant *v) {
+  JsonVariant *stack;
+  size_t n;
+
+  if (ps->stack_size == ps->stack_allocated) {
+    n = MAX(ps->stack_allocated * 2, 64);
+    stack = (JsonVariant *)reallocarray(ps->stack, n, sizeof(JsonVariant));
+    if (!stack)
+      return -ENOMEM;
+    ps->stack = stack;
+    ps->stack_allocated = n;
+  }
+
+  ps->stack[ps->stack_size++] = *v;
+  return 0;
+}
+
+static int json_utf8_length(unsigned char c) {
+  if (c < 0x80)
+    return 1;
+  if ((c & 0xe0) == 0xc0)
+    return 2;
+  if ((c & 0xf0) == 0xe0)
+    return 3;
+  if ((c & 0xf8) == 0xf0)
+    return 4;
+  return -EINVAL;
+}
+
+#define JSON_ONES 0x0101010101010101ULL
+#define JSON_HIGHS 0x8080808080808080ULL
+#define JSON_HAS_ZERO(w) (((w)-JSON_ONES) & ~(w)&JSON_HIGHS)
+
+/* any byte that `json_decode_string` must look at: controls, DEL, quotes,
+ * backslashes and the start of multi-byte sequences
+ */
+static inline bool json_word_special(uint64_t w) {
+  return ((w - JSON_ONES * 0x20) | w) & JSON_HIGHS ||
+         JSON_HAS_ZERO(w ^ (JSON_ONES * '"')) ||
+         JSON_HAS_ZERO(w ^ (JSON_ONES * '\\')) ||
+         JSON_HAS_ZERO(w ^ (JSON_ONES * 0x7f));
+}
+
+/* @func `json_decode_string`
+ * @desc Validates and decodes the string body starting at `c` into `out`,
+ *       stopping at the closing quote. Decoding never produces more bytes
+ *       than it consumes, so `out` may be `c` itself. A `NULL` `out` only
+ *       validates and is limited to strings without escape sequences.
+ *
+ * @ret number of bytes written or error code, `*next` follows the quote
+ */
+static ssize_t json_decode_string(const char *c, const char *end, char *out,
+                                  const char **next) {
+  size_t n = 0;
+  uint16_t x, y;
+  char ch;
+  int len, r;
+
+  for (;;) {
+    /* plain printable ASCII is taken a word at a time */
+    while (end - c >= 8) {
+      uint64_t w;
+
+      memcpy(&w, c, sizeof(w));
+      if (json_word_special(w))
+        break;
+      if (out && out + n != c)
+        memmove(out + n, c, sizeof(w));
+      n += sizeof(w);
+      c += sizeof(w);
+    }
+
+    if (c >= end)
+      return -EINVAL;
+
+    if (*c == '"') {
+      *next = c + 1;
+      return n;
+    }
+
+    /* control characters 0x00..0x1f and 0x7f */
+    if ((unsigned char)*c < ' ' || *c == 0x7f)
+      return -EINVAL;
+
+    if (*c == '\\') {
+      if (++c >= end)
+        return -EINVAL;
+
+      if (in_set(*c, '"', '\\', '/'))
+        ch = *c;
+      else if (*c == 'b')
+        ch = '\b';
+      else if (*c == 'f')
+        ch = '\f';
+      else if (*c == 'n')
+        ch = '\n';
+      else if (*c == 'r')
+        ch = '\r';
+      else if (*c == 't')
+        ch = '\t';
+      else if (*c == 'u') {
+        if (end - c < 5)
+          return -EINVAL;
+
+        r = unhex_ucs2(c + 1, &x);
+        if (r < 0)
+          return r;
+        c += 5;
+
+        if (!utf16_is_surrogate(x)) {
+          n += utf8_encode_unichar(out + n, x);
+          continue;
+        }
+        if (utf16_is_trailing_surrogate(x) || end - c < 6 || c[0] != '\\' ||
+            c[1] != 'u')
+          return -EINVAL;
+
+        r = unhex_ucs2(c + 2, &y);
+        if (r < 0)
+          return r;
+        if (!utf16_is_trailing_surrogate(y))
+          return -EINVAL;
+        c += 6;
+
+        n += utf8_encode_unichar(out + n, utf16_surrogate_pair_to_unichar(x, y));
+        continue;
+      } else
+        return -EINVAL;
+
+      out[n++] = ch;
+      c++;
+      continue;
+    }
+
+    len = json_utf8_length(*c);
+    if (len < 0 || end - c < len)
+      return -EINVAL;
+    if (len > 1) {
+      r = utf8_encoded_valid_unichar(c);
+      if (r < 0)
+        return r;
+    }
+
+    /* validation only, or nothing to shift yet while decoding in place */
+    if (out && out + n != c)
+      memmove(out + n, c, len);
+    n += len;
+    c += len;
+  }
+}
+
+static int json_parser_string(struct json_parser *ps, JsonVariant *v) {
+  const char *c, *body;
+  bool escaped = false;
+  ssize_t n;
+  char *s;
+
+  /* the decoded string is at most as long as the raw one */
+  body = ps->c + 1;
+  if (ps->index) {
+    /* the opening quote is followed by the closing one in the index */
+    json_parser_sync(ps);
+    if (ps->index_pos + 1 >= ps->index_count ||
+        ps->begin + ps->index[ps->index_pos] != ps->c)
+      return -EINVAL;
+    c = ps->begin + ps->index[ps->index_pos + 1];
+    if (*c != '"')
+      return -EINVAL;
+    ps->index_pos += 2;
+    escaped = memchr(body, '\\', c - body) != NULL;
+  } else {
+    for (c = body; c < ps->end && *c != '"'; ++c)
+      if (*c == '\\') {
+        escaped = true;
+        c++;
+      }
+    if (c >= ps->end)
+      return -EINVAL;
+  }
+
+  v->type = JSON_VARIANT_STRING;
+
+  if (ps->mode == JSON_PARSER_INSITU) {
+    /* the closing quote, or an earlier byte, becomes the terminator */
+    s = (char *)body;
+    n = json_decode_string(body, ps->end, s, &ps->c);
+    if (n < 0)
+      return (int)n;
+    s[n] = 0;
+
+    v->flags = JSON_STRING_INSITU | (escaped ? JSON_STRING_DECODED : 0);
+    v->size = n;
+    v->string = s;
+    return 0;
+  }
+
+  if (ps->mode == JSON_PARSER_VIEW && !escaped) {
+    n = json_decode_string(body, ps->end, NULL, &ps->c);
+    if (n < 0)
+      return (int)n;
+
+    v->flags = JSON_STRING_INSITU | JSON_STRING_UNTERMINATED;
+    v->size = n;
+    v->string = (char *)body;
+    return 0;
+  }
+
+  s = (char *)arena_alloc(ps->arena, c - body + 1);
+  if (!s)
+    return -ENOMEM;
+
+  n = json_decode_string(body, ps->end, s, &ps->c);
+  if (n < 0)
+    return (int)n;
+  s[n] = 0;
+
+  v->flags = 0;
+  v->size = n;
+  v->string = s;
+
+  return 0;
+}
+
+static int json_parser_number(struct json_parser *ps, JsonVariant *v) {
+  const char *c;
+  int r;
+
+  r = json_scan_number(ps->c, ps->end, &c, &v->value);
+  if (r < 0)
+    return r;
+  /* reject run-ons such as `1.2.3` or `1e5e5` */
+  if (c < ps->end && strchr("+-.eE0123456789", *c) && *c)
+    return -EINVAL;
+
+  v->type = r == JSON_REAL ? JSON_VARIANT_REAL : JSON_VARIANT_INTEGER;
+  v->size = 0;
+  ps->c = c;
+
+  return 0;
+}
+
+static bool json_parser_literal(struct json_parser *ps, const char *word) {
+  size_t n = strlen(word);
+
+  if ((size_t)(ps->end - ps->c) < n || memcmp(ps->c, word, n) != 0)
+    return false;
+
+  ps->c += n;
+  return true;
+}
+
+static int json_parser_value(struct json_parser *ps, JsonVariant *v);
+
+/* @func `json_parser_container`
+ * @desc Parses an array or object, children are collected on the scratch
+ *       stack and copied into one arena block once the scope closes
+ */
+static int json_parser_container(struct json_parser *ps, JsonVariant *v,
+                                 bool object) {
+  char terminator = object ? '}' : ']';
+  JsonVariant child;
+  size_t base, n;
+  int r;
+
+  if (++ps->depth > JSON_DEPTH_MAX)
+    return -EBADMSG;
+
+  base = ps->stack_size;
+  ps->c++;
+
+  json_parser_skip_space(ps);
+  if (ps->c < ps->end && *ps->c == terminator) {
+    ps->c++;
+  } else {
+    for (;;) {
+      if (object) {
+        json_parser_skip_space(ps);
+        if (ps->c >= ps->end || *ps->c != '"')
+          return -EBADMSG;
+        memset(&child, 0, sizeof(child));
+        r = json_parser_string(ps, &child);
+        if (r < 0)
+          return r;
+        r = json_parser_push(ps, &child);
+        if (r < 0)
+          return r;
+
+        json_parser_skip_space(ps);
+        if (ps->c >= ps->end || *ps->c != ':')
+          return -EBADMSG;
+        ps->c++;
+      }
+
+      r = json_parser_value(ps, &child);
+      if (r < 0)
+        return r;
+      r = json_parser_push(ps, &child);
+      if (r < 0)
+        return r;
+
+      json_parser_skip_space(ps);
+      if (ps->c >= ps->end)
+        return -EBADMSG;
+      if (*ps->c == terminator) {
+        ps->c++;
+        break;
+      }
+      if (*ps->c != ',')
+        return -EBADMSG;
+      ps->c++;
+    }
+  }
+
+  n = ps->stack_size - base;
+  v->type = object ? JSON_VARIANT_OBJECT : JSON_VARIANT_ARRAY;
+  v->size = n;
+  v->objects = (JsonVariant *)arena_alloc(ps->arena, n * sizeof(JsonVariant));
+  if (!v->objects)
+    return -ENOMEM;
+  if (n)
+    memcpy(v->objects, ps->stack + base, n * sizeof(JsonVariant));
+
+  /* index large objects now, the arena keeps lookups allocation free */
+  v->index = NULL;
+  if (object && n / 2 >= JSON_INDEX_KEYS) {
+    v->index = (struct json_key_index *)arena_alloc(ps->arena,
+                                                    json_key_index_size(n / 2));
+    if (!v->index)
+      return -ENOMEM;
+    memset(v->index, 0, json_key_index_size(n / 2));
+    json_key_index_fill(v, v->index);
+  }
+
+  ps->stack_size = base;
+  ps->depth--;
+
+  return 0;
+}
+
+static int json_parser_value(struct json_parser *ps, JsonVariant *v) {
+  json_parser_skip_space(ps);
+  if (ps->c >= ps->end)
+    return -EBADMSG;
+
+  memset(v, 0, sizeof(*v));
+
+  switch (*ps->c) {
+  case '{':
+    return json_parser_container(ps, v, true);
+  case '[':
+    return json_parser_container(ps, v, false);
+  case '"':
+    return json_parser_string(ps, v);
+  case '-':
+  case '0' ... '9':
+    return json_parser_number(ps, v);
+  }
+
+  if (json_parser_literal(ps, "true")) {
+    v->type = JSON_VARIANT_BOOLEAN;
+    v->value.boolean = true;
+  } else if (json_parser_literal(ps, "false")) {
+    v->type = JSON_VARIANT_BOOLEAN;
+    v->value.boolean = false;
+  } else if (json_parser_literal(ps, "null"))
+    v->type = JSON_VARIANT_NULL;
+  else
+    return -EINVAL;
+
+  return 0;
+}
+
+static int json_document_parse_mode(const char *string, size_t size,
+                                    enum json_parser_mode mode,
+                                    JsonDocument **out_doc) {
+  struct json_parser ps = {0};
+  JsonDocument *doc;
+  Arena *arena;
+  int r;
+
+  assert(string || size == 0);
+  assert(out_doc);
+
+  /* variants take about three times the text they were parsed from */
+  r = arena_new(MAX(size * 3, 4096), &arena);
+  if (r < 0)
+    return r;
+
+  r = -ENOMEM;
+  doc = (JsonDocument *)arena_alloc(arena, sizeof(JsonDocument));
+  if (!doc)
+    goto err;
+  doc->arena = arena;
+
+  ps.c = ps.begin = string;
+  ps.end = string + size;
+  ps.mode = mode;
+  ps.arena = arena;
+
+  if (size >= JSON_INDEX_MIN && size < UINT32_MAX) {
+    r = json_structural_index(string, size, (uint32_t **)&ps.index,
+                              &ps.index_count);
+    if (r < 0)
+      goto err;
+  }
+
+  r = json_parser_value(&ps, &doc->root);
+  if (r < 0)
+    goto err;
+
+  json_parser_skip_space(&ps);
+  if (ps.c != ps.end) {
+    r = -EBADMSG;
+    goto err;
+  }
+
+  free((void *)ps.stack);
+  free((void *)ps.index);
+  *out_doc = doc;
+
+  return 0;
+err:
+  free((void *)ps.stack);
+  free((void *)ps.index);
+  arena_unref(arena);
+  return r;
+}
+
+/* @func `json_document_parse`
+ * @desc Single pass recursive descent parser. The whole tree, including
+ *       all strings, lives in one arena, so the document is released with
+ *       a single `json_document_unref` and individual variants must not be
+ *       passed to `json_variant_unref`.
+ *
+ * @param(string)  JSON text, doesn't need to be terminated
+ * @param(size)    Length of `string`
+ * @param(out_doc) Receives the document
+ *
+ * @ret 0 on success or error code
+ */
+int json_document_parse(const char *string, size_t size,
+                        JsonDocument **out_doc) {
+  return json_document_parse_mode(string, size, JSON_PARSER_COPY, out_doc);
+}
+
+/* @func `json_document_parse_view`
+ * @desc Like `json_document_parse`, but strings without escape sequences
+ *       aren't copied: they point into `string` and are flagged
+ *       `JSON_STRING_INSITU | JSON_STRING_UNTERMINATED`, so they must be
+ *       read with `json_variant_string_view`. `string` is left untouched,
+ *       which suits shared buffers such as cached `FileResource` data, and
+ *       must outlive the document.
+ *
+ * @param(string)  JSON text, doesn't need to be terminated
+ * @param(size)    Length of `string`
+ * @param(out_doc) Receives the document
+ *
+ * @ret 0 on success or error code
+ */
+int json_document_parse_view(const char *string, size_t size,
+                             JsonDocument **out_doc) {
+  return json_document_parse_mode(string, size, JSON_PARSER_VIEW, out_doc);
+}
+
+/* @func `json_document_parse_insitu`
+ * @desc Like `json_document_parse`, but no string is copied. Escape
+ *       sequences are decoded in place and every string is terminated by
+ *       overwriting its closing quote, so `string` is destroyed as JSON
+ *       text and must outlive the document. Strings that had escapes are
+ *       flagged `JSON_STRING_DECODED`.
+ *
+ * @param(string)  Writable JSON text, doesn't need to be terminated
+ * @param(size)    Length of `string`
+ * @param(out_doc) Receives the document
+ *
+ * @ret 0 on success or error code, on failure `string` may be modified
+ */
+int json_document_parse_insitu(char *string, size_t size,
+                               JsonDocument **out_doc) {
+  return json_document_parse_mode(string, size, JSON_PARSER_INSITU, out_doc);
+}
+
+int json_document_unref(JsonDocument *doc) {
+  assert(doc);
+  return arena_unref(doc->arena);
+}
+
+enum {
+  JSON_READER_VALUE,
+  /* after `[`, a value or `]` */
+  JSON_READER_ARRAY_FIRST,
+  /* after `{`, a key or `}` */
+  JSON_READER_OBJECT_FIRST,
+  JSON_READER_KEY,
+  /* after a value, `,` or the closing bracket */
+  JSON_READER_NEXT,
+  JSON_READER_DONE,
+  JSON_READER_FINISHED,
+};
+
+static ssize_t json_read_fd(void *context, char *buffer, size_t size) {
+  ssize_t n;
+
+  do
+    n = read((int)(intptr_t)context, buffer, size);
+  while (n < 0 && errno == EINTR);
+
+  return n < 0 ? -errno : n;
+}
+
+/* @func `json_reader_fill`
+ * @desc Moves the unconsumed input to the front and reads until the buffer
+ *       is full or the input ends. The buffer doubles once a token fills
+ *       more than half of it, so rescanning a long token stays linear.
+ */
+static int json_reader_fill(JsonReader *reader) {
+  size_t n = reader->end - reader->begin, allocated;
+  ssize_t k;
+  char *buffer;
+
+  if (reader->eof)
+    return 0;
+
+  if (reader->begin) {
+    memmove(reader->buffer, reader->buffer + reader->begin, n);
+    reader->begin = 0;
+    reader->end = n;
+  }
+
+  if (n > reader->allocated / 2) {
+    allocated = reader->allocated * 2;
+    buffer = (char *)realloc(reader->buffer, allocated);
+    if (!buffer)
+      return -ENOMEM;
+    reader->buffer = buffer;
+    reader->allocated = allocated;
+  }
+
+  while (reader->end < reader->allocated) {
+    k = reader->read(reader->context, reader->buffer + reader->end,
+                     reader->allocated - reader->end);
+    if (k < 0)
+      return (int)k;
+    if (k == 0) {
+      reader->eof = true;
+      break;
+    }
+    reader->end += k;
+  }
+
+  return 0;
+}
+
+static int json_reader_skip_space(JsonReader *reader) {
+  int r;
+
+  for (;;) {
+    while (reader->begin < reader->end &&
+           json_is_space(reader->buffer[reader->begin]))
+      reader->begin++;
+
+    if (reader->begin < reader->end || reader->eof)
+      return 0;
+
+    r = json_reader_fill(reader);
+    if (r < 0)
+      return r;
+  }
+}
+
+/* @ret 1 when `n` bytes are available, 0 at the end of input or error code */
+static int json_reader_ensure(JsonReader *reader, size_t n) {
+  int r;
+
+  while (reader->end - reader->begin < n) {
+    if (reader->eof)
+      return 0;
+    r = json_reader_fill(reader);
+    if (r < 0)
+      return r;
+  }
+
+  return 1;
+}
+
+static int json_reader_string(JsonReader *reader) {
+  const char *c, *end, *next;
+  size_t allocated;
+  ssize_t n;
+  char *s;
+  int r;
+
+  /* find the closing quote, reading more until it is buffered */
+  for (;;) {
+    end = reader->buffer + reader->end;
+    for (c = reader->buffer + reader->begin + 1; c < end && *c != '"'; ++c)
+      if (*c == '\\')
+        c++;
+    if (c < end)
+      break;
+    if (reader->eof)
+      return -EINVAL;
+    r = json_reader_fill(reader);
+    if (r < 0)
+      return r;
+  }
+
+  c = reader->buffer + reader->begin + 1;
+  if ((size_t)(end - c) >= reader->string_allocated) {
+    allocated = MAX((size_t)(end - c) + 1, reader->string_allocated * 2);
+    s = (char *)realloc(reader->string, allocated);
+    if (!s)
+      return -ENOMEM;
+    reader->string = s;
+    reader->string_allocated = allocated;
+  }
+
+  n = json_decode_string(c, end, reader->string, &next);
+  if (n < 0)
+    return (int)n;
+  reader->string[n] = 0;
+  reader->size = n;
+  reader->begin = next - reader->buffer;
+
+  return 0;
+}
+
+static int json_reader_number(JsonReader *reader, JsonEvent *event) {
+  const char *c, *end, *next;
+  int r;
+
+  for (;;) {
+    c = reader->buffer + reader->begin;
+    end = reader->buffer + reader->end;
+    while (c < end && strchr("+-.eE0123456789", *c) && *c)
+      c++;
+    if (c < end || reader->eof)
+      break;
+    r = json_reader_fill(reader);
+    if (r < 0)
+      return r;
+  }
+
+  r = json_scan_number(reader->buffer + reader->begin, c, &next,
+                       &reader->value);
+  if (r < 0)
+    return r;
+  if (next != c)
+    return -EINVAL;
+
+  *event = r == JSON_REAL ? JSON_EVENT_REAL : JSON_EVENT_INTEGER;
+  reader->begin = c - reader->buffer;
+
+  return 0;
+}
+
+static int json_reader_literal(JsonReader *reader, const char *word) {
+  size_t n = strlen(word);
+  int r;
+
+  r = json_reader_ensure(reader, n);
+  if (r <= 0)
+    return r < 0 ? r : -EINVAL;
+  if (memcmp(reader->buffer + reader->begin, word, n) != 0)
+    return -EINVAL;
+
+  reader->begin += n;
+  return 0;
+}
+
+static int json_reader_value(JsonReader *reader, JsonEvent *event) {
+  char c = reader->buffer[reader->begin];
+  int r;
+
+  if (c == '{' || c == '[') {
+    if (reader->depth >= JSON_DEPTH_MAX)
+      return -EBADMSG;
+    reader->scopes[reader->depth++] = c == '{';
+    reader->begin++;
+    reader->state = c == '{' ? JSON_READER_OBJECT_FIRST : JSON_READER_ARRAY_FIRST;
+    *event = c == '{' ? JSON_EVENT_OBJECT_BEGIN : JSON_EVENT_ARRAY_BEGIN;
+    return 0;
+  }
+
+  if (c == '"') {
+    r = json_reader_string(reader);
+    *event = JSON_EVENT_STRING;
+  } else if (c == '-' || (c >= '0' && c <= '9'))
+    r = json_reader_number(reader, event);
+  else if (c == 't' || c == 'f') {
+    r = json_reader_literal(reader, c == 't' ? "true" : "false");
+    reader->value.boolean = c == 't';
+    *event = JSON_EVENT_BOOLEAN;
+  } else if (c == 'n') {
+    r = json_reader_literal(reader, "null");
+    *event = JSON_EVENT_NULL;
+  } else
+    return -EBADMSG;
+
+  if (r < 0)
+    return r;
+  reader->state = reader->depth ? JSON_READER_NEXT : JSON_READER_DONE;
+  return 0;
+}
+
+static int json_reader_close(JsonReader *reader, JsonEvent *event) {
+  bool object = reader->buffer[reader->begin] == '}';
+
+  if (!reader->depth || reader->scopes[reader->depth - 1] != object)
+    return -EBADMSG;
+
+  reader->depth--;
+  reader->begin++;
+  reader->state = reader->depth ? JSON_READER_NEXT : JSON_READER_DONE;
+  *event = object ? JSON_EVENT_OBJECT_END : JSON_EVENT_ARRAY_END;
+  return 0;
+}
+
+/* @func `json_reader_next`
+ * @desc Reads up to the next event. Keys and strings are decoded into
+ *       `reader->string` (`reader->size` bytes, terminated), numbers and
+ *       booleans into `reader->value`; both stay valid until the next call.
+ *       Once the root value is complete the rest of the input must be
+ *       whitespace and every further call returns `JSON_EVENT_END`.
+ *
+ * @param(out_event) Receives the event
+ *
+ * @ret 0 on success or error code
+ */
+int json_reader_next(JsonReader *reader, JsonEvent *out_event) {
+  JsonEvent event;
+  char c;
+  int r;
+
+  assert(reader);
+  assert(out_event);
+
+  r = json_reader_skip_space(reader);
+  if (r < 0)
+    return r;
+
+  if (reader->state == JSON_READER_FINISHED) {
+    *out_event = reader->event = JSON_EVENT_END;
+    return 0;
+  }
+
+  if (reader->begin == reader->end) {
+    if (reader->state != JSON_READER_DONE)
+      return -EBADMSG;
+    reader->state = JSON_READER_FINISHED;
+    *out_event = reader->event = JSON_EVENT_END;
+    return 0;
+  }
+
+  c = reader->buffer[reader->begin];
+
+  switch (reader->state) {
+  case JSON_READER_DONE:
+    return -EBADMSG;
+
+  case JSON_READER_NEXT:
+    if (c == '}' || c == ']') {
+      r = json_reader_close(reader, &event);
+      break;
+    }
+    if (c != ',')
+      return -EBADMSG;
+    reader->begin++;
+    reader->state = reader->scopes[reader->depth - 1] ? JSON_READER_KEY
+                                                      : JSON_READER_VALUE;
+    return json_reader_next(reader, out_event);
+
+  case JSON_READER_ARRAY_FIRST:
+    if (c == ']') {
+      r = json_reader_close(reader, &event);
+      break;
+    }
+    r = json_reader_value(reader, &event);
+    break;
+
+  case JSON_READER_OBJECT_FIRST:
+    if (c == '}') {
+      r = json_reader_close(reader, &event);
+      break;
+    }
+    /* fall through */
+  case JSON_READER_KEY:
+    if (c != '"')
+      return -EBADMSG;
+    r = json_reader_string(reader);
+    if (r < 0)
+      return r;
+
+    r = json_reader_skip_space(reader);
+    if (r < 0)
+      return r;
+    if (reader->begin == reader->end || reader->buffer[reader->begin] != ':')
+      return -EBADMSG;
+    reader->begin++;
+    reader->state = JSON_READER_VALUE;
+    event = JSON_EVENT_KEY;
+    break;
+
+  default:
+    r = json_reader_value(reader, &event);
+    break;
+  }
+
+  if (r < 0)
+    return r;
+
+  *out_event = reader->event = event;
+  return 0;
+}
+
+/* @func `json_reader_skip`
+ * @desc Skips the value belonging to the last event: the rest of a container
+ *       after its begin event, or the value following a key. Nothing is
+ *       decoded into memory beyond the current token.
+ *
+ * @ret 0 on success or error code
+ */
+int json_reader_skip(JsonReader *reader) {
+  JsonEvent event;
+  size_t depth;
+  int r;
+
+  assert(reader);
+
+  event = reader->event;
+  if (event == JSON_EVENT_KEY) {
+    r = json_reader_next(reader, &event);
+    if (r < 0)
+      return r;
+  }
+
+  if (event != JSON_EVENT_OBJECT_BEGIN && event != JSON_EVENT_ARRAY_BEGIN)
+    return 0;
+
+  depth = reader->depth - 1;
+  while (reader->depth > depth) {
+    r = json_reader_next(reader, &event);
+    if (r < 0)
+      return r;
+    if (event == JSON_EVENT_END)
+      return -EBADMSG;
+  }
+
+  return 0;
+}
+
+/* @func `json_reader_new`
+ * @desc Creates a reader pulling its input through `read` in chunks of
+ *       `JSON_READER_CHUNK` bytes
+ *
+ * @param(read)       Input callback
+ * @param(context)    Passed to `read`
+ * @param(out_reader) Receives the reader
+ *
+ * @ret 0 on success or error code
+ */
+int json_reader_new(JsonReadFunc read, void *context, JsonReader **out_reader) {
+  JsonReader *reader;
+
+  assert(read);
+  assert(out_reader);
+
+  reader = NEW0(JsonReader);
+  if (!reader)
+    return -ENOMEM;
+
+  reader->buffer = (char *)malloc(JSON_READER_CHUNK);
+  if (!reader->buffer) {
+    free((void *)reader);
+    return -ENOMEM;
+  }
+  reader->allocated = JSON_READER_CHUNK;
+  reader->owned = true;
+  reader->read = read;
+  reader->context = context;
+
+  *out_reader = reader;
+  return 0;
+}
+
+/* the descriptor is read from its current offset and isn't closed */
+int json_reader_new_fd(int fd, JsonReader **out_reader) {
+  assert(fd >= 0);
+  return json_reader_new(json_read_fd, (void *)(intptr_t)fd, out_reader);
+}
+
+/* @func `json_reader_new_resource`
+ * @desc Creates a reader over data that is already loaded, the buffer is
+ *       used as is and `fr` must outlive the reader
+ */
+int json_reader_new_resource(const FileResource *fr, JsonReader **out_reader) {
+  JsonReader *reader;
+
+  assert(fr);
+  assert(out_reader);
+
+  reader = NEW0(JsonReader);
+  if (!reader)
+    return -ENOMEM;
+
+  reader->buffer = fr->data;
+  reader->end = reader->allocated = fr->size;
+  reader->eof = true;
+
+  *out_reader = reader;
+  return 0;
+}
+
+int json_reader_unref(JsonReader *reader) {
+  assert(reader);
+
+  if (reader->owned)
+    free((void *)reader->buffer);
+  free((void *)reader->string);
+  free((void *)reader);
+  return 0;
+}
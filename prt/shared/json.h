@@ -13,7 +13,11 @@
   You should have received a copy of the GNU Lesser General Public License
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
+#pragma once
+
 #include <stdbool.h>
+#include <sys/types.h>
+#include <prt/shared/arena.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -51,26 +55,55 @@ union json_value {
   intmax_t integer;
 };
 
+/* where a string variant's bytes live, see `json_document_parse_view` */
+enum {
+  /* points into the text the document was parsed from */
+  JSON_STRING_INSITU = 1 << 0,
+  /* not NUL terminated, only `size` bytes are valid */
+  JSON_STRING_UNTERMINATED = 1 << 1,
+  /* escape sequences were decoded in place, the source text was modified */
+  JSON_STRING_DECODED = 1 << 2,
+};
+
+/* objects with at least this many keys get a hashed key index */
+#ifndef JSON_INDEX_KEYS
+#define JSON_INDEX_KEYS 16
+#endif
+
+/* nesting limit of the document parser and the pull reader, guards the
+ * parser's recursion and sizes the reader's scope stack */
+#define JSON_DEPTH_MAX 512
+
+struct json_key_index;
+
 typedef struct _JsonVariant {
   JsonVariantType type;
+  unsigned flags;
   size_t size;
   union {
     char *string;
     struct _JsonVariant *objects;
     union json_value value;
   };
+  /* large objects only, built by the document parser or on first lookup */
+  struct json_key_index *index;
 } JsonVariant;
 
 int json_variant_new(JsonVariant **ret, JsonVariantType type);
 JsonVariant *json_variant_unref(JsonVariant *v);
 
 char *json_variant_string(JsonVariant *v);
+const char *json_variant_string_view(JsonVariant *v, size_t *size);
+bool json_variant_string_equal(JsonVariant *v, const char *s);
 bool json_variant_bool(JsonVariant *v);
 intmax_t json_variant_integer(JsonVariant *v);
 double json_variant_real(JsonVariant *v);
 
 JsonVariant *json_variant_element(JsonVariant *v, unsigned index);
 JsonVariant *json_variant_value(JsonVariant *v, const char *key);
+/* `hash` must be `HASH(key)` */
+JsonVariant *json_variant_value_hashed(JsonVariant *v, Id hash,
+                                       const char *key);
 
 #define JSON_VALUE_NULL ((union json_value){})
 
@@ -79,6 +112,72 @@ int json_tokenize(const char **p, char **ret_string,
 
 int json_parse(const char *string, size_t size, JsonVariant **rv);
 
+/* Tree built in a single pass with every variant and string in one arena */
+typedef struct _JsonDocument {
+  Arena *arena;
+  JsonVariant root;
+} JsonDocument;
+
+int json_document_parse(const char *string, size_t size,
+                        JsonDocument **out_doc);
+/* strings without escapes point into `string`, which must outlive `doc` */
+int json_document_parse_view(const char *string, size_t size,
+                             JsonDocument **out_doc);
+/* every string is decoded and terminated inside `string` itself */
+int json_document_parse_insitu(char *string, size_t size,
+                               JsonDocument **out_doc);
+int json_document_unref(JsonDocument *doc);
+
+/* Pull reader producing one event per call with bounded memory, the input
+ * is read in chunks and only the token being parsed has to fit in memory.
+ */
+typedef enum {
+  JSON_EVENT_END,
+  JSON_EVENT_OBJECT_BEGIN,
+  JSON_EVENT_OBJECT_END,
+  JSON_EVENT_ARRAY_BEGIN,
+  JSON_EVENT_ARRAY_END,
+  JSON_EVENT_KEY,
+  JSON_EVENT_STRING,
+  JSON_EVENT_INTEGER,
+  JSON_EVENT_REAL,
+  JSON_EVENT_BOOLEAN,
+  JSON_EVENT_NULL,
+} JsonEvent;
+
+/* fills up to `size` bytes, returns the count, 0 at the end or error code */
+typedef ssize_t (*JsonReadFunc)(void *context, char *buffer, size_t size);
+
+#define JSON_READER_CHUNK 0x10000
+
+struct _FileResource;
+
+typedef struct _JsonReader {
+  JsonReadFunc read;
+  void *context;
+  /* unconsumed input is `buffer[begin, end)` */
+  char *buffer;
+  size_t begin, end, allocated;
+  bool owned, eof;
+  int state;
+  JsonEvent event;
+  /* `true` for objects, one entry per open container */
+  bool scopes[JSON_DEPTH_MAX];
+  size_t depth;
+  /* decoded key or string of the last event, valid until the next one */
+  char *string;
+  size_t size, string_allocated;
+  union json_value value;
+} JsonReader;
+
+int json_reader_new(JsonReadFunc read, void *context, JsonReader **out_reader);
+int json_reader_new_fd(int fd, JsonReader **out_reader);
+int json_reader_new_resource(const struct _FileResource *fr,
+                             JsonReader **out_reader);
+int json_reader_next(JsonReader *reader, JsonEvent *out_event);
+int json_reader_skip(JsonReader *reader);
+int json_reader_unref(JsonReader *reader);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,333 @@
+#include <prt/shared/json_bind.h>
+
+/* gives up on a table size after this many seeds and doubles it */
+#define JSON_NAMES_SEEDS 4096
+
+/* perfect hash table, every name has its own slot */
+struct json_names {
+  uint32_t seed;
+  uint32_t mask;
+  /* name index + 1, 0 for an empty slot */
+  uint16_t slots[];
+};
+
+static inline char json_fold(char c, bool fold_case) {
+  return fold_case && c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+/* FNV-1a over the optionally case folded bytes, seeded */
+static uint32_t json_names_hash(const char *s, size_t n, uint32_t seed,
+                                bool fold_case) {
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+  size_t i;
+
+  for (i = 0; i < n; ++i)
+    h = (h ^ (uint8_t)json_fold(s[i], fold_case)) * 16777619u;
+  return h ^ h >> 15;
+}
+
+static bool json_names_equal(const char *name, const char *s, size_t n,
+                             bool fold_case) {
+  size_t i;
+
+  for (i = 0; i < n; ++i)
+    if (!name[i] || json_fold(name[i], fold_case) != json_fold(s[i], fold_case))
+      return false;
+  return name[n] == 0;
+}
+
+#define JSON_NAME(base, stride, i)                                             \
+  (*(const char *const *)((const uint8_t *)(base) + (i) * (stride)))
+
+/* @func `json_names_build`
+ * @desc Searches a seed that maps `count` names, read from `base` every
+ *       `stride` bytes, to distinct slots
+ *
+ * @ret the table or `NULL` when out of memory
+ */
+static struct json_names *json_names_build(const void *base, size_t stride,
+                                           size_t count, bool fold_case) {
+  struct json_names *t;
+  const char *name;
+  uint32_t seed, slot;
+  size_t capacity = 4, i;
+
+  assert(count < UINT16_MAX);
+
+  while (capacity < count * 2)
+    capacity <<= 1;
+
+  for (;;) {
+    t = (struct json_names *)calloc(1, sizeof(*t) + capacity * sizeof(uint16_t));
+    if (!t)
+      return NULL;
+    t->mask = capacity - 1;
+
+    for (seed = 0; seed < JSON_NAMES_SEEDS; ++seed) {
+      memset(t->slots, 0, capacity * sizeof(uint16_t));
+      for (i = 0; i < count; ++i) {
+        name = JSON_NAME(base, stride, i);
+        slot = json_names_hash(name, strlen(name), seed, fold_case) & t->mask;
+        if (t->slots[slot])
+          break;
+        t->slots[slot] = i + 1;
+      }
+      if (i == count) {
+        t->seed = seed;
+        return t;
+      }
+    }
+
+    free((void *)t);
+    capacity <<= 1;
+  }
+}
+
+/* publishes `*table` once, concurrent builders drop their copy */
+static struct json_names *json_names_get(struct json_names **table,
+                                         const void *base, size_t stride,
+                                         size_t count, bool fold_case) {
+  struct json_names *t, *expected = NULL;
+
+  t = __atomic_load_n(table, __ATOMIC_ACQUIRE);
+  if (t)
+    return t;
+
+  t = json_names_build(base, stride, count, fold_case);
+  if (!t)
+    return NULL;
+
+  if (!__atomic_compare_exchange_n(table, &expected, t, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free((void *)t);
+    return expected;
+  }
+  return t;
+}
+
+/* @ret index of the name or -1 */
+static ssize_t json_names_find(const struct json_names *t, const void *base,
+                               size_t stride, const char *s, size_t n,
+                               bool fold_case) {
+  uint16_t slot;
+
+  slot = t->slots[json_names_hash(s, n, t->seed, fold_case) & t->mask];
+  if (!slot ||
+      !json_names_equal(JSON_NAME(base, stride, slot - 1), s, n, fold_case))
+    return -1;
+  return slot - 1;
+}
+
+/* @func `json_enum_lookup`
+ * @desc Finds the value of a name without allocating, one hash and one
+ *       comparison per lookup
+ *
+ * @param(s)         Name, doesn't need to be terminated
+ * @param(n)         Length of `s`
+ * @param(out_value) Receives the value
+ *
+ * @ret 0 on success, -ENOENT for unknown names or error code
+ */
+int json_enum_lookup(JsonEnum *e, const char *s, size_t n, int *out_value) {
+  struct json_names *t;
+  size_t count;
+  ssize_t i;
+
+  assert(e);
+  assert(s);
+  assert(out_value);
+
+  for (count = 0; e->names[count]; ++count)
+    ;
+
+  t = json_names_get(&e->table, e->names, sizeof(*e->names), count,
+                     e->fold_case);
+  if (!t)
+    return -ENOMEM;
+
+  i = json_names_find(t, e->names, sizeof(*e->names), s, n, e->fold_case);
+  if (i < 0)
+    return -ENOENT;
+
+  *out_value = e->values ? e->values[i] : (int)i;
+  return 0;
+}
+
+static int json_bind_field(const JsonField *f, JsonVariant *v, uint8_t *out) {
+  const char *s;
+  uint8_t *items;
+  size_t n, i;
+  int r;
+
+  switch (f->type) {
+  case JSON_FIELD_INT:
+    if (v->type != JSON_VARIANT_INTEGER || v->value.integer < INT_MIN ||
+        v->value.integer > INT_MAX)
+      return -EINVAL;
+    *(int *)(out + f->offset) = (int)v->value.integer;
+    return 0;
+
+  case JSON_FIELD_REAL:
+  case JSON_FIELD_FLOAT: {
+    double d;
+
+    if (v->type == JSON_VARIANT_REAL)
+      d = v->value.real;
+    else if (v->type == JSON_VARIANT_INTEGER)
+      d = (double)v->value.integer;
+    else
+      return -EINVAL;
+
+    if (f->type == JSON_FIELD_REAL)
+      *(double *)(out + f->offset) = d;
+    else
+      *(float *)(out + f->offset) = (float)d;
+    return 0;
+  }
+
+  case JSON_FIELD_BOOL:
+    if (v->type != JSON_VARIANT_BOOLEAN)
+      return -EINVAL;
+    *(bool *)(out + f->offset) = v->value.boolean;
+    return 0;
+
+  case JSON_FIELD_STRING:
+    if (v->type != JSON_VARIANT_STRING)
+      return -EINVAL;
+    s = json_variant_string_view(v, &n);
+    *(char **)(out + f->offset) = strndup(s, n);
+    return *(char **)(out + f->offset) ? 0 : -ENOMEM;
+
+  case JSON_FIELD_ENUM:
+    if (v->type != JSON_VARIANT_STRING)
+      return -EINVAL;
+    s = json_variant_string_view(v, &n);
+    r = json_enum_lookup(f->names, s, n, (int *)(out + f->offset));
+    return r == -ENOENT ? -EINVAL : r;
+
+  case JSON_FIELD_ARRAY:
+    if (v->type != JSON_VARIANT_ARRAY)
+      return -EINVAL;
+
+    items = (uint8_t *)calloc(MAX(v->size, (size_t)1), f->schema->size);
+    if (!items)
+      return -ENOMEM;
+    /* stored first so a partial array is released by `json_bind_free` */
+    *(void **)(out + f->offset) = items;
+    *(size_t *)(out + f->count_offset) = 0;
+
+    for (i = 0; i < v->size; ++i) {
+      r = json_bind(f->schema, &v->objects[i], items + i * f->schema->size);
+      if (r < 0)
+        return r;
+      *(size_t *)(out + f->count_offset) = i + 1;
+    }
+    return 0;
+
+  case JSON_FIELD_OBJECT:
+    return json_bind(f->schema, v, out + f->offset);
+  }
+
+  return -EINVAL;
+}
+
+/* @func `json_bind`
+ * @desc Decodes `object` into the struct at `out` in a single pass over its
+ *       pairs. Unknown keys are ignored, missing required keys and values
+ *       of the wrong type fail. Members of absent optional keys keep their
+ *       value.
+ *
+ * @param(schema) Description of the struct
+ * @param(object) Object variant to decode
+ * @param(out)    Zeroed struct to fill, release with `json_bind_free`
+ *
+ * @ret 0 on success or error code, on failure `out` holds nothing that
+ *      needs freeing
+ */
+int json_bind(JsonSchema *schema, JsonVariant *object, void *out) {
+  struct json_names *t;
+  const JsonField *f;
+  uint64_t seen = 0, required = 0;
+  const char *key;
+  size_t i, n;
+  ssize_t k;
+  int r;
+
+  assert(schema);
+  assert(object);
+  assert(out);
+  /* a bit per field tracks the required ones */
+  assert(schema->num_fields <= 64);
+
+  if (object->type != JSON_VARIANT_OBJECT)
+    return -EINVAL;
+
+  t = json_names_get(&schema->table, schema->fields, sizeof(JsonField),
+                     schema->num_fields, false);
+  if (!t)
+    return -ENOMEM;
+
+  for (i = 0; i < object->size; i += 2) {
+    key = json_variant_string_view(&object->objects[i], &n);
+    k = json_names_find(t, schema->fields, sizeof(JsonField), key, n, false);
+    /* first pair wins, as with `json_variant_value` */
+    if (k < 0 || seen & 1ULL << k)
+      continue;
+
+    f = &schema->fields[k];
+    r = json_bind_field(f, &object->objects[i + 1], (uint8_t *)out);
+    if (r < 0) {
+      _Log(LL_ERROR, "Invalid `%s` element", f->key);
+      json_bind_free(schema, out);
+      return r;
+    }
+    seen |= 1ULL << k;
+  }
+
+  for (k = 0; k < (ssize_t)schema->num_fields; ++k)
+    if (schema->fields[k].required)
+      required |= 1ULL << k;
+
+  if ((seen & required) != required) {
+    for (k = 0; k < (ssize_t)schema->num_fields; ++k)
+      if (required & ~seen & 1ULL << k)
+        _Log(LL_ERROR, "Missing `%s` element", schema->fields[k].key);
+    json_bind_free(schema, out);
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+/* @func `json_bind_free`
+ * @desc Releases the strings and arrays `json_bind` allocated in `data`
+ *       and clears the pointers
+ */
+void json_bind_free(JsonSchema *schema, void *data) {
+  const JsonField *f;
+  uint8_t *out = (uint8_t *)data, *items;
+  size_t i, j, count;
+
+  assert(schema);
+  assert(data);
+
+  for (i = 0; i < schema->num_fields; ++i) {
+    f = &schema->fields[i];
+
+    if (f->type == JSON_FIELD_STRING) {
+      free(*(void **)(out + f->offset));
+      *(void **)(out + f->offset) = NULL;
+    } else if (f->type == JSON_FIELD_ARRAY) {
+      items = *(uint8_t **)(out + f->offset);
+      if (!items)
+        continue;
+      count = *(size_t *)(out + f->count_offset);
+      for (j = 0; j < count; ++j)
+        json_bind_free(f->schema, items + j * f->schema->size);
+      free((void *)items);
+      *(void **)(out + f->offset) = NULL;
+      *(size_t *)(out + f->count_offset) = 0;
+    } else if (f->type == JSON_FIELD_OBJECT)
+      json_bind_free(f->schema, out + f->offset);
+  }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <prt/shared/basic.h>
+#include <prt/shared/json.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Declarative decoding of JSON objects into C structs. A `JsonSchema` lists
+ * the keys of an object with the offset and type of the member each one is
+ * stored to; `json_bind` walks the object's pairs once and looks every key
+ * up in a perfect hash table built from the schema on first use.
+ */
+
+struct json_names;
+
+/* Names of an enumeration, matched through a perfect hash table */
+typedef struct _JsonEnum {
+  /* `NULL` terminated */
+  const char *const *names;
+  /* value of each name, the name's index when `NULL` */
+  const int *values;
+  /* compare names ignoring ASCII case */
+  bool fold_case;
+  /* built on the first lookup */
+  struct json_names *table;
+} JsonEnum;
+
+typedef enum _JsonFieldType {
+  /* `int` */
+  JSON_FIELD_INT,
+  /* `double` */
+  JSON_FIELD_REAL,
+  /* `float` */
+  JSON_FIELD_FLOAT,
+  /* `bool` */
+  JSON_FIELD_BOOL,
+  /* `char *`, allocated */
+  JSON_FIELD_STRING,
+  /* `int` or any `int` sized enum, through `names` */
+  JSON_FIELD_ENUM,
+  /* pointer to `schema->size` sized elements, allocated, with a `size_t`
+   * count at `count_offset`
+   */
+  JSON_FIELD_ARRAY,
+  /* nested struct stored inline */
+  JSON_FIELD_OBJECT,
+} JsonFieldType;
+
+struct _JsonSchema;
+
+typedef struct _JsonField {
+  const char *key;
+  JsonFieldType type;
+  size_t offset;
+  bool required;
+  JsonEnum *names;
+  struct _JsonSchema *schema;
+  size_t count_offset;
+} JsonField;
+
+typedef struct _JsonSchema {
+  const JsonField *fields;
+  size_t num_fields;
+  /* size of the decoded struct, used for array elements */
+  size_t size;
+  /* built on the first `json_bind` */
+  struct json_names *table;
+} JsonSchema;
+
+int json_enum_lookup(JsonEnum *e, const char *s, size_t n, int *out_value);
+int json_bind(JsonSchema *schema, JsonVariant *object, void *out);
+void json_bind_free(JsonSchema *schema, void *data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,159 @@
+/* Type-generic parts of the kd-trees, included once per coordinate type by
+ * kd_tree.c and kd_treef.c, hence no include guard. Define before
+ * including:
+ *
+ *   KD_T    coordinate and squared distance type
+ *   KD_KNN  bounded max-heap type with `data`, `distance`, `k` and `size`
+ *           members, `distance` being a `KD_T *`
+ *
+ * Both are undefined again at the end.
+ */
+
+#if !defined(KD_T) || !defined(KD_KNN)
+#error "KD_T and KD_KNN must be defined before including kd_template.h"
+#endif
+
+/* @func `_widest_axis`
+ * @desc Finds the axis with the largest extent among `indices`
+ */
+static int _widest_axis(const KD_T *points, const size_t *indices, size_t n,
+                        int dimension) {
+  KD_T lo, hi, v, extent;
+  size_t i;
+  int d, axis;
+
+  axis = 0;
+  extent = -1;
+  for (d = 0; d < dimension; ++d) {
+    lo = hi = points[indices[0] * dimension + d];
+    for (i = 1; i < n; ++i) {
+      v = points[indices[i] * dimension + d];
+      if (v < lo)
+        lo = v;
+      if (v > hi)
+        hi = v;
+    }
+
+    if (hi - lo > extent) {
+      extent = hi - lo;
+      axis = d;
+    }
+  }
+
+  return axis;
+}
+
+#define KD_COORD(i) points[indices[(i)] * dimension + axis]
+#define KD_SWAP(a, b)                                                          \
+  ({                                                                           \
+    size_t _t_ = indices[(a)];                                                 \
+    indices[(a)] = indices[(b)];                                               \
+    indices[(b)] = _t_;                                                        \
+  })
+
+/* @func `_select_median`
+ * @desc Quickselect (nth_element) of `indices` along `axis`, afterwards
+ *       everything before `k` is <= and everything after is >= `indices[k]`
+ */
+static void _select_median(const KD_T *points, size_t *indices, size_t n,
+                           size_t k, int dimension, int axis) {
+  size_t lo, hi, lt, gt, i;
+  KD_T a, b, c, pivot;
+
+  lo = 0;
+  hi = n - 1;
+  while (hi > lo) {
+    /* median of three pivot */
+    a = KD_COORD(lo);
+    b = KD_COORD(lo + (hi - lo) / 2);
+    c = KD_COORD(hi);
+    pivot = MAX(MIN(a, b), MIN(MAX(a, b), c));
+
+    /* three-way partition keeps duplicate coordinates linear */
+    lt = i = lo;
+    gt = hi;
+    while (i <= gt) {
+      if (KD_COORD(i) < pivot) {
+        KD_SWAP(lt, i);
+        lt++;
+        i++;
+      } else if (KD_COORD(i) > pivot) {
+        KD_SWAP(i, gt);
+        gt--;
+      } else
+        i++;
+    }
+
+    if (k < lt)
+      hi = lt - 1;
+    else if (k > gt)
+      lo = gt + 1;
+    else
+      return;
+  }
+}
+
+#undef KD_SWAP
+#undef KD_COORD
+
+static void _knn_swap(KD_KNN *h, size_t a, size_t b) {
+  void *data;
+  KD_T distance;
+
+  data = h->data[a];
+  distance = h->distance[a];
+  h->data[a] = h->data[b];
+  h->distance[a] = h->distance[b];
+  h->data[b] = data;
+  h->distance[b] = distance;
+}
+
+static void _knn_sift_down(KD_KNN *h, size_t i, size_t size) {
+  size_t c;
+
+  while ((c = i * 2 + 1) < size) {
+    if (c + 1 < size && h->distance[c + 1] > h->distance[c])
+      c++;
+    if (h->distance[c] <= h->distance[i])
+      return;
+    _knn_swap(h, i, c);
+    i = c;
+  }
+}
+
+/* keeps the `k` closest, the farthest of them at the root */
+static void _knn_push(KD_KNN *h, void *data, KD_T distance) {
+  size_t i;
+
+  if (h->size < h->k) {
+    i = h->size++;
+    h->data[i] = data;
+    h->distance[i] = distance;
+    while (i > 0 && h->distance[(i - 1) / 2] < h->distance[i]) {
+      _knn_swap(h, i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+  } else if (distance < h->distance[0]) {
+    h->data[0] = data;
+    h->distance[0] = distance;
+    _knn_sift_down(h, 0, h->size);
+  }
+}
+
+/* anything farther than this cannot enter the heap */
+static KD_T _knn_bound(const KD_KNN *h) {
+  return h->size < h->k ? (KD_T)INFINITY : h->distance[0];
+}
+
+/* heap sort in place, leaves the results ordered by ascending distance */
+static void _knn_sort(KD_KNN *h) {
+  size_t end;
+
+  for (end = h->size; end > 1; --end) {
+    _knn_swap(h, 0, end - 1);
+    _knn_sift_down(h, 0, end - 1);
+  }
+}
+
+#undef KD_KNN
+#undef KD_T
@@ -15,21 +15,10 @@ static int _clear_tree_recursive(KdNode *node) {
   return 0;
 }
 
-static int _clear_results(KdResultNode *r) {
-  KdResultNode *a, *b;
-  a = r;
-  while (a) {
-    b = a->next;
-    free((void *)a);
-    a = b;
-  }
-  return 0;
-}
-
 static int _insert_record(KdNode **node, const double *p, void *data, int dir,
                           int dim) {
   KdNode *n;
-  int nd;
+  int nd, r;
   assert(p);
   assert(node);
 
@@ -47,17 +36,24 @@ static int _insert_record(KdNode **node, const double *p, void *data, int dir,
     memcpy(n->position, p, dim * sizeof(*n->position));
     n->data = data;
     n->direction = dir;
+    n->size = 1;
     *node = n;
 
     return 0;
   }
 
+  /* split on the node's own axis, the same way the searches descend */
   n = *node;
   nd = (n->direction + 1) % dim;
 
-  if (p[nd] > n->position[nd])
-    return _insert_record(&(*node)->left, p, data, nd, dim);
-  return _insert_record(&(*node)->right, p, data, nd, dim);
+  if (p[n->direction] <= n->position[n->direction])
+    r = _insert_record(&n->left, p, data, nd, dim);
+  else
+    r = _insert_record(&n->right, p, data, nd, dim);
+  if (r == 0)
+    n->size++;
+
+  return r;
 }
 
 static int _hyper_rectangle_extend(KdHyperRect *r, const double *p) {
@@ -144,26 +140,16 @@ static int _hyper_rectangle_distance_sq(KdHyperRect *r, const double *p,
   return 0;
 }
 
-static int _insert_result_node(KdResultNode *rn, KdNode *node,
-                               double distance) {
-  KdResultNode *r;
-  assert(rn);
-
-  r = NEW0(KdResultNode);
-  if (!r)
-    return -ENOMEM;
-
-  r->node = node;
-  r->distance_squared = distance;
-
-  if (distance >= 0.0)
-    while (rn->next && rn->next->distance_squared < distance)
-      rn = rn->next;
+/* appends to the result buffer, only grows it when capacity runs out */
+static int _push_result(Array *results, KdNode *node, double distance) {
+  KdResult result;
+  assert(results);
 
-  r->next = rn->next;
-  rn->next = r;
+  result.node = node;
+  result.data = node->data;
+  result.distance_squared = distance;
 
-  return 0;
+  return ARRAY_ADD(results, result);
 }
 
 static int _find_nearest_slicing(KdNode *node, const double *p,
@@ -206,7 +192,7 @@ static int _find_nearest_slicing(KdNode *node, const double *p,
   for (i = 0; i < hyperrect->dimension; ++i)
     distance += SQUARE(node->position[i] - p[i]);
 
-  if (distance < *out_distance) {
+  if (distance < *out_distance && !node->deleted) {
     *out_result = node;
     *out_distance = distance;
   }
@@ -228,55 +214,352 @@ static int _find_nearest_slicing(KdNode *node, const double *p,
   return 0;
 }
 
+/* appends the points within `range` of `p` to `results`, callers count
+ * them by the growth of `results` */
 static int _find_nearest(KdNode *node, const double *p, double range,
-                         KdResultNode *rn, int ordered, int dimension,
-                         size_t *out_numfound) {
+                         Array *results, int dimension) {
   double distance, dx;
-  size_t i, found, f;
+  size_t i;
   int r;
-  assert(rn);
+  assert(results);
   assert(p);
 
-  if (!node) {
-    *out_numfound = 0;
+  if (!node)
     return 0;
-  }
 
-  found = 0;
-  r = 0;
   distance = 0.0;
-  dx = 0.0;
-
   for (i = 0; i < dimension; ++i)
     distance += SQUARE(node->position[i] - p[i]);
 
-  if (distance <= SQUARE(range)) {
-    r = _insert_result_node(rn, node, ordered ? distance : -1.0);
+  if (distance <= SQUARE(range) && !node->deleted) {
+    r = _push_result(results, node, distance);
     if (r < 0)
       return r;
-    found = 1;
   }
 
   dx = p[node->direction] - node->position[node->direction];
-  r = _find_nearest(dx <= 0.0 ? node->left : node->right, p, range, rn, ordered,
-                    dimension, &f);
+  r = _find_nearest(dx <= 0.0 ? node->left : node->right, p, range, results,
+                    dimension);
   if (r < 0)
     return r;
 
-  if (fabs(dx) < range) {
-    found += f;
-    r = _find_nearest(dx <= 0.0 ? node->right : node->left, p, range, rn,
-                      ordered, dimension, &f);
+  if (fabs(dx) < range)
+    return _find_nearest(dx <= 0.0 ? node->right : node->left, p, range,
+                         results, dimension);
+
+  return 0;
+}
+
+enum KdRegionClass { KD_REGION_OUTSIDE, KD_REGION_PARTIAL, KD_REGION_INSIDE };
+
+/* axis aligned box when `min` is set, convex polytope otherwise */
+struct KdRegion {
+  int dimension;
+  const double *min, *max;
+  /* `num_planes` * (`dimension` + 1), inside where n . x + d >= 0 */
+  const double *planes;
+  size_t num_planes;
+};
+
+static bool _region_contains(const struct KdRegion *region, const double *p) {
+  const double *plane;
+  double v;
+  size_t i;
+  int d;
+
+  if (region->min) {
+    for (d = 0; d < region->dimension; ++d)
+      if (p[d] < region->min[d] || p[d] > region->max[d])
+        return false;
+    return true;
+  }
+
+  for (i = 0; i < region->num_planes; ++i) {
+    plane = &region->planes[i * (region->dimension + 1)];
+    v = plane[region->dimension];
+    for (d = 0; d < region->dimension; ++d)
+      v += plane[d] * p[d];
+    if (v < 0.0)
+      return false;
+  }
+
+  return true;
+}
+
+/* @func `_region_classify`
+ * @desc Classifies a cell against the region. For planes the corner
+ *       farthest along the normal decides "outside", the nearest one
+ *       "inside".
+ */
+static enum KdRegionClass _region_classify(const struct KdRegion *region,
+                                           const KdHyperRect *cell) {
+  enum KdRegionClass c = KD_REGION_INSIDE;
+  const double *plane;
+  double far, near;
+  size_t i;
+  int d;
+
+  if (region->min) {
+    for (d = 0; d < region->dimension; ++d) {
+      if (cell->max[d] < region->min[d] || cell->min[d] > region->max[d])
+        return KD_REGION_OUTSIDE;
+      if (cell->min[d] < region->min[d] || cell->max[d] > region->max[d])
+        c = KD_REGION_PARTIAL;
+    }
+    return c;
+  }
+
+  for (i = 0; i < region->num_planes; ++i) {
+    plane = &region->planes[i * (region->dimension + 1)];
+    far = near = plane[region->dimension];
+    for (d = 0; d < region->dimension; ++d) {
+      far += plane[d] * (plane[d] > 0.0 ? cell->max[d] : cell->min[d]);
+      near += plane[d] * (plane[d] > 0.0 ? cell->min[d] : cell->max[d]);
+    }
+    if (far < 0.0)
+      return KD_REGION_OUTSIDE;
+    if (near < 0.0)
+      c = KD_REGION_PARTIAL;
+  }
+
+  return c;
+}
+
+/* reports a whole subtree without testing its points */
+static int _report_subtree(KdNode *node, Array *results, size_t *found) {
+  int r;
+
+  for (; node; node = node->right) {
+    if (!node->deleted) {
+      r = _push_result(results, node, 0.0);
+      if (r < 0)
+        return r;
+      (*found)++;
+    }
+
+    r = _report_subtree(node->left, results, found);
+    if (r < 0)
+      return r;
+  }
+
+  return 0;
+}
+
+/* @func `_find_region`
+ * @desc Collects all points inside `region`, `cell` is narrowed in place to
+ *       the bounds of `node` while descending
+ */
+static int _find_region(KdNode *node, const struct KdRegion *region,
+                        KdHyperRect *cell, Array *results, size_t *found) {
+  double saved;
+  int dir, r;
+
+  if (!node)
+    return 0;
+
+  switch (_region_classify(region, cell)) {
+  case KD_REGION_OUTSIDE:
+    return 0;
+  case KD_REGION_INSIDE:
+    return _report_subtree(node, results, found);
+  default:
+    break;
+  }
+
+  if (!node->deleted && _region_contains(region, node->position)) {
+    r = _push_result(results, node, 0.0);
     if (r < 0)
       return r;
-    found += f;
+    (*found)++;
+  }
+
+  dir = node->direction;
+
+  saved = cell->max[dir];
+  cell->max[dir] = node->position[dir];
+  r = _find_region(node->left, region, cell, results, found);
+  cell->max[dir] = saved;
+  if (r < 0)
+    return r;
+
+  saved = cell->min[dir];
+  cell->min[dir] = node->position[dir];
+  r = _find_region(node->right, region, cell, results, found);
+  cell->min[dir] = saved;
+
+  return r;
+}
+
+struct KdBuildArgs {
+  const double *points;
+  void **data;
+  size_t *indices;
+  size_t n;
+  int dimension;
+  int depth;
+  KdNode **out_node;
+  int result;
+};
+
+static int _build_subtree(const double *points, void **data, size_t *indices,
+                          size_t n, int dimension, int depth,
+                          KdNode **out_node);
+
+static void *_build_subtree_thread(void *build_args) {
+  struct KdBuildArgs *a = (struct KdBuildArgs *)build_args;
+
+  a->result = _build_subtree(a->points, a->data, a->indices, a->n,
+                             a->dimension, a->depth, a->out_node);
+  return NULL;
+}
+
+/* Bounded max-heap of the k best candidates, stored directly in the
+ * caller's result buffers. The root holds the current k-th distance.
+ */
+struct KdKnn {
+  void **data;
+  double *distance;
+  size_t k;
+  size_t size;
+  /* approximate mode, (1 + epsilon)^2 - 1 */
+  double slack;
+  /* node visits left before giving up, 0 for unlimited */
+  size_t budget;
+  size_t visited;
+};
+
+#define KD_T double
+#define KD_KNN struct KdKnn
+#include <prt/shared/kd_template.h>
+
+/* @func `_build_subtree`
+ * @desc Recursively builds balanced subtree over `indices`, splitting at the
+ *       median of the widest axis. Upper levels fork the left half onto a
+ *       separate thread while `depth` is positive.
+ */
+static int _build_subtree(const double *points, void **data, size_t *indices,
+                          size_t n, int dimension, int depth,
+                          KdNode **out_node) {
+  struct KdBuildArgs args;
+  pthread_t thread;
+  KdNode *node;
+  size_t mid;
+  int axis, r;
+  bool forked;
+
+  if (!n) {
+    *out_node = NULL;
+    return 0;
+  }
+
+  axis = _widest_axis(points, indices, n, dimension);
+  mid = n / 2;
+  _select_median(points, indices, n, mid, dimension, axis);
+
+  node = NEW0(KdNode);
+  if (!node)
+    return -ENOMEM;
+
+  node->position = (KD_POSITION)calloc(dimension, sizeof(*node->position));
+  if (!node->position) {
+    free((void *)node);
+    return -ENOMEM;
+  }
+
+  memcpy(node->position, &points[indices[mid] * dimension],
+         dimension * sizeof(*node->position));
+  node->data = data ? data[indices[mid]] : NULL;
+  node->direction = axis;
+  node->size = n;
+
+  args.points = points;
+  args.data = data;
+  args.indices = indices;
+  args.n = mid;
+  args.dimension = dimension;
+  args.depth = depth - 1;
+  args.out_node = &node->left;
+  args.result = 0;
+
+  forked = depth > 0 && n >= KD_BUILD_PARALLEL_MIN &&
+           pthread_create(&thread, NULL, _build_subtree_thread, &args) == 0;
+  if (!forked)
+    (void)_build_subtree_thread(&args);
+
+  r = _build_subtree(points, data, indices + mid + 1, n - mid - 1, dimension,
+                     depth - 1, &node->right);
+
+  if (forked)
+    pthread_join(thread, NULL);
+
+  if (r < 0 || args.result < 0) {
+    _clear_tree_recursive(node);
+    return r < 0 ? r : args.result;
   }
 
-  *out_numfound = found;
+  *out_node = node;
 
   return 0;
 }
 
+/* @func `_knn_configure`
+ * @desc Applies optional search parameters, `NULL` keeps the search exact
+ */
+static void _knn_configure(struct KdKnn *h, const KdSearchParams *params) {
+  if (!params)
+    return;
+
+  h->slack = SQUARE(1.0 + params->epsilon) - 1.0;
+  h->budget = params->max_visits;
+}
+
+/* whether a cell at squared distance `rd` is still worth a visit */
+static bool _knn_reaches(const struct KdKnn *h, double rd) {
+  return rd + rd * h->slack < _knn_bound(h);
+}
+
+/* counts a visit, false once the budget is spent */
+static bool _knn_visit(struct KdKnn *h) {
+  if (h->budget && h->visited >= h->budget)
+    return false;
+  h->visited++;
+  return true;
+}
+
+static void _knn_search(KdNode *node, const double *p, int dimension,
+                        double *offsets, double rd, struct KdKnn *h) {
+  KdNode *near, *far;
+  double distance, dx, old;
+  int i, axis;
+
+  if (!_knn_visit(h))
+    return;
+
+  distance = 0.0;
+  for (i = 0; i < dimension; ++i)
+    distance += SQUARE(node->position[i] - p[i]);
+  if (!node->deleted)
+    _knn_push(h, node->data, distance);
+
+  axis = node->direction;
+  dx = p[axis] - node->position[axis];
+  near = dx <= 0.0 ? node->left : node->right;
+  far = dx <= 0.0 ? node->right : node->left;
+
+  if (near)
+    _knn_search(near, p, dimension, offsets, rd, h);
+
+  if (far) {
+    old = offsets[axis];
+    rd += SQUARE(dx) - SQUARE(old);
+    if (_knn_reaches(h, rd)) {
+      offsets[axis] = dx;
+      _knn_search(far, p, dimension, offsets, rd, h);
+      offsets[axis] = old;
+    }
+  }
+}
+
 int kd_tree_new(int dimensions, KdTree **out_tree) {
   KdTree *tree;
   assert(out_tree);
@@ -295,10 +578,13 @@ int kd_tree_new(int dimensions, KdTree **out_tree) {
 }
 
 int kd_tree_clear(KdTree *tree) {
+  int r;
   assert(tree);
-  assert(tree->root);
 
-  return _clear_tree_recursive(tree->root);
+  r = _clear_tree_recursive(tree->root);
+  tree->root = NULL;
+
+  return r;
 }
 
 int kd_tree_unref(KdTree *tree) {
@@ -382,18 +668,219 @@ int kd_tree_insert3f(KdTree *tree, float x, float y, float z,
   return kd_tree_insert(tree, d, data);
 }
 
-static int _kd_iterator_free(KdIterator *iterator) {
-  KdResultNode *tmp, *node;
+/* @func `_gather_live`
+ * @desc Copies position and data of every live node below `node`
+ */
+static void _gather_live(const KdNode *node, int dimension, double *points,
+                         void **data, size_t *n) {
+  for (; node; node = node->right) {
+    if (!node->deleted) {
+      memcpy(&points[*n * dimension], node->position,
+             dimension * sizeof(double));
+      data[(*n)++] = node->data;
+    }
+    _gather_live(node->left, dimension, points, data, n);
+  }
+}
+
+/* @func `_rebuild_subtree`
+ * @desc Replaces the subtree at `link` by a balanced one without its
+ *       deleted nodes. On failure the old subtree stays in place.
+ */
+static int _rebuild_subtree(KdNode **link, int dimension) {
+  KdNode *fresh;
+  double *points;
+  void **data;
+  size_t *indices, live, i;
+  int r;
+
+  live = (*link)->size - (*link)->dead;
+  fresh = NULL;
+  points = NULL;
+  data = NULL;
+  indices = NULL;
+
+  r = -ENOMEM;
+  if (live) {
+    points = NEW0N(double, live * dimension);
+    data = NEW0N(void *, live);
+    indices = NEW0N(size_t, live);
+    if (!points || !data || !indices)
+      goto out;
+
+    i = 0;
+    _gather_live(*link, dimension, points, data, &i);
+    assert(i == live);
+    for (i = 0; i < live; ++i)
+      indices[i] = i;
+
+    r = _build_subtree(points, data, indices, live, dimension, 0, &fresh);
+    if (r < 0)
+      goto out;
+  }
+
+  _clear_tree_recursive(*link);
+  *link = fresh;
+  r = 0;
+out:
+  free((void *)points);
+  free((void *)data);
+  free((void *)indices);
+  return r;
+}
+
+/* @func `_remove_record`
+ * @desc Marks the live node at `p` carrying `data` as deleted and updates
+ *       the counts on the way back up. The lowest subtree whose dead share
+ *       passes `KD_REBUILD_DEAD_RATIO` is rebuilt, `purged` carries the
+ *       number of dropped nodes to the ancestors.
+ *
+ * @ret true if the point was found
+ */
+static bool _remove_record(KdNode **link, const double *p, const void *data,
+                           int dimension, size_t *purged) {
+  KdNode *node;
+  size_t dead;
+  double dx;
+  bool found;
+  int i;
+
+  node = *link;
+  if (!node)
+    return false;
+
+  found = false;
+  if (!node->deleted && node->data == data) {
+    for (i = 0; i < dimension; ++i)
+      if (node->position[i] != p[i])
+        break;
+    found = i == dimension;
+  }
+
+  if (found) {
+    node->deleted = true;
+  } else {
+    /* points equal to the split may sit on either side after a build */
+    dx = p[node->direction] - node->position[node->direction];
+    if (dx <= 0.0)
+      found = _remove_record(&node->left, p, data, dimension, purged);
+    if (!found && dx >= 0.0)
+      found = _remove_record(&node->right, p, data, dimension, purged);
+    if (!found)
+      return false;
+  }
+
+  node->dead++;
+  node->size -= *purged;
+  node->dead -= *purged;
 
-  node = iterator->list->next;
+  if (node->dead > node->size * KD_REBUILD_DEAD_RATIO) {
+    dead = node->dead;
+    if (_rebuild_subtree(link, dimension) == 0)
+      *purged += dead;
+  }
+
+  return true;
+}
+
+/* @func `kd_tree_remove`
+ * @desc Removes the point at `p` with the associated `data`. The node is
+ *       only marked deleted, subtrees are rebuilt lazily once too many of
+ *       their nodes are, so the cost stays proportional to the number of
+ *       removed points.
+ *
+ * @param(tree) Tree to remove from
+ * @param(p)    Coordinates of the point
+ * @param(data) Data the point was inserted with
+ *
+ * @ret 0 on success, -ENOENT if there is no such point
+ */
+int kd_tree_remove(KdTree *tree, const double *p, const void *data) {
+  size_t purged;
+  bool found;
+  assert(tree);
+  assert(p);
+
+#ifdef KD_SYNCHRONIZED
+  lock_acquire(&tree->lock);
+#endif
+
+  purged = 0;
+  found = _remove_record(&tree->root, p, data, tree->dimension, &purged);
+
+#ifdef KD_SYNCHRONIZED
+  lock_release(&tree->lock);
+#endif
+
+  return found ? 0 : -ENOENT;
+}
+
+/* @func `kd_tree_build`
+ * @desc Builds a balanced tree from `n` points at once using median splits
+ *       on the widest axis, large inputs build their subtrees in parallel
+ *
+ * @param(dimension) Dimension of the points
+ * @param(points)    `n` * `dimension` packed coordinates
+ * @param(data)      Optional array of `n` data pointers
+ * @param(n)         Number of points
+ * @param(out_tree)  Receives the created tree
+ *
+ * @ret 0 on success or error code
+ */
+int kd_tree_build(int dimension, const double *points, void **data, size_t n,
+                  KdTree **out_tree) {
+  KdTree *tree;
+  size_t *indices, i;
+  long cpus;
+  int r, depth;
+  assert(points || n == 0);
+  assert(out_tree);
+
+  r = kd_tree_new(dimension, &tree);
+  if (r < 0)
+    return r;
+
+  if (!n) {
+    *out_tree = tree;
+    return 0;
+  }
 
-  while (node) {
-    tmp = node;
-    node = node->next;
-    free((void *)tmp);
+  indices = NEW0N(size_t, n);
+  if (!indices) {
+    (void)kd_tree_unref(tree);
+    return -ENOMEM;
   }
 
-  free((void *)iterator->list);
+  for (i = 0; i < n; ++i)
+    indices[i] = i;
+
+  /* one level of forking doubles the number of building threads */
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  for (depth = 0; cpus > 1; cpus >>= 1)
+    depth++;
+
+  r = _build_subtree(points, data, indices, n, dimension, depth, &tree->root);
+  free((void *)indices);
+  if (r < 0)
+    goto err;
+
+  r = _hyper_rectangle_create(dimension, points, points, &tree->rectangle);
+  if (r < 0)
+    goto err;
+
+  for (i = 1; i < n; ++i)
+    (void)_hyper_rectangle_extend(tree->rectangle, &points[i * dimension]);
+
+  *out_tree = tree;
+
+  return 0;
+err:
+  (void)kd_tree_unref(tree);
+  return r;
+}
+
+static int _kd_iterator_free(KdIterator *iterator) {
+  free((void *)iterator->results.items);
   free((void *)iterator);
 
   return 0;
@@ -404,7 +891,6 @@ int kd_tree_nearest(KdTree *tree, const double *p, KdIterator **out_iterator) {
   KdNode *n;
   KdIterator *it;
   double distance;
-  size_t i;
   int r;
   assert(tree);
   assert(tree->rectangle);
@@ -422,40 +908,32 @@ int kd_tree_nearest(KdTree *tree, const double *p, KdIterator **out_iterator) {
     goto out;
   }
 
-  it->list = NEW0(KdResultNode);
-  if (!it->list) {
-    free((void *)it);
-    r = -ENOMEM;
-    goto out;
-  }
-
   it->tree = tree;
   r = _hyper_rectangle_duplicate(tree->rectangle, &hr);
   if (r < 0)
     goto free_out;
 
-  n = tree->root;
-  distance = 0.0;
-  for (i = 0; i < tree->dimension; ++i)
-    distance += SQUARE(n->position[i] - p[i]);
-
-  (void)_find_nearest_slicing(tree->root, p, &n, &distance, hr);
+  /* the root may be deleted, so start without a candidate */
+  n = NULL;
+  distance = INFINITY;
+  if (tree->root)
+    (void)_find_nearest_slicing(tree->root, p, &n, &distance, hr);
 
   _hyper_rectangle_unref(hr);
-  if (n) {
-    r = _insert_result_node(it->list, n, -1.0);
-    if (r < 0)
-      goto free_out;
-    it->size = 1;
-    r = kd_iterator_rewind(it);
-    if (r < 0)
-      goto free_out;
-    *out_iterator = it;
-  } else {
-    _kd_iterator_free(it);
+  if (!n) {
     r = -ENOENT;
+    goto free_out;
   }
 
+  r = _push_result(&it->results, n, distance);
+  if (r < 0)
+    goto free_out;
+  it->size = 1;
+  r = kd_iterator_rewind(it);
+  if (r < 0)
+    goto free_out;
+  *out_iterator = it;
+
   return r;
 free_out:
   _kd_iterator_free(it);
@@ -513,13 +991,43 @@ int kd_tree_nearest3f(KdTree *tree, float x, float y, float z,
   return kd_tree_nearest(tree, d, out_iterator);
 }
 
+/* @func `kd_tree_nearest_range_into`
+ * @desc Appends all points within `range` of `p` to `results` as
+ *       `KdResult` items. Clearing and reusing the buffer with `array_clear`
+ *       keeps steady state queries free of heap allocations.
+ *
+ * @param(tree)    Tree to search
+ * @param(p)       Query point
+ * @param(range)   Search radius
+ * @param(results) Caller owned buffer, may start zeroed
+ *
+ * @ret number of points appended or error code
+ */
+int kd_tree_nearest_range_into(KdTree *tree, const double *p, double range,
+                               Array *results) {
+  size_t before;
+  int r;
+  assert(tree);
+  assert(p);
+  assert(results);
+
+#ifdef KD_SYNCHRONIZED
+  lock_acquire(&tree->lock);
+#endif
+
+  before = results->occupied;
+  r = _find_nearest(tree->root, p, range, results, tree->dimension);
+
+#ifdef KD_SYNCHRONIZED
+  lock_release(&tree->lock);
+#endif
+
+  return r < 0 ? r : (int)((results->occupied - before) / sizeof(KdResult));
+}
+
 int kd_tree_nearest_range(KdTree *tree, const double *p, double range,
                           KdIterator **out_iterator) {
-  KdHyperRect *hr;
-  KdNode *n;
   KdIterator *it;
-  double distance;
-  size_t found;
   int r;
   assert(tree);
   assert(p);
@@ -536,21 +1044,14 @@ int kd_tree_nearest_range(KdTree *tree, const double *p, double range,
     goto out;
   }
 
-  it->list = NEW0(KdResultNode);
-  if (!it->list) {
-    free((void *)it);
-    r = -ENOMEM;
-    goto out;
-  }
-
   it->tree = tree;
-  r = _find_nearest(tree->root, p, range, it->list, 0, tree->dimension, &found);
+  r = _find_nearest(tree->root, p, range, &it->results, tree->dimension);
   if (r < 0) {
     _kd_iterator_free(it);
     goto out;
   }
 
-  it->size = found;
+  it->size = it->results.occupied / sizeof(KdResult);
   *out_iterator = it;
 
   r = kd_iterator_rewind(it);
@@ -609,58 +1110,586 @@ int kd_tree_nearest_range3(KdTree *tree, double x, double y, double z,
   return kd_tree_nearest_range(tree, d, range, out_iterator);
 }
 
-int kd_iterator_free(KdIterator *iterator) {
-  assert(iterator);
+/* @func `_region_query`
+ * @desc Unlocked body of the box and polytope queries
+ */
+static int _region_query(KdTree *tree, const struct KdRegion *region,
+                         Array *results, size_t *out_found) {
+  KdHyperRect cell;
+  double *bounds;
+  size_t size;
+  bool stack;
+  int r;
 
-#ifdef KD_SYNCHRONIZED
-  lock_release(&iterator->tree->lock);
-#endif
-  return _kd_iterator_free(iterator);
-}
+  *out_found = 0;
+  if (!tree->root)
+    return 0;
 
-int kd_iterator_rewind(KdIterator *iterator) {
-  assert(iterator);
-  iterator->next = iterator->list->next;
-  return 0;
-}
+  /* `_find_region` narrows and restores the cell in place, so one copy of
+   * the tree bounds on the stack serves the whole descent */
+  size = 2 * tree->dimension * sizeof(double);
+  stack = size < 4096;
 
-bool kd_iterator_end(KdIterator *iterator) {
-  assert(iterator);
-  return iterator->next == NULL;
-}
+  if (stack)
+    bounds = alloca(size);
+  else
+    bounds = malloc(size);
+  if (!bounds)
+    return -ENOMEM;
 
-bool kd_iterator_next(KdIterator *iterator) {
-  assert(iterator);
-  iterator->next = iterator->next->next;
-  return iterator->next != NULL;
-}
+  cell.dimension = tree->dimension;
+  cell.min = bounds;
+  cell.max = bounds + tree->dimension;
+  memcpy(cell.min, tree->rectangle->min, tree->dimension * sizeof(double));
+  memcpy(cell.max, tree->rectangle->max, tree->dimension * sizeof(double));
 
-int kd_iterator_item(KdIterator *iterator, double *p, void **out_data) {
-  assert(iterator);
+  r = _find_region(tree->root, region, &cell, results, out_found);
 
-  if (iterator->next) {
-    if (p)
-      memcpy(p, iterator->next->node->position,
-             iterator->tree->dimension * sizeof(*p));
-    *out_data = iterator->next->node->data;
-    return 0;
-  }
+  if (!stack)
+    free((void *)bounds);
 
-  return -ENOENT;
+  return r;
 }
 
-int kd_iterator_itemf(KdIterator *iterator, float *p, void **out_data) {
-  size_t i;
-  assert(iterator);
-  assert(out_data);
-
-  if (iterator->next) {
-    if (p)
-      for (i = 0; i < iterator->tree->dimension; ++i)
-        p[i] = iterator->next->node->position[i];
-    *out_data = iterator->next->node->data;
-    return 0;
-  }
+/* @func `_region_into`
+ * @desc Appends region results to a caller owned buffer
+ */
+static int _region_into(KdTree *tree, const struct KdRegion *region,
+                        Array *results) {
+  size_t found;
+  int r;
+
+#ifdef KD_SYNCHRONIZED
+  lock_acquire(&tree->lock);
+#endif
+
+  r = _region_query(tree, region, results, &found);
+
+#ifdef KD_SYNCHRONIZED
+  lock_release(&tree->lock);
+#endif
+
+  return r < 0 ? r : (int)found;
+}
+
+/* @func `_region_iterator`
+ * @desc Region results as an iterator, which keeps the tree locked like
+ *       `kd_tree_nearest_range`
+ */
+static int _region_iterator(KdTree *tree, const struct KdRegion *region,
+                            KdIterator **out_iterator) {
+  KdIterator *it;
+  size_t found;
+  int r;
+
+#ifdef KD_SYNCHRONIZED
+  lock_acquire(&tree->lock);
+#endif
+
+  r = -ENOMEM;
+  it = NEW0(KdIterator);
+  if (!it)
+    goto out;
+
+  it->tree = tree;
+  r = _region_query(tree, region, &it->results, &found);
+  if (r < 0) {
+    _kd_iterator_free(it);
+    goto out;
+  }
+
+  it->size = found;
+  *out_iterator = it;
+
+  r = kd_iterator_rewind(it);
+out:
+#ifdef KD_SYNCHRONIZED
+  if (r < 0)
+    lock_release(&tree->lock);
+#endif
+  return r;
+}
+
+static void _box_region(KdTree *tree, const double *min, const double *max,
+                        struct KdRegion *region) {
+  memset(region, 0, sizeof(*region));
+  region->dimension = tree->dimension;
+  region->min = min;
+  region->max = max;
+}
+
+static void _polytope_region(KdTree *tree, const double *planes,
+                             size_t num_planes, struct KdRegion *region) {
+  memset(region, 0, sizeof(*region));
+  region->dimension = tree->dimension;
+  region->planes = planes;
+  region->num_planes = num_planes;
+}
+
+/* @func `kd_tree_box`
+ * @desc Finds all points inside the axis aligned box [`min`, `max`].
+ *       Subtrees whose cell lies completely inside are reported without
+ *       testing their points, cells completely outside are skipped.
+ *
+ * @param(tree)         Tree to search
+ * @param(min)          Lower corner of the box
+ * @param(max)          Upper corner of the box
+ * @param(out_iterator) Receives an unordered iterator over the points
+ *
+ * @ret 0 on success or error code
+ */
+int kd_tree_box(KdTree *tree, const double *min, const double *max,
+                KdIterator **out_iterator) {
+  struct KdRegion region;
+  assert(tree);
+  assert(min);
+  assert(max);
+  assert(out_iterator);
+
+  _box_region(tree, min, max, &region);
+  return _region_iterator(tree, &region, out_iterator);
+}
+
+/* @func `kd_tree_box_into`
+ * @desc `kd_tree_box` appending to a caller owned buffer, see
+ *       `kd_tree_nearest_range_into`
+ *
+ * @ret number of points appended or error code
+ */
+int kd_tree_box_into(KdTree *tree, const double *min, const double *max,
+                     Array *results) {
+  struct KdRegion region;
+  assert(tree);
+  assert(min);
+  assert(max);
+  assert(results);
+
+  _box_region(tree, min, max, &region);
+  return _region_into(tree, &region, results);
+}
+
+/* @func `kd_tree_polytope`
+ * @desc Finds all points inside a convex polytope given as the
+ *       intersection of half spaces, e.g. the 6 planes of a view frustum.
+ *       To cull boxes insert their centers and move every plane outwards
+ *       by the largest half extent projected onto its normal.
+ *
+ * @param(tree)         Tree to search
+ * @param(planes)       `num_planes` * (dimension + 1) coefficients, a point
+ *                      `x` is inside when n . x + d >= 0 for every plane
+ * @param(num_planes)   Number of planes
+ * @param(out_iterator) Receives an unordered iterator over the points
+ *
+ * @ret 0 on success or error code
+ */
+int kd_tree_polytope(KdTree *tree, const double *planes, size_t num_planes,
+                     KdIterator **out_iterator) {
+  struct KdRegion region;
+  assert(tree);
+  assert(planes || num_planes == 0);
+  assert(out_iterator);
+
+  _polytope_region(tree, planes, num_planes, &region);
+  return _region_iterator(tree, &region, out_iterator);
+}
+
+/* @func `kd_tree_polytope_into`
+ * @desc `kd_tree_polytope` appending to a caller owned buffer, see
+ *       `kd_tree_nearest_range_into`
+ *
+ * @ret number of points appended or error code
+ */
+int kd_tree_polytope_into(KdTree *tree, const double *planes,
+                          size_t num_planes, Array *results) {
+  struct KdRegion region;
+  assert(tree);
+  assert(planes || num_planes == 0);
+  assert(results);
+
+  _polytope_region(tree, planes, num_planes, &region);
+  return _region_into(tree, &region, results);
+}
+
+/* @func `_knn_query`
+ * @desc Unlocked k nearest neighbours search, `offsets` is scratch space
+ *       of `dimension` doubles
+ */
+static int _knn_query(KdTree *tree, const double *p, size_t k,
+                      const KdSearchParams *params, void **out_data,
+                      double *out_dist2, double *offsets) {
+  struct KdKnn h = {.data = out_data, .distance = out_dist2, .k = k};
+
+  _knn_configure(&h, params);
+  memset(offsets, 0, tree->dimension * sizeof(double));
+  if (tree->root && k)
+    _knn_search(tree->root, p, tree->dimension, offsets, 0.0, &h);
+
+  _knn_sort(&h);
+
+  return (int)h.size;
+}
+
+/* @func `kd_tree_knn`
+ * @desc Finds the `k` points nearest to `p` without allocating, results are
+ *       written into caller provided buffers ordered by ascending distance
+ *
+ * @param(tree)      Tree to search
+ * @param(p)         Query point
+ * @param(k)         Number of neighbours to find
+ * @param(out_data)  Buffer of at least `k` entries, receives the data
+ * @param(out_dist2) Buffer of at least `k` entries, receives squared distances
+ *
+ * @ret number of neighbours found or error code
+ */
+int kd_tree_knn(KdTree *tree, const double *p, size_t k, void **out_data,
+                double *out_dist2) {
+  return kd_tree_knn_approx(tree, p, k, NULL, out_data, out_dist2);
+}
+
+/* @func `kd_tree_knn_approx`
+ * @desc Like `kd_tree_knn`, but trades accuracy for latency. With an
+ *       `epsilon` every reported distance is within (1 + epsilon) of the
+ *       true one, since cells farther than best / (1 + epsilon) are pruned.
+ *       With `max_visits` the search returns the best points found so far
+ *       once that many nodes were visited.
+ *
+ * @param(params) Search parameters, `NULL` for an exact search
+ *
+ * @ret number of neighbours found or error code
+ */
+int kd_tree_knn_approx(KdTree *tree, const double *p, size_t k,
+                       const KdSearchParams *params, void **out_data,
+                       double *out_dist2) {
+  double *offsets;
+  int r;
+  assert(tree);
+  assert(p);
+  assert(out_data);
+  assert(out_dist2);
+
+  if (k > INT_MAX)
+    return -EINVAL;
+
+  offsets = alloca(tree->dimension * sizeof(double));
+
+#ifdef KD_SYNCHRONIZED
+  lock_acquire(&tree->lock);
+#endif
+
+  r = _knn_query(tree, p, k, params, out_data, out_dist2, offsets);
+
+#ifdef KD_SYNCHRONIZED
+  lock_release(&tree->lock);
+#endif
+
+  return r;
+}
+
+/* @func `kd_tree_nearest_approx`
+ * @desc Single nearest point with `kd_tree_knn_approx` semantics
+ *
+ * @ret 0 on success, -ENOENT if the tree is empty
+ */
+int kd_tree_nearest_approx(KdTree *tree, const double *p,
+                           const KdSearchParams *params, void **out_data,
+                           double *out_distance) {
+  double distance;
+  int r;
+  assert(out_data);
+
+  r = kd_tree_knn_approx(tree, p, 1, params, out_data, &distance);
+  if (r < 0)
+    return r;
+  if (r == 0)
+    return -ENOENT;
+
+  if (out_distance)
+    *out_distance = distance;
+
+  return 0;
+}
+
+int kd_tree_knn3(KdTree *tree, double x, double y, double z, size_t k,
+                 void **out_data, double *out_dist2) {
+  double d[3];
+  d[0] = x;
+  d[1] = y;
+  d[2] = z;
+  return kd_tree_knn(tree, d, k, out_data, out_dist2);
+}
+
+struct KdBatch {
+  KdTree *tree;
+  const double *points;
+  /* processing order, `NULL` for input order */
+  const size_t *order;
+  size_t k;
+  void **out_data;
+  double *out_dist2;
+  size_t remaining;
+  WaitHandle done;
+};
+
+struct KdBatchChunk {
+  struct KdBatch *batch;
+  size_t start, end;
+};
+
+struct KdMortonKey {
+  uint64_t code;
+  size_t index;
+};
+
+/* spreads the low 21 bits of `v` so that they occupy every third bit */
+static uint64_t _morton_spread(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+static int _morton_compare(const void *a, const void *b) {
+  uint64_t x = ((const struct KdMortonKey *)a)->code;
+  uint64_t y = ((const struct KdMortonKey *)b)->code;
+  return x < y ? -1 : x > y;
+}
+
+/* @func `_morton_order`
+ * @desc Orders query points along a Z-order curve over (up to) their first
+ *       three axes so that consecutive queries visit similar subtrees
+ */
+static int _morton_order(const double *points, size_t n, int dimension,
+                         size_t **out_order) {
+  struct KdMortonKey *keys;
+  double lo[3], hi[3], scale[3], v;
+  size_t *order, i;
+  uint64_t code;
+  int d, axes;
+
+  axes = MIN(dimension, 3);
+  for (d = 0; d < axes; ++d) {
+    lo[d] = hi[d] = points[d];
+    for (i = 1; i < n; ++i) {
+      v = points[i * dimension + d];
+      if (v < lo[d])
+        lo[d] = v;
+      if (v > hi[d])
+        hi[d] = v;
+    }
+    scale[d] = hi[d] > lo[d] ? (double)0x1fffff / (hi[d] - lo[d]) : 0.0;
+  }
+
+  keys = NEW0N(struct KdMortonKey, n);
+  order = NEW0N(size_t, n);
+  if (!keys || !order) {
+    free((void *)keys);
+    free((void *)order);
+    return -ENOMEM;
+  }
+
+  for (i = 0; i < n; ++i) {
+    code = 0;
+    for (d = 0; d < axes; ++d)
+      code |= _morton_spread(
+                  (uint64_t)((points[i * dimension + d] - lo[d]) * scale[d]))
+              << d;
+    keys[i].code = code;
+    keys[i].index = i;
+  }
+
+  qsort(keys, n, sizeof(*keys), _morton_compare);
+  for (i = 0; i < n; ++i)
+    order[i] = keys[i].index;
+
+  free((void *)keys);
+  *out_order = order;
+
+  return 0;
+}
+
+static void _query_batch_chunk(void *context) {
+  struct KdBatchChunk *chunk = (struct KdBatchChunk *)context;
+  struct KdBatch *b = chunk->batch;
+  double *offsets, *dist2;
+  void **data;
+  size_t i, j, q;
+  int found;
+
+  offsets = alloca(b->tree->dimension * sizeof(double));
+
+  for (i = chunk->start; i < chunk->end; ++i) {
+    q = b->order ? b->order[i] : i;
+    data = b->out_data + q * b->k;
+    dist2 = b->out_dist2 + q * b->k;
+
+    found = _knn_query(b->tree, b->points + q * b->tree->dimension, b->k, NULL,
+                       data, dist2, offsets);
+    for (j = found; j < b->k; ++j) {
+      data[j] = NULL;
+      dist2[j] = INFINITY;
+    }
+  }
+
+  if (__sync_sub_and_fetch(&b->remaining, 1) == 0)
+    waithandle_signal(&b->done);
+}
+
+/* @func `kd_tree_query_batch`
+ * @desc Runs `n` k-nearest queries at once. The tree is locked once for the
+ *       whole batch and the queries are split into chunks that run on `pool`
+ *       without any further locking or allocation.
+ *
+ * @param(tree)      Tree to search
+ * @param(pool)      Worker pool, `NULL` runs on the calling thread
+ * @param(points)    `n` * dimension packed query coordinates
+ * @param(n)         Number of queries
+ * @param(k)         Neighbours per query
+ * @param(out_data)  `n` * `k` entries, query i writes to [i * k, i * k + k)
+ * @param(out_dist2) `n` * `k` squared distances, same layout as `out_data`;
+ *                   missing neighbours are `NULL` at distance `INFINITY`
+ * @param(flags)     `KD_BATCH_*` flags
+ *
+ * @ret 0 on success or error code
+ */
+int kd_tree_query_batch(KdTree *tree, ThreadPool *pool, const double *points,
+                        size_t n, size_t k, void **out_data,
+                        double *out_dist2, int flags) {
+  struct KdBatchChunk *chunks;
+  struct KdBatch b = {0};
+  size_t *order, num_chunks, per_chunk, i;
+  int r;
+  assert(tree);
+  assert(points || n == 0);
+  assert(out_data || n == 0 || k == 0);
+  assert(out_dist2 || n == 0 || k == 0);
+
+  if (!n || !k)
+    return 0;
+
+  if (k > INT_MAX)
+    return -EINVAL;
+
+  order = NULL;
+  if (flags & KD_BATCH_MORTON) {
+    r = _morton_order(points, n, tree->dimension, &order);
+    if (r < 0)
+      return r;
+  }
+
+  /* a few chunks per worker to even out uneven query costs */
+  num_chunks = pool ? pool->num_threads * 4 : 1;
+  per_chunk = MAX((n + num_chunks - 1) / num_chunks, KD_BATCH_MIN_CHUNK);
+  num_chunks = (n + per_chunk - 1) / per_chunk;
+
+  chunks = NEW0N(struct KdBatchChunk, num_chunks);
+  if (!chunks) {
+    free((void *)order);
+    return -ENOMEM;
+  }
+
+  b.tree = tree;
+  b.points = points;
+  b.order = order;
+  b.k = k;
+  b.out_data = out_data;
+  b.out_dist2 = out_dist2;
+  b.remaining = num_chunks;
+  waithandle_init(&b.done);
+
+#ifdef KD_SYNCHRONIZED
+  lock_acquire(&tree->lock);
+#endif
+
+  for (i = 0; i < num_chunks; ++i) {
+    chunks[i].batch = &b;
+    chunks[i].start = i * per_chunk;
+    chunks[i].end = MIN(n, (i + 1) * per_chunk);
+
+    /* the last chunk, or anything the pool refuses, runs right here */
+    if (!pool || i + 1 == num_chunks ||
+        thread_pool_submit(pool, _query_batch_chunk, &chunks[i]) < 0)
+      _query_batch_chunk(&chunks[i]);
+  }
+
+  waithandle_wait(&b.done);
+
+#ifdef KD_SYNCHRONIZED
+  lock_release(&tree->lock);
+#endif
+
+  waithandle_unref(&b.done);
+  free((void *)chunks);
+  free((void *)order);
+
+  return 0;
+}
+
+int kd_iterator_free(KdIterator *iterator) {
+  assert(iterator);
+
+#ifdef KD_SYNCHRONIZED
+  lock_release(&iterator->tree->lock);
+#endif
+  return _kd_iterator_free(iterator);
+}
+
+int kd_iterator_rewind(KdIterator *iterator) {
+  assert(iterator);
+  iterator->index = 0;
+  return 0;
+}
+
+bool kd_iterator_end(KdIterator *iterator) {
+  assert(iterator);
+  return iterator->index >= iterator->size;
+}
+
+bool kd_iterator_next(KdIterator *iterator) {
+  assert(iterator);
+  iterator->index++;
+  return iterator->index < iterator->size;
+}
+
+/* current result, `NULL` past the end */
+static KdResult *_iterator_result(KdIterator *iterator) {
+  if (iterator->index >= iterator->size)
+    return NULL;
+  return ARRAY_GET(&iterator->results, iterator->index, KdResult);
+}
+
+int kd_iterator_item(KdIterator *iterator, double *p, void **out_data) {
+  KdResult *result;
+  assert(iterator);
+
+  result = _iterator_result(iterator);
+  if (result) {
+    if (p)
+      memcpy(p, result->node->position,
+             iterator->tree->dimension * sizeof(*p));
+    *out_data = result->data;
+    return 0;
+  }
+
+  return -ENOENT;
+}
+
+int kd_iterator_itemf(KdIterator *iterator, float *p, void **out_data) {
+  KdResult *result;
+  size_t i;
+  assert(iterator);
+  assert(out_data);
+
+  result = _iterator_result(iterator);
+  if (result) {
+    if (p)
+      for (i = 0; i < iterator->tree->dimension; ++i)
+        p[i] = result->node->position[i];
+    *out_data = result->data;
+    return 0;
+  }
 
   return -ENOENT;
 }
@@ -668,3 +1697,674 @@ int kd_iterator_itemf(KdIterator *iterator, float *p, void **out_data) {
 int kd_iterator_data(KdIterator *iterator, void **out_data) {
   return kd_iterator_item(iterator, NULL, out_data);
 }
+
+struct KdFlatBuild {
+  const double *points;
+  size_t *indices;
+  int dimension;
+  /* build order links, remapped into van Emde Boas order afterwards */
+  uint32_t *left, *right, *point, *remap;
+  int32_t *direction;
+  uint32_t count, next;
+  int height;
+};
+
+/* @func `_flat_build_subtree`
+ * @desc Median split build like `_build_subtree`, but into index arrays
+ */
+static uint32_t _flat_build_subtree(struct KdFlatBuild *b, size_t *indices,
+                                    size_t n, int depth) {
+  uint32_t node;
+  size_t mid;
+  int axis;
+
+  if (!n)
+    return KD_FLAT_NONE;
+
+  if (depth > b->height)
+    b->height = depth;
+
+  axis = _widest_axis(b->points, indices, n, b->dimension);
+  mid = n / 2;
+  _select_median(b->points, indices, n, mid, b->dimension, axis);
+
+  node = b->count++;
+  b->point[node] = indices[mid];
+  b->direction[node] = axis;
+  b->left[node] = _flat_build_subtree(b, indices, mid, depth + 1);
+  b->right[node] = _flat_build_subtree(b, indices + mid + 1, n - mid - 1,
+                                       depth + 1);
+
+  return node;
+}
+
+static void _veb_layout(struct KdFlatBuild *b, uint32_t node, int height);
+
+/* lays out all subtrees rooted `depth` levels below `node` */
+static void _veb_bottoms(struct KdFlatBuild *b, uint32_t node, int depth,
+                         int height) {
+  if (node == KD_FLAT_NONE)
+    return;
+
+  if (depth == 0) {
+    _veb_layout(b, node, height);
+    return;
+  }
+
+  _veb_bottoms(b, b->left[node], depth - 1, height);
+  _veb_bottoms(b, b->right[node], depth - 1, height);
+}
+
+/* @func `_veb_layout`
+ * @desc Assigns van Emde Boas positions to the subtree of `node` cut off
+ *       after `height` levels: the top half of the levels first, then each
+ *       of the bottom subtrees, recursively
+ */
+static void _veb_layout(struct KdFlatBuild *b, uint32_t node, int height) {
+  int top;
+
+  if (node == KD_FLAT_NONE)
+    return;
+
+  if (height == 1) {
+    b->remap[node] = b->next++;
+    return;
+  }
+
+  top = height / 2;
+  _veb_layout(b, node, top);
+  _veb_bottoms(b, node, top, height - top);
+}
+
+/* @func `kd_flat_tree_build`
+ * @desc Builds a balanced, compact tree from `n` points
+ *
+ * @param(dimension) Dimension of the points
+ * @param(points)    `n` * `dimension` packed coordinates
+ * @param(data)      Optional array of `n` data pointers
+ * @param(n)         Number of points
+ * @param(out_tree)  Receives the created tree
+ *
+ * @ret 0 on success or error code
+ */
+int kd_flat_tree_build(int dimension, const double *points, void **data,
+                       size_t n, KdFlatTree **out_tree) {
+  struct KdFlatBuild b = {0};
+  KdFlatTree *tree;
+  KdFlatNode *node;
+  void *nodes;
+  size_t i;
+  uint32_t o;
+  int r;
+  assert(points || n == 0);
+  assert(out_tree);
+
+  if (n >= KD_FLAT_NONE)
+    return -E2BIG;
+
+  tree = NEW0(KdFlatTree);
+  if (!tree)
+    return -ENOMEM;
+
+  tree->dimension = dimension;
+  tree->stride = sizeof(KdFlatNode) + dimension * sizeof(double);
+  if (!n) {
+    *out_tree = tree;
+    return 0;
+  }
+
+  r = -ENOMEM;
+  b.points = points;
+  b.dimension = dimension;
+  b.indices = NEW0N(size_t, n);
+  b.left = NEW0N(uint32_t, n);
+  b.right = NEW0N(uint32_t, n);
+  b.point = NEW0N(uint32_t, n);
+  b.remap = NEW0N(uint32_t, n);
+  b.direction = NEW0N(int32_t, n);
+  if (!b.indices || !b.left || !b.right || !b.point || !b.remap ||
+      !b.direction)
+    goto out;
+
+  if (posix_memalign(&nodes, 64, n * tree->stride))
+    goto out;
+  tree->nodes = (uint8_t *)nodes;
+
+  for (i = 0; i < n; ++i)
+    b.indices[i] = i;
+
+  (void)_flat_build_subtree(&b, b.indices, n, 1);
+  _veb_layout(&b, 0, b.height);
+
+  for (o = 0; o < n; ++o) {
+    node = KD_FLAT_NODE(tree, b.remap[o]);
+    node->left = b.left[o] == KD_FLAT_NONE ? KD_FLAT_NONE : b.remap[b.left[o]];
+    node->right =
+        b.right[o] == KD_FLAT_NONE ? KD_FLAT_NONE : b.remap[b.right[o]];
+    node->direction = b.direction[o];
+    node->flags = 0;
+    node->data = data ? data[b.point[o]] : NULL;
+    memcpy(node->position, &points[(size_t)b.point[o] * dimension],
+           dimension * sizeof(double));
+  }
+
+  tree->size = n;
+  *out_tree = tree;
+  tree = NULL;
+  r = 0;
+out:
+  free((void *)b.indices);
+  free((void *)b.left);
+  free((void *)b.right);
+  free((void *)b.point);
+  free((void *)b.remap);
+  free((void *)b.direction);
+  if (tree)
+    kd_flat_tree_unref(tree);
+  return r;
+}
+
+/* @func `_flat_nearest`
+ * @desc Nearest neighbour descent, `offsets` holds per-axis distances from
+ *       `p` to the current cell and `rd` their squared sum
+ */
+static void _flat_nearest(const KdFlatTree *tree, uint32_t index,
+                          const double *p, double *offsets, double rd,
+                          uint32_t *out_best, double *out_distance) {
+  const KdFlatNode *node;
+  double distance, dx, old;
+  uint32_t near, far;
+  int i, axis;
+
+  node = KD_FLAT_NODE(tree, index);
+
+  distance = 0.0;
+  for (i = 0; i < tree->dimension; ++i)
+    distance += SQUARE(node->position[i] - p[i]);
+
+  if (distance < *out_distance && !(node->flags & KD_FLAT_DEAD)) {
+    *out_distance = distance;
+    *out_best = index;
+  }
+
+  axis = node->direction;
+  dx = p[axis] - node->position[axis];
+  near = dx <= 0.0 ? node->left : node->right;
+  far = dx <= 0.0 ? node->right : node->left;
+
+  if (near != KD_FLAT_NONE)
+    _flat_nearest(tree, near, p, offsets, rd, out_best, out_distance);
+
+  if (far != KD_FLAT_NONE) {
+    old = offsets[axis];
+    rd += SQUARE(dx) - SQUARE(old);
+    if (rd < *out_distance) {
+      offsets[axis] = dx;
+      _flat_nearest(tree, far, p, offsets, rd, out_best, out_distance);
+      offsets[axis] = old;
+    }
+  }
+}
+
+/* @func `kd_flat_tree_nearest`
+ * @desc Finds the point nearest to `p`
+ *
+ * @param(tree)         Flat kd-tree
+ * @param(p)            Query point
+ * @param(out_data)     Receives data of the nearest point
+ * @param(out_distance) Optional, receives the squared distance
+ *
+ * @ret 0 on success, -ENOENT if the tree is empty
+ */
+int kd_flat_tree_nearest(KdFlatTree *tree, const double *p, void **out_data,
+                         double *out_distance) {
+  double *offsets, distance;
+  uint32_t best;
+  assert(tree);
+  assert(p);
+  assert(out_data);
+
+  if (!tree->size)
+    return -ENOENT;
+
+  offsets = alloca(tree->dimension * sizeof(double));
+  memset(offsets, 0, tree->dimension * sizeof(double));
+
+  best = 0;
+  distance = INFINITY;
+  _flat_nearest(tree, 0, p, offsets, 0.0, &best, &distance);
+  if (isinf(distance))
+    return -ENOENT;
+
+  *out_data = KD_FLAT_NODE(tree, best)->data;
+  if (out_distance)
+    *out_distance = distance;
+
+  return 0;
+}
+
+static void _flat_knn(const KdFlatTree *tree, uint32_t index, const double *p,
+                      double *offsets, double rd, struct KdKnn *h) {
+  const KdFlatNode *node;
+  double distance, dx, old;
+  uint32_t near, far;
+  int i, axis;
+
+  if (!_knn_visit(h))
+    return;
+
+  node = KD_FLAT_NODE(tree, index);
+
+  distance = 0.0;
+  for (i = 0; i < tree->dimension; ++i)
+    distance += SQUARE(node->position[i] - p[i]);
+  if (!(node->flags & KD_FLAT_DEAD))
+    _knn_push(h, node->data, distance);
+
+  axis = node->direction;
+  dx = p[axis] - node->position[axis];
+  near = dx <= 0.0 ? node->left : node->right;
+  far = dx <= 0.0 ? node->right : node->left;
+
+  if (near != KD_FLAT_NONE)
+    _flat_knn(tree, near, p, offsets, rd, h);
+
+  if (far != KD_FLAT_NONE) {
+    old = offsets[axis];
+    rd += SQUARE(dx) - SQUARE(old);
+    if (_knn_reaches(h, rd)) {
+      offsets[axis] = dx;
+      _flat_knn(tree, far, p, offsets, rd, h);
+      offsets[axis] = old;
+    }
+  }
+}
+
+/* @func `kd_flat_tree_knn`
+ * @desc Same as `kd_tree_knn` for flat trees
+ *
+ * @ret number of neighbours found or error code
+ */
+int kd_flat_tree_knn(KdFlatTree *tree, const double *p, size_t k,
+                     void **out_data, double *out_dist2) {
+  return kd_flat_tree_knn_approx(tree, p, k, NULL, out_data, out_dist2);
+}
+
+/* @func `kd_flat_tree_knn_approx`
+ * @desc Same as `kd_tree_knn_approx` for flat trees
+ *
+ * @ret number of neighbours found or error code
+ */
+int kd_flat_tree_knn_approx(KdFlatTree *tree, const double *p, size_t k,
+                            const KdSearchParams *params, void **out_data,
+                            double *out_dist2) {
+  struct KdKnn h = {.data = out_data, .distance = out_dist2, .k = k};
+  double *offsets;
+  assert(tree);
+  assert(p);
+  assert(out_data);
+  assert(out_dist2);
+
+  if (k > INT_MAX)
+    return -EINVAL;
+
+  _knn_configure(&h, params);
+
+  offsets = alloca(tree->dimension * sizeof(double));
+  memset(offsets, 0, tree->dimension * sizeof(double));
+
+  if (tree->size && k)
+    _flat_knn(tree, 0, p, offsets, 0.0, &h);
+
+  _knn_sort(&h);
+
+  return (int)h.size;
+}
+
+int kd_flat_tree_unref(KdFlatTree *tree) {
+  assert(tree);
+
+  free((void *)tree->nodes);
+  free((void *)tree);
+
+  return 0;
+}
+
+/* @func `kd_forest_new`
+ * @desc Creates an empty dynamic forest of flat trees
+ *
+ * @param(dimension)  Dimension of the points
+ * @param(out_forest) Receives the forest
+ *
+ * @ret 0 on success or error code
+ */
+int kd_forest_new(int dimension, KdForest **out_forest) {
+  KdForest *forest;
+  assert(out_forest);
+
+  if (dimension <= 0)
+    return -EINVAL;
+
+  forest = NEW0(KdForest);
+  if (!forest)
+    return -ENOMEM;
+
+  forest->dimension = dimension;
+  lock_init(&forest->lock);
+
+  *out_forest = forest;
+  return 0;
+}
+
+/* @func `_forest_gather`
+ * @desc Copies the live points of levels [0, `levels`) behind the `n`
+ *       points already in `points`/`data`, returns the new count
+ */
+static size_t _forest_gather(KdForest *forest, int levels, double *points,
+                             void **data, size_t n) {
+  const KdFlatNode *node;
+  KdFlatTree *tree;
+  size_t i;
+  int l;
+
+  for (l = 0; l < levels; ++l) {
+    tree = forest->trees[l];
+    if (!tree)
+      continue;
+
+    for (i = 0; i < tree->size; ++i) {
+      node = KD_FLAT_NODE(tree, i);
+      if (node->flags & KD_FLAT_DEAD)
+        continue;
+      memcpy(&points[n * forest->dimension], node->position,
+             forest->dimension * sizeof(double));
+      data[n++] = node->data;
+    }
+  }
+
+  return n;
+}
+
+static void _forest_drop_levels(KdForest *forest, int levels) {
+  int l;
+
+  for (l = 0; l < levels; ++l) {
+    if (!forest->trees[l])
+      continue;
+    kd_flat_tree_unref(forest->trees[l]);
+    forest->trees[l] = NULL;
+  }
+}
+
+/* @func `_forest_rebuild`
+ * @desc Drops all dead points and redistributes the live ones over the
+ *       levels given by the binary representation of their count
+ */
+static int _forest_rebuild(KdForest *forest) {
+  KdFlatTree *trees[KD_FOREST_LEVELS] = {NULL};
+  double *points;
+  void **data;
+  size_t n, offset, count;
+  int l, r;
+
+  r = -ENOMEM;
+  points = NEW0N(double, MAX(forest->size, 1) * forest->dimension);
+  data = NEW0N(void *, MAX(forest->size, 1));
+  if (!points || !data)
+    goto out;
+
+  n = _forest_gather(forest, KD_FOREST_LEVELS, points, data, 0);
+  assert(n == forest->size);
+
+  offset = 0;
+  for (l = 0; l < KD_FOREST_LEVELS && offset < n; ++l) {
+    if (!(n & ((size_t)1 << l)))
+      continue;
+
+    count = (size_t)1 << l;
+    r = kd_flat_tree_build(forest->dimension,
+                           &points[offset * forest->dimension], &data[offset],
+                           count, &trees[l]);
+    if (r < 0)
+      goto out;
+    offset += count;
+  }
+
+  _forest_drop_levels(forest, KD_FOREST_LEVELS);
+  memcpy(forest->trees, trees, sizeof(trees));
+  memset(trees, 0, sizeof(trees));
+  forest->dead = 0;
+  r = 0;
+out:
+  for (l = 0; l < KD_FOREST_LEVELS; ++l)
+    if (trees[l])
+      kd_flat_tree_unref(trees[l]);
+  free((void *)points);
+  free((void *)data);
+  return r;
+}
+
+/* @func `kd_forest_insert`
+ * @desc Inserts a point, merging all full lower levels into the first free
+ *       one. Amortized cost is O(log^2 n).
+ *
+ * @param(forest) Forest to insert into
+ * @param(p)      Point coordinates
+ * @param(data)   Data associated with the point
+ *
+ * @ret 0 on success or error code
+ */
+int kd_forest_insert(KdForest *forest, const double *p, void *data) {
+  KdFlatTree *tree;
+  double *points;
+  void **items;
+  size_t n, live;
+  int level, r;
+  assert(forest);
+  assert(p);
+
+  lock_acquire(&forest->lock);
+
+  n = 1;
+  for (level = 0; level < KD_FOREST_LEVELS && forest->trees[level]; ++level)
+    n += forest->trees[level]->size;
+
+  r = -E2BIG;
+  if (level == KD_FOREST_LEVELS)
+    goto out;
+
+  r = -ENOMEM;
+  points = NEW0N(double, n * forest->dimension);
+  items = NEW0N(void *, n);
+  if (!points || !items)
+    goto free;
+
+  memcpy(points, p, forest->dimension * sizeof(double));
+  items[0] = data;
+  live = _forest_gather(forest, level, points, items, 1);
+
+  r = kd_flat_tree_build(forest->dimension, points, items, live, &tree);
+  if (r < 0)
+    goto free;
+
+  /* merged levels no longer carry their dead points */
+  _forest_drop_levels(forest, level);
+  forest->trees[level] = tree;
+  forest->dead -= n - live;
+  forest->size++;
+free:
+  free((void *)points);
+  free((void *)items);
+out:
+  lock_release(&forest->lock);
+  return r;
+}
+
+/* @func `_flat_find`
+ * @desc Finds the live node at `p` carrying `data`. Points equal to a split
+ *       coordinate may sit on either side, so both are searched then.
+ */
+static uint32_t _flat_find(const KdFlatTree *tree, uint32_t index,
+                           const double *p, void *data) {
+  const KdFlatNode *node;
+  uint32_t found;
+  double dx;
+  int i;
+
+  node = KD_FLAT_NODE(tree, index);
+
+  if (node->data == data && !(node->flags & KD_FLAT_DEAD)) {
+    for (i = 0; i < tree->dimension; ++i)
+      if (node->position[i] != p[i])
+        break;
+    if (i == tree->dimension)
+      return index;
+  }
+
+  dx = p[node->direction] - node->position[node->direction];
+  if (dx <= 0.0 && node->left != KD_FLAT_NONE) {
+    found = _flat_find(tree, node->left, p, data);
+    if (found != KD_FLAT_NONE)
+      return found;
+  }
+  if (dx >= 0.0 && node->right != KD_FLAT_NONE)
+    return _flat_find(tree, node->right, p, data);
+
+  return KD_FLAT_NONE;
+}
+
+/* @func `kd_forest_remove`
+ * @desc Marks the point at `p` with `data` as removed. The forest is
+ *       rebuilt once dead points outnumber live ones.
+ *
+ * @ret 0 on success, -ENOENT if no such point exists or error code
+ */
+int kd_forest_remove(KdForest *forest, const double *p, void *data) {
+  KdFlatTree *tree;
+  uint32_t index;
+  int l, r;
+  assert(forest);
+  assert(p);
+
+  lock_acquire(&forest->lock);
+
+  r = -ENOENT;
+  for (l = 0; l < KD_FOREST_LEVELS; ++l) {
+    tree = forest->trees[l];
+    if (!tree || !tree->size)
+      continue;
+
+    index = _flat_find(tree, 0, p, data);
+    if (index == KD_FLAT_NONE)
+      continue;
+
+    KD_FLAT_NODE(tree, index)->flags |= KD_FLAT_DEAD;
+    forest->dead++;
+    forest->size--;
+    r = 0;
+    break;
+  }
+
+  if (r == 0 && forest->dead > forest->size)
+    r = _forest_rebuild(forest);
+
+  lock_release(&forest->lock);
+  return r;
+}
+
+/* @func `kd_forest_nearest`
+ * @desc Same as `kd_flat_tree_nearest` over all levels of the forest
+ *
+ * @ret 0 on success, -ENOENT if the forest is empty
+ */
+int kd_forest_nearest(KdForest *forest, const double *p, void **out_data,
+                      double *out_distance) {
+  KdFlatTree *tree, *best_tree;
+  double *offsets, distance;
+  uint32_t index, best;
+  int l;
+  assert(forest);
+  assert(p);
+  assert(out_data);
+
+  offsets = alloca(forest->dimension * sizeof(double));
+
+  lock_acquire(&forest->lock);
+
+  best = 0;
+  best_tree = NULL;
+  distance = INFINITY;
+  for (l = 0; l < KD_FOREST_LEVELS; ++l) {
+    tree = forest->trees[l];
+    if (!tree || !tree->size)
+      continue;
+
+    /* the best distance so far keeps pruning the remaining trees */
+    memset(offsets, 0, forest->dimension * sizeof(double));
+    index = KD_FLAT_NONE;
+    _flat_nearest(tree, 0, p, offsets, 0.0, &index, &distance);
+    if (index != KD_FLAT_NONE) {
+      best = index;
+      best_tree = tree;
+    }
+  }
+
+  if (best_tree) {
+    *out_data = KD_FLAT_NODE(best_tree, best)->data;
+    if (out_distance)
+      *out_distance = distance;
+  }
+
+  lock_release(&forest->lock);
+
+  return best_tree ? 0 : -ENOENT;
+}
+
+/* @func `kd_forest_knn`
+ * @desc Same as `kd_tree_knn` over all levels of the forest
+ *
+ * @ret number of neighbours found or error code
+ */
+int kd_forest_knn(KdForest *forest, const double *p, size_t k, void **out_data,
+                  double *out_dist2) {
+  struct KdKnn h = {.data = out_data, .distance = out_dist2, .k = k};
+  KdFlatTree *tree;
+  double *offsets;
+  int l;
+  assert(forest);
+  assert(p);
+  assert(out_data);
+  assert(out_dist2);
+
+  if (k > INT_MAX)
+    return -EINVAL;
+
+  offsets = alloca(forest->dimension * sizeof(double));
+
+  lock_acquire(&forest->lock);
+
+  for (l = 0; l < KD_FOREST_LEVELS && k; ++l) {
+    tree = forest->trees[l];
+    if (!tree || !tree->size)
+      continue;
+
+    memset(offsets, 0, forest->dimension * sizeof(double));
+    _flat_knn(tree, 0, p, offsets, 0.0, &h);
+  }
+
+  lock_release(&forest->lock);
+
+  _knn_sort(&h);
+
+  return (int)h.size;
+}
+
+int kd_forest_unref(KdForest *forest) {
+  assert(forest);
+
+  _forest_drop_levels(forest, KD_FOREST_LEVELS);
+  lock_unref(&forest->lock);
+  free((void *)forest);
+
+  return 0;
+}
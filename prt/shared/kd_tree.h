@@ -5,7 +5,9 @@ extern "C" {
 #endif
 
 #include <prt/shared/basic.h>
+#include <prt/shared/array.h>
 #include <prt/runtime/lock.h>
+#include <prt/runtime/thread_pool.h>
 
 #ifndef KD_FLOAT
 #define KD_FLOAT double
@@ -14,6 +16,35 @@ extern "C" {
 #define KD_SYNCHRONIZED
 #define KD_POSITION KD_FLOAT *
 
+/* subtrees are rebuilt once deleted nodes exceed this share of them */
+#ifndef KD_REBUILD_DEAD_RATIO
+#define KD_REBUILD_DEAD_RATIO 0.5
+#endif
+
+/* subtrees with at least this many points are built on their own thread */
+#ifndef KD_BUILD_PARALLEL_MIN
+#define KD_BUILD_PARALLEL_MIN 0x10000
+#endif
+
+/* smallest number of queries handed to a worker by `kd_tree_query_batch` */
+#ifndef KD_BATCH_MIN_CHUNK
+#define KD_BATCH_MIN_CHUNK 64
+#endif
+
+typedef enum _KdBatchFlags {
+  KD_BATCH_NONE = 0,
+  /* process queries along a Morton curve for cache reuse */
+  KD_BATCH_MORTON = 1 << 0,
+} KdBatchFlags;
+
+/* approximate nearest neighbour search, zeroed fields mean exact */
+typedef struct _KdSearchParams {
+  /* prune cells farther than best / (1 + epsilon) */
+  double epsilon;
+  /* give up after visiting this many nodes, 0 for no limit */
+  size_t max_visits;
+} KdSearchParams;
+
 typedef struct _KdHyperRect {
   int dimension;
   KD_POSITION min;
@@ -24,15 +55,23 @@ typedef struct _KdNode {
   KD_POSITION position;
   int direction;
   void *data;
+  /* removed, kept as a split until its subtree is rebuilt */
+  bool deleted;
+  /* nodes in this subtree including itself, and how many are deleted */
+  size_t size, dead;
 
   struct _KdNode *left, *right;
 } KdNode;
 
-typedef struct _KdResultNode {
+/* item of the `Array` filled by the `_into` queries, `node` stays valid
+ * until the tree is modified; box and polytope queries report a distance
+ * of 0
+ */
+typedef struct _KdResult {
   KdNode *node;
+  void *data;
   KD_FLOAT distance_squared;
-  struct _KdResultNode *next;
-} KdResultNode;
+} KdResult;
 
 typedef struct _KdTree {
   int dimension;
@@ -43,14 +82,63 @@ typedef struct _KdTree {
 #endif
 } KdTree;
 
+/* Compact read-only variant. All nodes live in a single allocation with the
+ * coordinates stored inline, children are linked by index and the nodes are
+ * laid out in van Emde Boas order so that every few levels of a descent stay
+ * within the same cache lines.
+ */
+#define KD_FLAT_NONE UINT32_MAX
+/* node was removed from a `KdForest` and is skipped by queries */
+#define KD_FLAT_DEAD 0x1
+
+typedef struct _KdFlatNode {
+  uint32_t left, right;
+  int32_t direction;
+  uint32_t flags;
+  void *data;
+  double position[];
+} KdFlatNode;
+
+typedef struct _KdFlatTree {
+  int dimension;
+  size_t size;
+  /* bytes per node including the inline coordinates */
+  size_t stride;
+  /* root is always at index 0 */
+  uint8_t *nodes;
+} KdFlatTree;
+
+#define KD_FLAT_NODE(t, i)                                                     \
+  ((KdFlatNode *)((t)->nodes + (size_t)(i) * (t)->stride))
+
+/* Dynamic set of flat trees (Bentley-Saxe logarithmic method). Level `i`
+ * holds a balanced tree of at most 2^i points; an insert merges the full
+ * lower levels with the new point into the first free level. Removed points
+ * are only marked dead and dropped when their tree is merged, or by a full
+ * rebuild once they outnumber the live ones.
+ */
+#define KD_FOREST_LEVELS 48
+
+typedef struct _KdForest {
+  int dimension;
+  /* live points */
+  size_t size;
+  /* removed points still stored in `trees` */
+  size_t dead;
+  KdFlatTree *trees[KD_FOREST_LEVELS];
+  Lock lock;
+} KdForest;
+
 typedef struct _KdIterator {
   KdTree *tree;
-  KdResultNode *list;
-  KdResultNode *next;
+  /* `KdResult` items */
+  Array results;
+  size_t index;
   size_t size;
 } KdIterator;
 
 int kd_tree_new(int, KdTree **);
+int kd_tree_build(int, const double *, void **, size_t, KdTree **);
 int kd_tree_clear(KdTree *);
 int kd_tree_unref(KdTree *);
 
@@ -58,6 +146,7 @@ int kd_tree_insert(KdTree *, const double *, const void *);
 int kd_tree_insertf(KdTree *, const float *, const void *);
 int kd_tree_insert3(KdTree *, double, double, double, const void *);
 int kd_tree_insert3f(KdTree *, float, float, float, const void *);
+int kd_tree_remove(KdTree *, const double *, const void *);
 
 int kd_tree_nearest(KdTree *, const double *, KdIterator **);
 int kd_tree_nearestf(KdTree *, const float *, KdIterator **);
@@ -70,6 +159,25 @@ int kd_tree_nearest_range3(KdTree *, double, double, double, double,
                            KdIterator **);
 int kd_tree_nearest_range3f(KdTree *, float, float, float, float,
                             KdIterator **);
+/* append `KdResult` items to a reusable buffer, no iterator or lock kept */
+int kd_tree_nearest_range_into(KdTree *, const double *, double, Array *);
+
+/* unordered points inside an axis aligned box or a convex polytope */
+int kd_tree_box(KdTree *, const double *, const double *, KdIterator **);
+int kd_tree_polytope(KdTree *, const double *, size_t, KdIterator **);
+int kd_tree_box_into(KdTree *, const double *, const double *, Array *);
+int kd_tree_polytope_into(KdTree *, const double *, size_t, Array *);
+
+/* k nearest neighbours into caller buffers, returns the number found */
+int kd_tree_knn(KdTree *, const double *, size_t, void **, double *);
+int kd_tree_knn3(KdTree *, double, double, double, size_t, void **, double *);
+int kd_tree_knn_approx(KdTree *, const double *, size_t, const KdSearchParams *,
+                       void **, double *);
+int kd_tree_nearest_approx(KdTree *, const double *, const KdSearchParams *,
+                           void **, double *);
+/* many k nearest queries on `pool`, results at [i * k, i * k + k) */
+int kd_tree_query_batch(KdTree *, ThreadPool *, const double *, size_t, size_t,
+                        void **, double *, int);
 
 int kd_iterator_free(KdIterator *);
 int kd_iterator_rewind(KdIterator *);
@@ -79,6 +187,21 @@ bool kd_iterator_next(KdIterator *);
 int kd_iterator_item(KdIterator *, double *, void **);
 int kd_iterator_itemf(KdIterator *, float *, void **);
 int kd_iterator_data(KdIterator *, void **);
+
+/* flat trees are immutable, queries take no locks */
+int kd_flat_tree_build(int, const double *, void **, size_t, KdFlatTree **);
+int kd_flat_tree_nearest(KdFlatTree *, const double *, void **, double *);
+int kd_flat_tree_knn(KdFlatTree *, const double *, size_t, void **, double *);
+int kd_flat_tree_knn_approx(KdFlatTree *, const double *, size_t,
+                            const KdSearchParams *, void **, double *);
+int kd_flat_tree_unref(KdFlatTree *);
+
+int kd_forest_new(int, KdForest **);
+int kd_forest_insert(KdForest *, const double *, void *);
+int kd_forest_remove(KdForest *, const double *, void *);
+int kd_forest_nearest(KdForest *, const double *, void **, double *);
+int kd_forest_knn(KdForest *, const double *, size_t, void **, double *);
+int kd_forest_unref(KdForest *);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,416 @@
+#include <prt/shared/kd_treef.h>
+
+#if defined(PRT_INTEL) && defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(PRT_ARM) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define SQUARE(x) ((x) * (x))
+
+/*
+ * Vector abstraction for the bucket kernels, `KDF_LANES` floats wide.
+ * AVX handles a bucket in one step, SSE and NEON in two.
+ */
+#if defined(PRT_INTEL) && defined(__AVX__)
+#define KDF_LANES 8
+typedef __m256 kdf_vec;
+#define kdf_zero() _mm256_setzero_ps()
+#define kdf_set1(x) _mm256_set1_ps(x)
+#define kdf_load(p) _mm256_load_ps(p)
+#define kdf_store(p, v) _mm256_storeu_ps(p, v)
+#define kdf_sub(a, b) _mm256_sub_ps(a, b)
+#define kdf_madd(acc, a) _mm256_add_ps(acc, _mm256_mul_ps(a, a))
+#elif defined(PRT_INTEL) && defined(__SSE2__)
+#define KDF_LANES 4
+typedef __m128 kdf_vec;
+#define kdf_zero() _mm_setzero_ps()
+#define kdf_set1(x) _mm_set1_ps(x)
+#define kdf_load(p) _mm_load_ps(p)
+#define kdf_store(p, v) _mm_storeu_ps(p, v)
+#define kdf_sub(a, b) _mm_sub_ps(a, b)
+#define kdf_madd(acc, a) _mm_add_ps(acc, _mm_mul_ps(a, a))
+#elif defined(PRT_ARM) && defined(__ARM_NEON)
+#define KDF_LANES 4
+typedef float32x4_t kdf_vec;
+#define kdf_zero() vdupq_n_f32(0.0f)
+#define kdf_set1(x) vdupq_n_f32(x)
+#define kdf_load(p) vld1q_f32(p)
+#define kdf_store(p, v) vst1q_f32(p, v)
+#define kdf_sub(a, b) vsubq_f32(a, b)
+#define kdf_madd(acc, a) vmlaq_f32(acc, a, a)
+#else
+#define KDF_LANES 1
+typedef float kdf_vec;
+#define kdf_zero() 0.0f
+#define kdf_set1(x) (x)
+#define kdf_load(p) (*(p))
+#define kdf_store(p, v) (*(p) = (v))
+#define kdf_sub(a, b) ((a) - (b))
+#define kdf_madd(acc, a) ((acc) + (a) * (a))
+#endif
+
+/* @func `_distances`
+ * @desc Squared distances from `p` to all points of a bucket, `coords` is
+ *       the bucket laid out axis major
+ */
+static inline __attribute__((always_inline)) void
+_distances(const float *coords, const float *p, int dimension, float *out) {
+  kdf_vec acc;
+  int i, d;
+
+  for (i = 0; i < KDF_BUCKET; i += KDF_LANES) {
+    acc = kdf_zero();
+    for (d = 0; d < dimension; ++d)
+      acc = kdf_madd(acc, kdf_sub(kdf_load(&coords[d * KDF_BUCKET + i]),
+                                  kdf_set1(p[d])));
+    kdf_store(&out[i], acc);
+  }
+}
+
+/* stamps out a kernel with a constant dimension, the axis loop unrolls */
+#define KDF_SPECIALIZE(N)                                                      \
+  static void _distances##N(const float *coords, const float *p,               \
+                            int dimension, float *out) {                       \
+    (void)dimension;                                                           \
+    _distances(coords, p, N, out);                                             \
+  }
+
+KDF_SPECIALIZE(2)
+KDF_SPECIALIZE(3)
+KDF_SPECIALIZE(4)
+
+static void _distances_any(const float *coords, const float *p, int dimension,
+                           float *out) {
+  _distances(coords, p, dimension, out);
+}
+
+#undef KDF_SPECIALIZE
+
+static KdfDistances _select_kernel(int dimension) {
+  switch (dimension) {
+  case 2:
+    return _distances2;
+  case 3:
+    return _distances3;
+  case 4:
+    return _distances4;
+  default:
+    return _distances_any;
+  }
+}
+
+struct KdfBuild {
+  KdTreef *tree;
+  const float *points;
+  void **data;
+  size_t *indices;
+};
+
+/* bounded max-heap of the k best candidates, see `struct KdKnn` */
+struct KdfKnn {
+  void **data;
+  float *distance;
+  size_t k, size;
+};
+
+#define KD_T float
+#define KD_KNN struct KdfKnn
+#include <prt/shared/kd_template.h>
+
+
+/* @func `_fill_bucket`
+ * @desc Transposes up to `KDF_BUCKET` points into the next bucket, unused
+ *       lanes are padded with infinity so they never win a comparison
+ */
+static uint32_t _fill_bucket(struct KdfBuild *b, const size_t *indices,
+                             size_t n) {
+  KdTreef *tree = b->tree;
+  uint32_t bucket;
+  float *coords;
+  size_t i;
+  int d;
+
+  bucket = (uint32_t)tree->num_buckets++;
+  coords = &tree->coords[(size_t)bucket * tree->dimension * KDF_BUCKET];
+
+  for (d = 0; d < tree->dimension; ++d)
+    for (i = 0; i < KDF_BUCKET; ++i)
+      coords[d * KDF_BUCKET + i] =
+          i < n ? b->points[indices[i] * tree->dimension + d] : INFINITY;
+
+  for (i = 0; i < KDF_BUCKET; ++i)
+    tree->data[(size_t)bucket * KDF_BUCKET + i] =
+        i < n && b->data ? b->data[indices[i]] : NULL;
+
+  return bucket;
+}
+
+/* @func `_build_subtree`
+ * @desc Splits at the median of the widest axis until at most `KDF_BUCKET`
+ *       points remain. Everything left of the split is <= `split` and
+ *       everything right of it is >= `split`.
+ */
+static void _build_subtree(struct KdfBuild *b, size_t *indices, size_t n) {
+  KdTreef *tree = b->tree;
+  KdTreefNode *node;
+  uint32_t index;
+  size_t mid;
+  int axis;
+
+  index = (uint32_t)tree->num_nodes++;
+  node = &tree->nodes[index];
+
+  if (n <= KDF_BUCKET) {
+    node->axis = KDF_LEAF;
+    node->split = 0.0f;
+    node->right = _fill_bucket(b, indices, n);
+    node->count = (uint32_t)n;
+    return;
+  }
+
+  axis = _widest_axis(b->points, indices, n, tree->dimension);
+  mid = n / 2;
+  _select_median(b->points, indices, n, mid, tree->dimension, axis);
+
+  node->axis = axis;
+  node->split = b->points[indices[mid] * tree->dimension + axis];
+  node->count = 0;
+
+  /* left child follows directly */
+  _build_subtree(b, indices, mid);
+  tree->nodes[index].right = (uint32_t)tree->num_nodes;
+  _build_subtree(b, indices + mid, n - mid);
+}
+
+/* @func `kd_treef_build`
+ * @desc Builds a read-only single precision tree from `n` points. Queries
+ *       don't lock and may run concurrently.
+ *
+ * @param(dimension) Dimension of the points
+ * @param(points)    `n` * `dimension` packed coordinates
+ * @param(data)      Optional array of `n` data pointers
+ * @param(n)         Number of points
+ * @param(out_tree)  Receives the created tree
+ *
+ * @ret 0 on success or error code
+ */
+int kd_treef_build(int dimension, const float *points, void **data, size_t n,
+                   KdTreef **out_tree) {
+  struct KdfBuild b;
+  KdTreef *tree;
+  size_t i, buckets;
+  void *coords;
+  int r;
+  assert(points || n == 0);
+  assert(out_tree);
+
+  if (dimension <= 0)
+    return -EINVAL;
+
+  /* every split leaves at least KDF_BUCKET / 2 points on either side */
+  buckets = n / (KDF_BUCKET / 2) + 1;
+  if (buckets * 2 >= UINT32_MAX)
+    return -E2BIG;
+
+  tree = NEW0(KdTreef);
+  if (!tree)
+    return -ENOMEM;
+
+  tree->dimension = dimension;
+  tree->distances = _select_kernel(dimension);
+  if (!n) {
+    *out_tree = tree;
+    return 0;
+  }
+
+  r = -ENOMEM;
+  b.tree = tree;
+  b.points = points;
+  b.data = data;
+  b.indices = NEW0N(size_t, n);
+  tree->nodes = NEW0N(KdTreefNode, buckets * 2);
+  tree->data = NEW0N(void *, buckets * KDF_BUCKET);
+  if (!b.indices || !tree->nodes || !tree->data)
+    goto out;
+
+  /* aligned for vector loads, one bucket axis is exactly 32 bytes */
+  if (posix_memalign(&coords, 32,
+                     buckets * dimension * KDF_BUCKET * sizeof(float)))
+    goto out;
+  tree->coords = (float *)coords;
+
+  for (i = 0; i < n; ++i)
+    b.indices[i] = i;
+
+  _build_subtree(&b, b.indices, n);
+
+  tree->size = n;
+  *out_tree = tree;
+  tree = NULL;
+  r = 0;
+out:
+  free((void *)b.indices);
+  if (tree)
+    kd_treef_unref(tree);
+  return r;
+}
+
+/* @func `_nearest`
+ * @desc Nearest neighbour descent, `offsets` holds per-axis distances from
+ *       `p` to the current cell and `rd` their squared sum
+ */
+static void _nearest(const KdTreef *tree, uint32_t index, const float *p,
+                     float *offsets, float rd, size_t *out_best,
+                     float *out_distance) {
+  const KdTreefNode *node;
+  float distances[KDF_BUCKET];
+  uint32_t near, far, i;
+  float dx, old;
+  int axis;
+
+  node = &tree->nodes[index];
+  if (node->axis == KDF_LEAF) {
+    tree->distances(
+        &tree->coords[(size_t)node->right * tree->dimension * KDF_BUCKET], p,
+        tree->dimension, distances);
+    for (i = 0; i < node->count; ++i)
+      if (distances[i] < *out_distance) {
+        *out_distance = distances[i];
+        *out_best = (size_t)node->right * KDF_BUCKET + i;
+      }
+    return;
+  }
+
+  axis = node->axis;
+  dx = p[axis] - node->split;
+  near = dx <= 0.0f ? index + 1 : node->right;
+  far = dx <= 0.0f ? node->right : index + 1;
+
+  _nearest(tree, near, p, offsets, rd, out_best, out_distance);
+
+  old = offsets[axis];
+  rd += SQUARE(dx) - SQUARE(old);
+  if (rd < *out_distance) {
+    offsets[axis] = dx;
+    _nearest(tree, far, p, offsets, rd, out_best, out_distance);
+    offsets[axis] = old;
+  }
+}
+
+/* @func `kd_treef_nearest`
+ * @desc Finds the nearest point to `p`
+ *
+ * @param(tree)         Tree to search
+ * @param(p)            Query point
+ * @param(out_data)     Receives data of the nearest point
+ * @param(out_distance) Optional, receives the squared distance
+ *
+ * @ret 0 on success, -ENOENT if the tree is empty
+ */
+int kd_treef_nearest(KdTreef *tree, const float *p, void **out_data,
+                     float *out_distance) {
+  float *offsets, distance;
+  size_t best;
+  assert(tree);
+  assert(p);
+  assert(out_data);
+
+  if (!tree->size)
+    return -ENOENT;
+
+  offsets = alloca(tree->dimension * sizeof(float));
+  memset(offsets, 0, tree->dimension * sizeof(float));
+
+  best = 0;
+  distance = INFINITY;
+  _nearest(tree, 0, p, offsets, 0.0f, &best, &distance);
+
+  *out_data = tree->data[best];
+  if (out_distance)
+    *out_distance = distance;
+
+  return 0;
+}
+
+static void _knn(const KdTreef *tree, uint32_t index, const float *p,
+                 float *offsets, float rd, struct KdfKnn *h) {
+  const KdTreefNode *node;
+  float distances[KDF_BUCKET];
+  uint32_t near, far, i;
+  float dx, old;
+  int axis;
+
+  node = &tree->nodes[index];
+  if (node->axis == KDF_LEAF) {
+    tree->distances(
+        &tree->coords[(size_t)node->right * tree->dimension * KDF_BUCKET], p,
+        tree->dimension, distances);
+    for (i = 0; i < node->count; ++i)
+      if (distances[i] < _knn_bound(h))
+        _knn_push(h, tree->data[(size_t)node->right * KDF_BUCKET + i],
+                  distances[i]);
+    return;
+  }
+
+  axis = node->axis;
+  dx = p[axis] - node->split;
+  near = dx <= 0.0f ? index + 1 : node->right;
+  far = dx <= 0.0f ? node->right : index + 1;
+
+  _knn(tree, near, p, offsets, rd, h);
+
+  old = offsets[axis];
+  rd += SQUARE(dx) - SQUARE(old);
+  if (rd < _knn_bound(h)) {
+    offsets[axis] = dx;
+    _knn(tree, far, p, offsets, rd, h);
+    offsets[axis] = old;
+  }
+}
+
+/* @func `kd_treef_knn`
+ * @desc Finds the `k` nearest points to `p`
+ *
+ * @param(tree)      Tree to search
+ * @param(p)         Query point
+ * @param(k)         Maximum number of neighbours
+ * @param(out_data)  Array of at least `k` entries, receives the data
+ * @param(out_dist2) Array of at least `k` entries, receives squared distances
+ *
+ * @ret number of neighbours found, ordered by ascending distance, or error
+ *      code
+ */
+int kd_treef_knn(KdTreef *tree, const float *p, size_t k, void **out_data,
+                 float *out_dist2) {
+  struct KdfKnn h = {.data = out_data, .distance = out_dist2, .k = k};
+  float *offsets;
+  assert(tree);
+  assert(p);
+  assert(out_data);
+  assert(out_dist2);
+
+  if (k > INT_MAX)
+    return -EINVAL;
+
+  offsets = alloca(tree->dimension * sizeof(float));
+  memset(offsets, 0, tree->dimension * sizeof(float));
+
+  if (tree->size && k)
+    _knn(tree, 0, p, offsets, 0.0f, &h);
+
+  _knn_sort(&h);
+
+  return (int)h.size;
+}
+
+int kd_treef_unref(KdTreef *tree) {
+  assert(tree);
+
+  free((void *)tree->nodes);
+  free((void *)tree->coords);
+  free((void *)tree->data);
+  free((void *)tree);
+
+  return 0;
+}
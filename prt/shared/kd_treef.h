@@ -0,0 +1,52 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <prt/shared/basic.h>
+
+/* Float-native, read-only kd-tree. Points are kept in leaf buckets of
+ * `KDF_BUCKET` entries stored as structure of arrays, so a whole bucket is
+ * tested with a few SIMD operations (AVX, SSE or NEON, scalar otherwise).
+ * Distance kernels are specialized for 2, 3 and 4 dimensions.
+ *
+ * Nodes are stored in pre-order, the left child of an inner node is the
+ * next node in the array.
+ */
+#define KDF_BUCKET 8
+#define KDF_LEAF -1
+
+typedef struct _KdTreefNode {
+  float split;
+  /* split axis or `KDF_LEAF` */
+  int32_t axis;
+  /* inner: index of the right child, leaf: bucket index */
+  uint32_t right;
+  /* leaf: number of points in the bucket */
+  uint32_t count;
+} KdTreefNode;
+
+typedef void (*KdfDistances)(const float *, const float *, int, float *);
+
+typedef struct _KdTreef {
+  int dimension;
+  size_t size;
+  KdTreefNode *nodes;
+  size_t num_nodes;
+  /* `KDF_BUCKET` * dimension floats per bucket, axis major */
+  float *coords;
+  /* `KDF_BUCKET` entries per bucket */
+  void **data;
+  size_t num_buckets;
+  KdfDistances distances;
+} KdTreef;
+
+int kd_treef_build(int, const float *, void **, size_t, KdTreef **);
+int kd_treef_nearest(KdTreef *, const float *, void **, float *);
+int kd_treef_knn(KdTreef *, const float *, size_t, void **, float *);
+int kd_treef_unref(KdTreef *);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,14 +1,8 @@
 #include <tests/common.h>
 #include <prt/shared/avl_tree.h>
 
-int pointer_compare(void *a, void *b) {
-  intptr_t d = (intptr_t)a - (intptr_t)b;
-  if (d == 0)
-    return 0;
-  else if (d < 0)
-    return -1;
-  return 1;
-}
+#define NUM_READERS 4
+#define READER_LOOKUPS 10000
 
 struct Data {
   char *key;
@@ -42,6 +36,155 @@ int test_single_entry(BinaryTree *t, size_t index) {
   return 0;
 }
 
+void *reader_thread(void *p) {
+  BinaryTree *t = (BinaryTree *)p;
+  void *value;
+  size_t i;
+
+  for (i = 0; i < READER_LOOKUPS; ++i) {
+    if (binary_tree_find(t, test_data[i % COUNT(test_data)].key, &value) < 0)
+      return INT_TO_PTR(-ENOENT);
+    if (!streq((const char *)value, test_data[i % COUNT(test_data)].value))
+      return INT_TO_PTR(-EINVAL);
+  }
+
+  return NULL;
+}
+
+int test_parallel_readers(BinaryTree *t) {
+  BinaryTreeEnum *en;
+  pthread_t readers[NUM_READERS];
+  void *ret;
+  size_t i;
+  int r, failed = 0;
+
+  /* an enumerator holds a read lock, finds must still go through */
+  r = binary_tree_enum_new(t, &en);
+  if (r < 0)
+    return r;
+
+  for (i = 0; i < NUM_READERS; ++i)
+    pthread_create(&readers[i], NULL, reader_thread, t);
+
+  for (i = 0; i < NUM_READERS; ++i) {
+    pthread_join(readers[i], &ret);
+    if (ret)
+      failed = PTR_TO_INT(ret);
+  }
+
+  r = binary_tree_enum_unref(en);
+  if (r < 0)
+    return r;
+
+  /* the tree lock is usable again after the enumerator is gone */
+  r = binary_tree_insert(t, "extra", "val5");
+  if (r < 0)
+    return r;
+
+  r = binary_tree_delete_key(t, "extra", &ret);
+  if (r < 0)
+    return r;
+
+  return failed;
+}
+
+#define BULK_ITEMS 1000
+
+/* keys are enumerated in descending order with `pointer_compare` */
+int test_bulk_load_and_ranges() {
+  BinaryTreeEnum *en;
+  BinaryTree *t;
+  void **items, *key, *val;
+  size_t i, rank;
+  int r;
+
+  items = calloc(BULK_ITEMS * 2, sizeof(void *));
+  if (!items)
+    return -ENOMEM;
+
+  for (i = 0; i < BULK_ITEMS; ++i) {
+    items[i * 2 + 0] = UINT_TO_PTR(BULK_ITEMS - i);
+    items[i * 2 + 1] = UINT_TO_PTR((BULK_ITEMS - i) * 10);
+  }
+
+  r = binary_tree_bulk_load(pointer_compare, items, BULK_ITEMS * 2, &t);
+  free((void *)items);
+  output("  [+] bulk load of %d items: %s", BULK_ITEMS, r == 0 ? "ok" : "ERROR");
+  if (r < 0)
+    return r;
+
+  /* perfectly balanced: ceil(log2(1001)) */
+  output("  [+] height: %u, size: %zu", t->root->height, t->root->size);
+  if (t->root->height != 10 || t->root->size != BULK_ITEMS)
+    return -1;
+
+  r = binary_tree_find(t, UINT_TO_PTR(123), &val);
+  if (r < 0 || PTR_TO_UINT(val) != 1230)
+    return -1;
+
+  r = binary_tree_select(t, 0, &key, &val);
+  output("  [+] select(0): %u", PTR_TO_UINT(key));
+  if (r < 0 || PTR_TO_UINT(key) != BULK_ITEMS)
+    return -1;
+
+  r = binary_tree_rank(t, UINT_TO_PTR(500), &rank);
+  output("  [+] rank(500): %zu", rank);
+  if (r < 0 || rank != 500)
+    return -1;
+
+  r = binary_tree_lower_bound(t, UINT_TO_PTR(500), &key, NULL);
+  output("  [+] lower_bound(500): %u", PTR_TO_UINT(key));
+  if (r < 0 || PTR_TO_UINT(key) != 500)
+    return -1;
+
+  r = binary_tree_upper_bound(t, UINT_TO_PTR(500), &key, NULL);
+  output("  [+] upper_bound(500): %u", PTR_TO_UINT(key));
+  if (r < 0 || PTR_TO_UINT(key) != 499)
+    return -1;
+
+  r = binary_tree_upper_bound(t, UINT_TO_PTR(1), &key, NULL);
+  if (r != -ENOENT)
+    return -1;
+
+  /* inserts and deletes keep subtree sizes in sync */
+  r = binary_tree_insert(t, UINT_TO_PTR(5000), NULL);
+  if (r < 0)
+    return r;
+  r = binary_tree_delete_key(t, UINT_TO_PTR(700), &val);
+  if (r < 0)
+    return r;
+  r = binary_tree_select(t, 0, &key, NULL);
+  if (r < 0 || PTR_TO_UINT(key) != 5000)
+    return -1;
+  r = binary_tree_rank(t, UINT_TO_PTR(500), &rank);
+  if (r < 0 || rank != 500)
+    return -1;
+
+  r = binary_tree_enum_new(t, &en);
+  if (r < 0)
+    return r;
+
+  r = binary_tree_enum_seek(en, UINT_TO_PTR(10), &val);
+  if (r < 0 || PTR_TO_UINT(val) != 100)
+    return -1;
+
+  for (i = 9; i > 0; --i) {
+    (void)binary_tree_enum_next_kv(en, &key, &val);
+    if (PTR_TO_UINT(key) != i)
+      return -1;
+  }
+  (void)binary_tree_enum_next(en, &val);
+  output("  [+] range enumeration from seek: %s", val == NULL ? "ok" : "ERROR");
+  if (val)
+    return -1;
+
+  r = binary_tree_enum_unref(en);
+  if (r < 0)
+    return r;
+
+  return binary_tree_unref(t);
+}
+
 int main(int argc, const char *argv[]) {
   BinaryTreeEnum *en;
   BinaryTree *tree;
@@ -88,6 +231,19 @@ int main(int argc, const char *argv[]) {
   }
   output1("");
 
+  r = binary_tree_find(tree, "missing", &val);
+  output("  [+] missing key lookup failed with -ENOENT: %s",
+         r == -ENOENT ? "yes" : "no");
+  if (r != -ENOENT)
+    return -1;
+
+  r = test_parallel_readers(tree);
+  output(" [+] %d parallel readers with a live enumerator: %s", NUM_READERS,
+         r == 0 ? "ok" : "ERROR");
+  if (r < 0)
+    return r;
+  output1("");
+
   r = binary_tree_to_array(tree, &all, &numall);
   output(" [+] to array: %s [count: %zu]", r == 0 ? "ok" : "ERROR", numall);
   if (r < 0)
@@ -159,6 +315,15 @@ int main(int argc, const char *argv[]) {
     return r;
   }
   output1(" [-] tree destroyed");
+  output1("");
+
+  output1(" [+] bulk load and ordered queries");
+  r = test_bulk_load_and_ranges();
+  if (r < 0) {
+    output1(" [!] ordered queries failed");
+    return r;
+  }
+
   output1("  - ALL TESTS PASSED!");
   return 0;
 }
@@ -1,6 +1,39 @@
 #include <tests/common.h>
 #include <prt/shared/bit_vector.h>
 
+/* searches start on set bits, cross words and end on the last word */
+int test_next_set_bit(void) {
+  static const size_t set[] = {0, 1, 2, 3, 4, 5, 63, 64, 128, 133, 200};
+  static const size_t queries[][2] = {
+      {2, 3}, {5, 63}, {63, 64}, {64, 128}, {128, 133}, {133, 200},
+  };
+  BitVector *vec;
+  size_t i, next;
+  int r;
+
+  r = bitvector_new(256, &vec);
+  if (r < 0)
+    return r;
+
+  for (i = 0; i < COUNT(set); ++i)
+    bitvector_set_bit(vec, set[i], true);
+
+  for (i = 0; i < COUNT(queries) && r == 0; ++i) {
+    r = bitvector_next_set_bit(vec, queries[i][0], &next);
+    if (r == 0 && next != queries[i][1]) {
+      output(" [!] next set bit after %zu: %zu != %zu", queries[i][0], next,
+             queries[i][1]);
+      r = -1;
+    }
+  }
+
+  if (r == 0 && bitvector_next_set_bit(vec, 200, &next) != -ENOENT)
+    r = -1;
+
+  bitvector_unref(vec);
+  return r;
+}
+
 int main(int argc, const char *argv[]) {
   BitVector *vec;
   size_t i, c;
@@ -15,6 +48,11 @@ int main(int argc, const char *argv[]) {
   if (r < 0)
     return r;
 
+  r = test_next_set_bit();
+  output(" [+] next set bit: %s", r == 0 ? "ok" : "ERROR");
+  if (r < 0)
+    return 1;
+
   for (i = 0; i < 1024 * 64; ++i)
     bitvector_set_bit(vec, i, i % 2);
 
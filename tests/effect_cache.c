@@ -0,0 +1,127 @@
+#include <tests/common.h>
+#include <prt/graphics/effect_cache.h>
+
+#define AS_STRING(r) (r == 0 ? "OK" : "FAILED")
+
+static VariableBinding attributes[] = {
+    {"a_position", SVT_FLOAT3}, {"a_uv", SVT_FLOAT2},
+};
+static VariableBinding uniforms[] = {
+    {"u_mvp", SVT_MATRIX_4X4}, {"u_color", SVT_FLOAT4}, {"u_texture", SVT_TEXTURE},
+};
+static const char binary[] = "\x01\x02\x00\x03 not really a program";
+
+/* entries come back as written, damaged ones are rejected */
+int test_roundtrip(EffectCache *cache) {
+  EffectCacheEntry entry = {0}, *read;
+  char file[PATH_MAX];
+  FILE *fd;
+  size_t i;
+  int r;
+
+  entry.key = 0x0123456789abcdefULL;
+  entry.type = ET_SOLID_TEXTURE;
+  entry.vertex = "shaders/solid.vs";
+  entry.fragment = "shaders/solid.fs";
+  entry.binding.attributes = attributes;
+  entry.binding.num_attributes = COUNT(attributes);
+  entry.binding.uniforms = uniforms;
+  entry.binding.num_uniforms = COUNT(uniforms);
+  entry.format = 0x8741;
+  entry.binary = binary;
+  entry.binary_size = sizeof(binary);
+
+  if (effect_cache_read(cache, "effects/solid.json", &read) != -ENOENT)
+    return -1;
+
+  r = effect_cache_write(cache, "effects/solid.json", &entry);
+  if (r < 0)
+    return r;
+
+  r = effect_cache_read(cache, "effects/solid.json", &read);
+  if (r < 0)
+    return r;
+
+  if (read->key != entry.key || read->type != entry.type ||
+      strcmp(read->vertex, entry.vertex) ||
+      strcmp(read->fragment, entry.fragment) || read->format != entry.format ||
+      read->binary_size != sizeof(binary) ||
+      memcmp(read->binary, binary, sizeof(binary)) ||
+      read->binding.num_attributes != COUNT(attributes) ||
+      read->binding.num_uniforms != COUNT(uniforms))
+    r = -1;
+  for (i = 0; r == 0 && i < COUNT(attributes); ++i)
+    if (strcmp(read->binding.attributes[i].name, attributes[i].name) ||
+        read->binding.attributes[i].type != attributes[i].type)
+      r = -1;
+  for (i = 0; r == 0 && i < COUNT(uniforms); ++i)
+    if (strcmp(read->binding.uniforms[i].name, uniforms[i].name) ||
+        read->binding.uniforms[i].type != uniforms[i].type)
+      r = -1;
+  effect_cache_entry_unref(read);
+  if (r < 0)
+    return r;
+
+  /* truncate the entry */
+  snprintf(file, sizeof(file), "%s/%016llx.effect", cache->dir,
+           (unsigned long long)murmur3_64("effects/solid.json", 18,
+                                          MURMUR64_SEED));
+  if (truncate(file, 60) < 0)
+    return -1;
+  if (effect_cache_read(cache, "effects/solid.json", &read) != -EINVAL)
+    return -1;
+
+  fd = fopen(file, "wb");
+  if (!fd)
+    return -1;
+  fputs("garbage", fd);
+  fclose(fd);
+  r = effect_cache_read(cache, "effects/solid.json", &read) == -EINVAL ? 0 : -1;
+  unlink(file);
+
+  return r;
+}
+
+/* the key covers the description and both shaders */
+int test_key(void) {
+  FileResource json = {"{}", 2, NULL}, vs = {"void vs() {}", 12, NULL},
+               fs = {"void fs() {}", 12, NULL}, fs2 = {"void fs() { }", 13, NULL};
+  uint64_t key;
+
+  key = effect_cache_key(&json, &vs, &fs);
+  if (key != effect_cache_key(&json, &vs, &fs) ||
+      key == effect_cache_key(&json, &vs, &fs2) ||
+      key == effect_cache_key(&json, &fs, &vs))
+    return -1;
+  return 0;
+}
+
+int main(int argc, const char *argv[]) {
+  EffectCache *cache;
+  char dir[] = "/tmp/prt-effect-cacheXXXXXX";
+  int r;
+
+  output1("[!] " PRD_HEADER " - effect cache test");
+
+  if (!mkdtemp(dir))
+    return 1;
+
+  r = effect_cache_new(dir, &cache);
+  output(" [+] cache created: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_roundtrip(cache);
+  output(" [+] entry roundtrip: %s", AS_STRING(r));
+  (void)effect_cache_unref(cache);
+  rmdir(dir);
+  if (r < 0)
+    return 1;
+
+  r = test_key();
+  output(" [+] content key: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  return 0;
+}
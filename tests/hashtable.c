@@ -72,6 +72,19 @@ int main(int argc, const char *argv[]) {
   printf("^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ "
          "^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n");
 
+  /* emptied buckets take new items, removal reports the removed value */
+  output(" [-] re-adding and removing item: (%s)", strings[5]);
+  r = hashtable_add(h, HASH(strings[5]), (void *)strings[5], INT_TO_PTR(5));
+  if (r == 0)
+    r = hashtable_remove(h, HASH(strings[5]), (void *)strings[5], &v);
+  if (r == 0 && PTR_TO_INT(v) != 5)
+    r = -EINVAL;
+  if (r == 0)
+    r = hashtable_add(h, HASH(strings[5]), (void *)strings[5], INT_TO_PTR(5));
+  output("  [-] item: (%s) re-added: %s", strings[5], r == 0 ? "ok" : "ERROR");
+  if (r < 0)
+    return 1;
+
   output1(" [+] iteration test");
   r = hashtable_iterate(h, &it);
   while (hashtable_iterator_next(it, &key, &v)) {
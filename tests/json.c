@@ -0,0 +1,646 @@
+#include <tests/common.h>
+#include <prt/shared/json.h>
+#include <prt/shared/json_bind.h>
+#include <stddef.h>
+#include <prt/runtime/resources.h>
+
+#define AS_STRING(r) (r == 0 ? "OK" : "FAILED")
+
+/* not terminated on purpose, documents come straight from file resources */
+static const char effect[] = "{\n"
+                             "  \"version\": 1,\n"
+                             "  \"name\": \"solid\\tcolor \\u00e9\\ud83d\\ude00\",\n"
+                             "  \"empty\": {},\n"
+                             "  \"uniforms\": [\n"
+                             "    { \"name\": \"u_mvp\", \"type\": \"mat4\" },\n"
+                             "    { \"name\": \"u_color\", \"type\": \"vec4\" }\n"
+                             "  ],\n"
+                             "  \"scale\": -2.5e1,\n"
+                             "  \"flags\": [true, false, null]\n"
+                             "}";
+
+static const char *invalid[] = {
+    "",     "{",           "{\"a\" 1}",   "[1,]",      "[1 2]",
+    "nul",  "\"abc",       "[\"\\x\"]",   "{\"a\":1}}", "[\"\\ud83d\"]",
+    "[01a]", "{1: 2}",     "[1.2.3]",     "[-]",       "[1e]",
+    "[.5]",
+};
+
+int test_document(void) {
+  JsonDocument *doc;
+  JsonVariant *v, *e;
+  size_t i;
+  int r;
+
+  r = json_document_parse(effect, sizeof(effect) - 1, &doc);
+  if (r < 0)
+    return r;
+
+  v = &doc->root;
+  if (v->type != JSON_VARIANT_OBJECT || v->size != 12)
+    return -1;
+
+  e = json_variant_value(v, "version");
+  if (!e || json_variant_integer(e) != 1)
+    return -1;
+
+  e = json_variant_value(v, "name");
+  if (!e || strcmp(json_variant_string(e), "solid\tcolor \xc3\xa9\xf0\x9f\x98\x80"))
+    return -1;
+
+  e = json_variant_value(v, "empty");
+  if (!e || e->type != JSON_VARIANT_OBJECT || e->size != 0)
+    return -1;
+
+  e = json_variant_value(v, "uniforms");
+  if (!e || e->type != JSON_VARIANT_ARRAY || e->size != 2)
+    return -1;
+  e = json_variant_value(json_variant_element(e, 1), "type");
+  if (!e || strcmp(json_variant_string(e), "vec4"))
+    return -1;
+
+  e = json_variant_value(v, "scale");
+  if (!e || json_variant_real(e) != -25.0)
+    return -1;
+
+  e = json_variant_value(v, "flags");
+  if (!e || e->size != 3 || !json_variant_bool(json_variant_element(e, 0)) ||
+      json_variant_element(e, 2)->type != JSON_VARIANT_NULL)
+    return -1;
+
+  (void)json_document_unref(doc);
+
+  for (i = 0; i < COUNT(invalid); ++i) {
+    r = json_document_parse(invalid[i], strlen(invalid[i]), &doc);
+    if (r >= 0) {
+      output("   [!] accepted invalid document: %s", invalid[i]);
+      (void)json_document_unref(doc);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* values must match the correctly rounded double, not an approximation */
+int test_numbers(void) {
+  static const char text[] =
+      "[0.1, 1e23, 2.2250738585072011e-308, 4.9406564584124654e-324,"
+      " 1.7976931348623157e308, 123456.789012345678, -0.000015625, 1e-400,"
+      " 9223372036854775807, -9223372036854775808, 9223372036854775808,"
+      " 12345678901234567890123, 1.5E+3]";
+  static const double reals[] = {0.1, 1e23, 2.2250738585072011e-308,
+                                 4.9406564584124654e-324,
+                                 1.7976931348623157e308, 123456.789012345678,
+                                 -0.000015625, 0.0};
+  JsonDocument *doc;
+  JsonVariant *v, *e;
+  size_t i;
+  int r = 0;
+
+  if (json_document_parse(text, sizeof(text) - 1, &doc) < 0)
+    return -1;
+  v = &doc->root;
+
+  for (i = 0; i < COUNT(reals); ++i) {
+    e = json_variant_element(v, i);
+    if (e->type != JSON_VARIANT_REAL || json_variant_real(e) != reals[i])
+      r = -1;
+  }
+
+  if (json_variant_integer(json_variant_element(v, 8)) != INTMAX_MAX ||
+      json_variant_integer(json_variant_element(v, 9)) != INTMAX_MIN)
+    r = -1;
+
+  /* integers that don't fit become reals instead of wrapping */
+  e = json_variant_element(v, 10);
+  if (e->type != JSON_VARIANT_REAL || json_variant_real(e) != 9223372036854775808.0)
+    r = -1;
+  e = json_variant_element(v, 11);
+  if (e->type != JSON_VARIANT_REAL || json_variant_real(e) != 12345678901234567890123.0)
+    r = -1;
+  if (json_variant_real(json_variant_element(v, 12)) != 1500.0)
+    r = -1;
+
+  (void)json_document_unref(doc);
+  return r;
+}
+
+#define INDEX_KEYS 300
+
+static int check_keys(JsonVariant *v) {
+  char key[32];
+  JsonVariant *e;
+  int i;
+
+  for (i = 0; i < INDEX_KEYS; ++i) {
+    sprintf(key, "key%d", i);
+    e = json_variant_value(v, key);
+    if (!e || json_variant_integer(e) != i)
+      return -1;
+    if (json_variant_value_hashed(v, HASH(key), key) != e)
+      return -1;
+  }
+
+  /* duplicates resolve to the first pair, like the linear scan */
+  e = json_variant_value(v, "dup");
+  if (!e || json_variant_integer(e) != 1)
+    return -1;
+
+  if (json_variant_value(v, "key") || json_variant_value(v, "key300") ||
+      json_variant_value_hashed(v, HASH("missing"), "missing"))
+    return -1;
+
+  return 0;
+}
+
+/* large objects are looked up through a hashed key index */
+int test_key_index(void) {
+  JsonDocument *doc;
+  JsonVariant *old;
+  char *text;
+  size_t n = 0;
+  int i, r;
+
+  text = malloc(32 * INDEX_KEYS + 64);
+  if (!text)
+    return -ENOMEM;
+
+  n += sprintf(text + n, "{\"dup\": 1");
+  for (i = 0; i < INDEX_KEYS; ++i)
+    n += sprintf(text + n, ", \"key%d\": %d", i, i);
+  n += sprintf(text + n, ", \"dup\": 2}");
+
+  /* indexed while parsing, with keys as views into `text` */
+  r = json_document_parse_view(text, n, &doc);
+  if (r < 0)
+    goto out;
+  r = doc->root.index ? check_keys(&doc->root) : -1;
+  (void)json_document_unref(doc);
+  if (r < 0)
+    goto out;
+
+  /* indexed lazily by the first lookup */
+  r = json_parse(text, n, &old);
+  if (r < 0)
+    goto out;
+  r = old->index ? -1 : check_keys(old);
+  /* the first lookup published the index */
+  if (r == 0 && !old->index)
+    r = -1;
+  (void)json_variant_unref(old);
+
+out:
+  free((void *)text);
+  return r;
+}
+
+static bool same_variant(JsonVariant *a, JsonVariant *b) {
+  size_t i;
+
+  if (a->type != b->type || a->size != b->size)
+    return false;
+
+  switch (a->type) {
+  case JSON_VARIANT_STRING:
+    return memcmp(a->string, b->string, a->size) == 0;
+  case JSON_VARIANT_ARRAY:
+  case JSON_VARIANT_OBJECT:
+    for (i = 0; i < a->size; ++i)
+      if (!same_variant(&a->objects[i], &b->objects[i]))
+        return false;
+    return true;
+  case JSON_VARIANT_NULL:
+    return true;
+  default:
+    return memcmp(&a->value, &b->value, sizeof(a->value)) == 0;
+  }
+}
+
+/* large documents go through the structural index, shifting the padding
+ * moves escapes and quotes across every position of a 64 byte block
+ */
+int test_index(void) {
+  static const char *items[] = {
+      "\"a\\\\\\\"b\"", "\"\\\\\"", "true", "-12", "null",
+      "{ \"k\" : [ ] }", "\"c d\\u00e9\"", "2.5",
+  };
+  JsonDocument *doc;
+  JsonVariant *old;
+  char *text;
+  size_t i, n, size = 64 * 1024;
+  int r;
+
+  text = malloc(size);
+  if (!text)
+    return -ENOMEM;
+
+  n = sprintf(text, "{ \"items\": [");
+  for (i = 0; n < size - 256; ++i)
+    n += sprintf(text + n, "%s%*s%s", i ? "," : "", (int)(i % 67), "",
+                 items[i % COUNT(items)]);
+  n += sprintf(text + n, "] }");
+
+  r = json_document_parse(text, n, &doc);
+  if (r < 0)
+    goto out;
+
+  r = json_parse(text, n, &old);
+  if (r < 0) {
+    (void)json_document_unref(doc);
+    goto out;
+  }
+
+  r = same_variant(&doc->root, old) ? 0 : -1;
+  (void)json_variant_unref(old);
+  (void)json_document_unref(doc);
+  if (r < 0)
+    goto out;
+
+  /* an unterminated string and trailing garbage after a literal */
+  text[n - 3] = '"';
+  if (json_document_parse(text, n, &doc) >= 0)
+    r = -1;
+  memcpy(text + n - 3, ",truex] }", 9);
+  if (json_document_parse(text, n + 6, &doc) >= 0)
+    r = -1;
+
+out:
+  free((void *)text);
+  return r;
+}
+
+struct chunked {
+  const char *data;
+  size_t size, offset;
+};
+
+/* hands out at most three bytes per call to split every token */
+static ssize_t read_chunked(void *context, char *buffer, size_t size) {
+  struct chunked *c = (struct chunked *)context;
+  size_t n = MIN(MIN(size, (size_t)3), c->size - c->offset);
+
+  memcpy(buffer, c->data + c->offset, n);
+  c->offset += n;
+  return n;
+}
+
+int test_reader(void) {
+  static const char text[] =
+      " {\"a\": [1, 2.5, \"x\\ny\"], \"b\": {\"c\": null, \"d\": true},"
+      " \"long key that spans many chunks\": [], \"e\": false} ";
+  static const JsonEvent expected[] = {
+      JSON_EVENT_OBJECT_BEGIN, JSON_EVENT_KEY,          JSON_EVENT_ARRAY_BEGIN,
+      JSON_EVENT_INTEGER,      JSON_EVENT_REAL,         JSON_EVENT_STRING,
+      JSON_EVENT_ARRAY_END,    JSON_EVENT_KEY,          JSON_EVENT_OBJECT_BEGIN,
+      JSON_EVENT_KEY,          JSON_EVENT_NULL,         JSON_EVENT_KEY,
+      JSON_EVENT_BOOLEAN,      JSON_EVENT_OBJECT_END,   JSON_EVENT_KEY,
+      JSON_EVENT_ARRAY_BEGIN,  JSON_EVENT_ARRAY_END,    JSON_EVENT_KEY,
+      JSON_EVENT_BOOLEAN,      JSON_EVENT_OBJECT_END,   JSON_EVENT_END,
+  };
+  struct chunked source = {text, sizeof(text) - 1, 0};
+  FileResource fr = {(char *)text, sizeof(text) - 1, "memory"};
+  JsonReader *reader;
+  JsonEvent event;
+  size_t i;
+  int r;
+
+  r = json_reader_new(read_chunked, &source, &reader);
+  if (r < 0)
+    return r;
+
+  for (i = 0; i < COUNT(expected); ++i) {
+    r = json_reader_next(reader, &event);
+    if (r < 0 || event != expected[i])
+      break;
+    if (i == 3 && reader->value.integer != 1)
+      break;
+    if (i == 4 && reader->value.real != 2.5)
+      break;
+    if (i == 5 && strcmp(reader->string, "x\ny"))
+      break;
+    if (i == 14 && strcmp(reader->string, "long key that spans many chunks"))
+      break;
+  }
+  (void)json_reader_unref(reader);
+  if (i != COUNT(expected))
+    return -1;
+
+  /* skipping a key skips its whole value */
+  r = json_reader_new_resource(&fr, &reader);
+  if (r < 0)
+    return r;
+  if (json_reader_next(reader, &event) < 0 ||
+      json_reader_next(reader, &event) < 0 || event != JSON_EVENT_KEY ||
+      json_reader_skip(reader) < 0 || json_reader_next(reader, &event) < 0 ||
+      event != JSON_EVENT_KEY || strcmp(reader->string, "b"))
+    r = -1;
+  (void)json_reader_unref(reader);
+  if (r < 0)
+    return r;
+
+  for (i = 0; i < COUNT(invalid); ++i) {
+    fr.data = (char *)invalid[i];
+    fr.size = strlen(invalid[i]);
+    r = json_reader_new_resource(&fr, &reader);
+    if (r < 0)
+      return r;
+    do
+      r = json_reader_next(reader, &event);
+    while (r >= 0 && event != JSON_EVENT_END);
+    (void)json_reader_unref(reader);
+    if (r >= 0) {
+      output("   [!] reader accepted invalid document: %s", invalid[i]);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* documents far larger than the reader buffer are streamed from a file */
+int test_reader_fd(void) {
+  JsonReader *reader;
+  JsonEvent event;
+  intmax_t sum = 0, expected = 0;
+  FILE *f;
+  int i, r;
+
+  f = tmpfile();
+  if (!f)
+    return -errno;
+
+  fputs("[", f);
+  for (i = 0; i < 100000; ++i) {
+    fprintf(f, "%s{\"id\": %d, \"name\": \"item %d\", \"skip\": [1, [2], {}]}",
+            i ? ", " : "", i, i);
+    expected += i;
+  }
+  fputs("]", f);
+  fflush(f);
+  rewind(f);
+
+  r = json_reader_new_fd(fileno(f), &reader);
+  if (r < 0)
+    goto out;
+
+  while ((r = json_reader_next(reader, &event)) >= 0 && event != JSON_EVENT_END) {
+    if (event != JSON_EVENT_KEY)
+      continue;
+    if (!strcmp(reader->string, "id")) {
+      r = json_reader_next(reader, &event);
+      if (r < 0)
+        break;
+      sum += reader->value.integer;
+    } else if (!strcmp(reader->string, "skip")) {
+      r = json_reader_skip(reader);
+      if (r < 0)
+        break;
+    }
+  }
+
+  if (r >= 0 && (sum != expected || reader->allocated != JSON_READER_CHUNK))
+    r = -1;
+  (void)json_reader_unref(reader);
+
+out:
+  fclose(f);
+  return r;
+}
+
+/* deep nesting must be rejected instead of overflowing the stack */
+int test_depth(void) {
+  JsonDocument *doc;
+  char *deep;
+  size_t i, n;
+  int r;
+
+  n = 100000;
+  deep = malloc(n);
+  if (!deep)
+    return -ENOMEM;
+  for (i = 0; i < n; ++i)
+    deep[i] = i < n / 2 ? '[' : ']';
+
+  r = json_document_parse(deep, n, &doc);
+  free((void *)deep);
+
+  return r == -EBADMSG ? 0 : -1;
+}
+
+/* strings point into the source text instead of the arena */
+int test_insitu(void) {
+  JsonDocument *doc;
+  JsonVariant *v, *e;
+  const char *s;
+  char *text;
+  size_t n;
+  int r;
+
+  r = json_document_parse_view(effect, sizeof(effect) - 1, &doc);
+  if (r < 0)
+    return r;
+
+  v = &doc->root;
+  e = json_variant_value(json_variant_element(json_variant_value(v, "uniforms"), 0),
+                         "name");
+  s = json_variant_string_view(e, &n);
+  if (e->flags != (JSON_STRING_INSITU | JSON_STRING_UNTERMINATED) ||
+      s < effect || s >= effect + sizeof(effect) || n != 5 ||
+      memcmp(s, "u_mvp", n))
+    return -1;
+
+  /* escapes can't be decoded without touching the source, so copied */
+  e = json_variant_value(v, "name");
+  if (e->flags || strcmp(json_variant_string(e), "solid\tcolor \xc3\xa9\xf0\x9f\x98\x80"))
+    return -1;
+  (void)json_document_unref(doc);
+
+  text = (char *)memdup((void *)effect, sizeof(effect) - 1);
+  if (!text)
+    return -ENOMEM;
+
+  r = json_document_parse_insitu(text, sizeof(effect) - 1, &doc);
+  if (r < 0) {
+    free((void *)text);
+    return r;
+  }
+
+  v = &doc->root;
+  e = json_variant_value(v, "name");
+  s = json_variant_string(e);
+  if (e->flags != (JSON_STRING_INSITU | JSON_STRING_DECODED) || s < text ||
+      s >= text + sizeof(effect) ||
+      strcmp(s, "solid\tcolor \xc3\xa9\xf0\x9f\x98\x80"))
+    r = -1;
+
+  e = json_variant_value(json_variant_element(json_variant_value(v, "uniforms"), 1),
+                         "type");
+  if (e->flags != JSON_STRING_INSITU || strcmp(json_variant_string(e), "vec4"))
+    r = -1;
+
+  (void)json_document_unref(doc);
+  free((void *)text);
+
+  return r;
+}
+
+struct bind_uniform {
+  char *name;
+  int type;
+};
+
+struct bind_effect {
+  int version;
+  char *name;
+  double scale;
+  struct bind_uniform *uniforms;
+  size_t num_uniforms;
+};
+
+static const char *const bind_type_names[] = {"vec4", "mat4", NULL};
+static const int bind_type_values[] = {4, 16};
+static JsonEnum bind_types = {
+    .names = bind_type_names, .values = bind_type_values, .fold_case = true};
+
+static const JsonField bind_uniform_fields[] = {
+    {.key = "name",
+     .type = JSON_FIELD_STRING,
+     .offset = offsetof(struct bind_uniform, name),
+     .required = true},
+    {.key = "type",
+     .type = JSON_FIELD_ENUM,
+     .offset = offsetof(struct bind_uniform, type),
+     .required = true,
+     .names = &bind_types},
+};
+static JsonSchema bind_uniform_schema = {
+    .fields = bind_uniform_fields,
+    .num_fields = COUNT(bind_uniform_fields),
+    .size = sizeof(struct bind_uniform)};
+
+static const JsonField bind_effect_fields[] = {
+    {.key = "version",
+     .type = JSON_FIELD_INT,
+     .offset = offsetof(struct bind_effect, version),
+     .required = true},
+    {.key = "name",
+     .type = JSON_FIELD_STRING,
+     .offset = offsetof(struct bind_effect, name),
+     .required = true},
+    {.key = "scale",
+     .type = JSON_FIELD_REAL,
+     .offset = offsetof(struct bind_effect, scale)},
+    {.key = "uniforms",
+     .type = JSON_FIELD_ARRAY,
+     .offset = offsetof(struct bind_effect, uniforms),
+     .required = true,
+     .schema = &bind_uniform_schema,
+     .count_offset = offsetof(struct bind_effect, num_uniforms)},
+};
+static JsonSchema bind_effect_schema = {
+    .fields = bind_effect_fields,
+    .num_fields = COUNT(bind_effect_fields),
+    .size = sizeof(struct bind_effect)};
+
+/* declarative decoding into structs */
+int test_bind(void) {
+  static const char *broken[] = {
+      "{\"version\": 1, \"name\": \"a\"}",
+      "{\"version\": \"1\", \"name\": \"a\", \"uniforms\": []}",
+      "{\"version\": 1, \"name\": \"a\", \"uniforms\": "
+      "[{\"name\": \"b\", \"type\": \"mat4\"}, "
+      "{\"name\": \"c\", \"type\": \"mat5\"}]}",
+  };
+  struct bind_effect e = {0};
+  JsonDocument *doc;
+  size_t i;
+  int r, value;
+
+  if (json_enum_lookup(&bind_types, "MaT4", 4, &value) < 0 || value != 16 ||
+      json_enum_lookup(&bind_types, "vec4s", 4, &value) < 0 || value != 4 ||
+      json_enum_lookup(&bind_types, "vec", 3, &value) != -ENOENT)
+    return -1;
+
+  r = json_document_parse_view(effect, sizeof(effect) - 1, &doc);
+  if (r < 0)
+    return r;
+
+  r = json_bind(&bind_effect_schema, &doc->root, &e);
+  (void)json_document_unref(doc);
+  if (r < 0)
+    return r;
+
+  if (e.version != 1 || e.scale != -25.0 || e.num_uniforms != 2 ||
+      strcmp(e.uniforms[0].name, "u_mvp") || e.uniforms[0].type != 16 ||
+      strcmp(e.uniforms[1].name, "u_color") || e.uniforms[1].type != 4)
+    r = -1;
+  json_bind_free(&bind_effect_schema, &e);
+  if (r < 0 || e.name || e.uniforms)
+    return -1;
+
+  for (i = 0; i < COUNT(broken); ++i) {
+    r = json_document_parse(broken[i], strlen(broken[i]), &doc);
+    if (r < 0)
+      return r;
+    r = json_bind(&bind_effect_schema, &doc->root, &e);
+    (void)json_document_unref(doc);
+    if (r != -EINVAL || e.name || e.uniforms)
+      return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, const char *argv[]) {
+  int r;
+
+  output1("[!] " PRD_HEADER " - json test");
+
+  r = test_document();
+  output(" [+] arena document parse: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_insitu();
+  output(" [+] in-situ string views: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_numbers();
+  output(" [+] number conversion: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_key_index();
+  output(" [+] hashed key index: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_index();
+  output(" [+] structural index: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_reader();
+  output(" [+] streaming reader: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_reader_fd();
+  output(" [+] streaming reader from a file: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_bind();
+  output(" [+] schema binding: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_depth();
+  output(" [+] nesting limit: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  return 0;
+}
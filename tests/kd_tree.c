@@ -1,7 +1,716 @@
 #include <tests/common.h>
 #include <prt/shared/kd_tree.h>
+#include <prt/shared/kd_treef.h>
 
 #define AS_STRING(r) (r == 0 ? "OK" : "FAILED")
+#define BUILD_POINTS 20000
+#define SQUARE(x) ((x) * (x))
+#define FLOAT_POINTS 5000
+#define FOREST_POINTS 3000
+
+static size_t tree_depth(KdNode *n) {
+  if (!n)
+    return 0;
+  return 1 + MAX(tree_depth(n->left), tree_depth(n->right));
+}
+
+static size_t brute_nearest(const double *points, size_t n, const double *p) {
+  double best = INFINITY, d;
+  size_t i, found = 0;
+
+  for (i = 0; i < n; ++i) {
+    d = SQUARE(points[i * 3] - p[0]) + SQUARE(points[i * 3 + 1] - p[1]) +
+        SQUARE(points[i * 3 + 2] - p[2]);
+    if (d < best) {
+      best = d;
+      found = i;
+    }
+  }
+
+  return found;
+}
+
+#define KNN 16
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* compares k best squared distances against a full sort */
+static int check_knn(const double *points, const double *q,
+                     const double *dist2, int found) {
+  static double all[BUILD_POINTS];
+  size_t i;
+
+  if (found != KNN)
+    return -1;
+
+  for (i = 0; i < BUILD_POINTS; ++i)
+    all[i] = SQUARE(points[i * 3] - q[0]) + SQUARE(points[i * 3 + 1] - q[1]) +
+             SQUARE(points[i * 3 + 2] - q[2]);
+  qsort(all, BUILD_POINTS, sizeof(double), cmp_double);
+
+  for (i = 0; i < KNN; ++i)
+    if (all[i] != dist2[i])
+      return -1;
+
+  return 0;
+}
+
+int test_knn(KdTree *tree, KdFlatTree *flat, const double *points) {
+  void *items[KNN];
+  double q[3], dist2[KNN];
+  size_t i;
+  int r;
+
+  for (i = 0; i < 50; ++i) {
+    q[0] = (i * 7901) % BUILD_POINTS + 0.25;
+    q[1] = (i * 41) % 100 - 0.5;
+    q[2] = (i * 11) % 20 + 0.7;
+
+    r = kd_tree_knn(tree, q, KNN, items, dist2);
+    if (check_knn(points, q, dist2, r) < 0)
+      return -1;
+
+    r = kd_flat_tree_knn(flat, q, KNN, items, dist2);
+    if (check_knn(points, q, dist2, r) < 0)
+      return -1;
+  }
+
+  /* k == 0 is a valid empty query */
+  r = kd_tree_knn3(tree, 0.0, 0.0, 0.0, 0, items, dist2);
+  if (r != 0)
+    return -1;
+
+  return 0;
+}
+
+/* approximate answers stay within (1 + epsilon) of the exact ones */
+int test_approx(KdTree *tree, KdFlatTree *flat) {
+  KdSearchParams params = {0.5, 0};
+  void *items[KNN], *item;
+  double q[3], exact[KNN], dist2[KNN], distance;
+  size_t i, j;
+  int r;
+
+  for (i = 0; i < 50; ++i) {
+    q[0] = (i * 7901) % BUILD_POINTS + 0.25;
+    q[1] = (i * 41) % 100 - 0.5;
+    q[2] = (i * 11) % 20 + 0.7;
+
+    r = kd_tree_knn(tree, q, KNN, items, exact);
+    if (r != KNN)
+      return -1;
+
+    params.max_visits = 0;
+    r = kd_flat_tree_knn_approx(flat, q, KNN, &params, items, dist2);
+    if (r != KNN)
+      return -1;
+    for (j = 0; j < KNN; ++j)
+      if (dist2[j] < exact[j] || dist2[j] > SQUARE(1.5) * exact[j])
+        return -1;
+
+    /* a budget still yields the best candidates seen so far */
+    params.max_visits = 8;
+    r = kd_tree_nearest_approx(tree, q, &params, &item, &distance);
+    if (r < 0 || distance < exact[0])
+      return -1;
+  }
+
+  return 0;
+}
+
+#define BATCH 3000
+
+int test_batch(KdTree *tree) {
+  ThreadPool *pool;
+  void **items, *single[KNN];
+  double *queries, *dist2, sdist2[KNN];
+  size_t i, j;
+  int r, flags;
+
+  queries = calloc(BATCH * 3, sizeof(double));
+  items = calloc(BATCH * KNN, sizeof(void *));
+  dist2 = calloc(BATCH * KNN, sizeof(double));
+  if (!queries || !items || !dist2)
+    return -ENOMEM;
+
+  for (i = 0; i < BATCH; ++i) {
+    queries[i * 3 + 0] = (i * 7877) % BUILD_POINTS + 0.1;
+    queries[i * 3 + 1] = (i * 43) % 100 + 0.6;
+    queries[i * 3 + 2] = (i * 19) % 20 - 0.2;
+  }
+
+  r = thread_pool_new(4, &pool);
+  if (r < 0)
+    return r;
+
+  for (flags = KD_BATCH_NONE; flags <= KD_BATCH_MORTON; ++flags) {
+    memset(items, 0, BATCH * KNN * sizeof(void *));
+
+    r = kd_tree_query_batch(tree, pool, queries, BATCH, KNN, items, dist2,
+                            flags);
+    if (r < 0)
+      return r;
+
+    for (i = 0; i < BATCH; ++i) {
+      r = kd_tree_knn(tree, &queries[i * 3], KNN, single, sdist2);
+      if (r != KNN)
+        return -1;
+      for (j = 0; j < KNN; ++j)
+        if (sdist2[j] != dist2[i * KNN + j])
+          return -1;
+    }
+  }
+
+  (void)thread_pool_unref(pool);
+  free((void *)queries);
+  free((void *)items);
+  free((void *)dist2);
+
+  return 0;
+}
+
+int test_flat(const double *points, void **data) {
+  KdFlatTree *flat;
+  double q[3], distance;
+  void *item;
+  size_t i, expected;
+  int r;
+
+  r = kd_flat_tree_build(3, points, data, BUILD_POINTS, &flat);
+  output("  [+] flat build of %d points: %s", BUILD_POINTS, AS_STRING(r));
+  if (r < 0)
+    return r;
+
+  /* the root is laid out first */
+  if (KD_FLAT_NODE(flat, 0)->left == 0 || KD_FLAT_NODE(flat, 0)->right == 0)
+    return -1;
+
+  for (i = 0; i < 1000; ++i) {
+    q[0] = (i * 7907) % BUILD_POINTS - 0.4;
+    q[1] = (i * 37) % 100 + 0.45;
+    q[2] = (i * 17) % 20 - 0.3;
+    expected = brute_nearest(points, BUILD_POINTS, q);
+
+    r = kd_flat_tree_nearest(flat, q, &item, &distance);
+    if (r < 0)
+      return r;
+
+    if (PTR_TO_ULONG(item) != expected) {
+      output("   [!] flat nearest mismatch: %zu != %zu", PTR_TO_ULONG(item),
+             expected);
+      return -1;
+    }
+  }
+  output1("  [+] flat nearest matches brute force: OK");
+
+  return kd_flat_tree_unref(flat);
+}
+
+static float brute_nearestf(const float *points, size_t n, int dimension,
+                            const float *p) {
+  float best = INFINITY, d;
+  size_t i;
+  int j;
+
+  for (i = 0; i < n; ++i) {
+    d = 0.0f;
+    for (j = 0; j < dimension; ++j)
+      d += SQUARE(points[i * dimension + j] - p[j]);
+    if (d < best)
+      best = d;
+  }
+
+  return best;
+}
+
+/* runs once per distance kernel: specialized 2, 3, 4 and the generic one */
+static int test_float_dimension(float *points, int dimension) {
+  KdTreef *tree;
+  void *item, *knn_data[KNN];
+  float q[5], distance, expected, knn_dist[KNN];
+  size_t i;
+  int j, r;
+
+  for (i = 0; i < FLOAT_POINTS * (size_t)dimension; ++i)
+    points[i] = (float)((i * 7919) % 1009) * 0.25f;
+
+  r = kd_treef_build(dimension, points, NULL, FLOAT_POINTS, &tree);
+  if (r < 0)
+    return r;
+
+  for (i = 0; i < 500; ++i) {
+    for (j = 0; j < dimension; ++j)
+      q[j] = (float)((i * 31 + j * 17) % 1009) * 0.25f + 0.1f;
+    expected = brute_nearestf(points, FLOAT_POINTS, dimension, q);
+
+    r = kd_treef_nearest(tree, q, &item, &distance);
+    if (r < 0)
+      return r;
+    if (fabsf(distance - expected) > 1e-3f * (expected + 1.0f)) {
+      output("   [!] %dd float nearest mismatch: %f != %f", dimension,
+             distance, expected);
+      return -1;
+    }
+
+    r = kd_treef_knn(tree, q, KNN, knn_data, knn_dist);
+    if (r != KNN || fabsf(knn_dist[0] - expected) > 1e-3f * (expected + 1.0f))
+      return -1;
+    for (j = 1; j < KNN; ++j)
+      if (knn_dist[j] < knn_dist[j - 1])
+        return -1;
+  }
+
+  return kd_treef_unref(tree);
+}
+
+int test_float(void) {
+  float *points;
+  int dimension, r;
+
+  points = calloc(FLOAT_POINTS * 5, sizeof(float));
+  if (!points)
+    return -ENOMEM;
+
+  r = 0;
+  for (dimension = 2; dimension <= 5 && r == 0; ++dimension)
+    r = test_float_dimension(points, dimension);
+
+  free((void *)points);
+  return r;
+}
+
+static bool in_planes(const double *planes, size_t n, const double *p) {
+  size_t i;
+
+  for (i = 0; i < n; ++i)
+    if (planes[i * 4] * p[0] + planes[i * 4 + 1] * p[1] +
+            planes[i * 4 + 2] * p[2] + planes[i * 4 + 3] <
+        0.0)
+      return false;
+  return true;
+}
+
+/* compares box and polytope results against a linear scan */
+int test_regions(KdTree *tree, const double *points) {
+  const double min[3] = {1000.5, 10.0, 0.0}, max[3] = {6000.0, 60.5, 4.0};
+  /* box 2000..9000 x 0..50 x 2..15 cut by the oblique plane x + 100y <= 8000 */
+  const double planes[] = {1,  0, 0, -2000, -1, 0,    0, 9000, 0, 1, 0,  0,
+                           0, -1, 0, 50,    0,  0,    1, -2,   0, 0, -1, 15,
+                           -1, -100, 0, 8000};
+  KdIterator *iterator;
+  double p[3];
+  void *item;
+  size_t i, expected, found, size;
+  int pass, r;
+
+  for (pass = 0; pass < 2; ++pass) {
+    expected = 0;
+    for (i = 0; i < BUILD_POINTS; ++i) {
+      if (pass == 0 && points[i * 3] >= min[0] && points[i * 3] <= max[0] &&
+          points[i * 3 + 1] >= min[1] && points[i * 3 + 1] <= max[1] &&
+          points[i * 3 + 2] >= min[2] && points[i * 3 + 2] <= max[2])
+        expected++;
+      if (pass == 1 && in_planes(planes, 7, &points[i * 3]))
+        expected++;
+    }
+
+    r = pass == 0 ? kd_tree_box(tree, min, max, &iterator)
+                  : kd_tree_polytope(tree, planes, 7, &iterator);
+    if (r < 0)
+      return r;
+
+    found = 0;
+    while (kd_iterator_item(iterator, p, &item) == 0) {
+      if (pass == 1 && !in_planes(planes, 7, p))
+        break;
+      found++;
+      kd_iterator_next(iterator);
+    }
+    size = iterator->size;
+    (void)kd_iterator_free(iterator);
+
+    if (found != expected || size != expected) {
+      output("   [!] region %d: %zu found, %zu expected", pass, found,
+             expected);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* the second round reuses the buffer of the first one */
+int test_result_buffer(KdTree *tree) {
+  const double min[3] = {100.0, 0.0, 0.0}, max[3] = {3000.0, 50.0, 2.0};
+  Array results = {0};
+  KdIterator *iterator;
+  KdResult *result;
+  double q[3] = {500.0, 20.0, 0.0};
+  uint8_t *items;
+  size_t capacity, i;
+  int round, found, r;
+
+  r = kd_tree_nearest_range(tree, q, 30.0, &iterator);
+  if (r < 0)
+    return r;
+  found = (int)iterator->size;
+  (void)kd_iterator_free(iterator);
+
+  items = NULL;
+  capacity = 0;
+  for (round = 0; round < 2; ++round) {
+    (void)array_clear(&results);
+
+    r = kd_tree_nearest_range_into(tree, q, 30.0, &results);
+    if (r != found)
+      return -1;
+    for (i = 0; i < (size_t)r; ++i) {
+      result = ARRAY_GET(&results, i, KdResult);
+      if (result->distance_squared > SQUARE(30.0) ||
+          result->data != result->node->data)
+        return -1;
+    }
+
+    r = kd_tree_box_into(tree, min, max, &results);
+    if (r <= 0)
+      return -1;
+
+    if (round == 1 && (results.items != items || results.capacity != capacity))
+      return -1;
+    items = results.items;
+    capacity = results.capacity;
+  }
+
+  free((void *)results.items);
+  return 0;
+}
+
+/* matches of the near side count when the far side of a split is pruned */
+int test_range_pruned(void) {
+  static const double points[][2] = {
+      {0.0, 0.0}, {-1.0, 0.0}, {1.0, 0.0}, {-1.5, 0.2}, {2.0, 0.0}};
+  const double q[2] = {-1.0, 0.0};
+  Array results = {0};
+  KdIterator *iterator;
+  KdTree *tree;
+  size_t i, n;
+  int r;
+
+  r = kd_tree_new(2, &tree);
+  if (r < 0)
+    return r;
+  for (i = 0; i < COUNT(points) && r == 0; ++i)
+    r = kd_tree_insert(tree, points[i], ULONG_TO_PTR(i + 1));
+
+  /* (-1, 0) and (-1.5, 0.2), the root splits at x = 0 beyond the radius */
+  if (r == 0) {
+    r = kd_tree_nearest_range_into(tree, q, 0.75, &results);
+    if (r != 2 || results.occupied != 2 * sizeof(KdResult))
+      r = -1;
+  }
+
+  if (r >= 0) {
+    r = kd_tree_nearest_range(tree, q, 0.75, &iterator);
+    if (r == 0) {
+      n = 0;
+      if (iterator->size)
+        do
+          ++n;
+        while (kd_iterator_next(iterator));
+      if (iterator->size != 2 || n != 2)
+        r = -1;
+      (void)kd_iterator_free(iterator);
+    }
+  }
+
+  free((void *)results.items);
+  (void)kd_tree_unref(tree);
+  return r < 0 ? r : 0;
+}
+
+static size_t count_live(const KdNode *n) {
+  if (!n)
+    return 0;
+  return !n->deleted + count_live(n->left) + count_live(n->right);
+}
+
+/* removes every third point, moves some, then empties the tree */
+int test_remove(const double *points) {
+  KdTree *tree;
+  KdIterator *iterator;
+  double q[3], best, d, moved[3];
+  void *item;
+  size_t i, j, expected;
+  int r;
+
+  r = kd_tree_new(3, &tree);
+  if (r < 0)
+    return r;
+  for (i = 0; i < FOREST_POINTS; ++i)
+    (void)kd_tree_insert(tree, &points[((i * 1237) % FOREST_POINTS) * 3],
+                         ULONG_TO_PTR((i * 1237) % FOREST_POINTS));
+
+  for (i = 0; i < FOREST_POINTS; i += 3) {
+    r = kd_tree_remove(tree, &points[i * 3], ULONG_TO_PTR(i));
+    if (r < 0)
+      return r;
+  }
+  if (kd_tree_remove(tree, &points[0], ULONG_TO_PTR(0)) != -ENOENT)
+    return -1;
+
+  /* counts stay exact and no subtree keeps too many dead nodes */
+  if (count_live(tree->root) != FOREST_POINTS - (FOREST_POINTS + 2) / 3 ||
+      tree->root->size - tree->root->dead != count_live(tree->root) ||
+      tree->root->dead > tree->root->size * KD_REBUILD_DEAD_RATIO)
+    return -1;
+
+  /* moving a point is a remove and an insert */
+  moved[0] = -10.0;
+  moved[1] = -10.0;
+  moved[2] = -10.0;
+  /* both position and data have to match */
+  if (kd_tree_remove(tree, &points[1 * 3], ULONG_TO_PTR(2)) != -ENOENT)
+    return -1;
+  r = kd_tree_remove(tree, &points[1 * 3], ULONG_TO_PTR(1));
+  if (r < 0)
+    return r;
+  r = kd_tree_insert(tree, moved, ULONG_TO_PTR(1));
+  if (r < 0)
+    return r;
+
+  for (i = 0; i < 200; ++i) {
+    q[0] = (i * 7907) % FOREST_POINTS - 0.4;
+    q[1] = (i * 37) % 100 + 0.45;
+    q[2] = (i * 17) % 20 - 0.3;
+
+    best = SQUARE(moved[0] - q[0]) + SQUARE(moved[1] - q[1]) +
+           SQUARE(moved[2] - q[2]);
+    expected = 1;
+    for (j = 2; j < FOREST_POINTS; ++j) {
+      if (j % 3 == 0)
+        continue;
+      d = SQUARE(points[j * 3] - q[0]) + SQUARE(points[j * 3 + 1] - q[1]) +
+          SQUARE(points[j * 3 + 2] - q[2]);
+      if (d < best) {
+        best = d;
+        expected = j;
+      }
+    }
+
+    r = kd_tree_nearest(tree, q, &iterator);
+    if (r < 0)
+      return r;
+    (void)kd_iterator_data(iterator, &item);
+    (void)kd_iterator_free(iterator);
+    if (PTR_TO_ULONG(item) != expected) {
+      output("   [!] nearest after removal: %zu != %zu", PTR_TO_ULONG(item),
+             expected);
+      return -1;
+    }
+  }
+
+  for (i = 2; i < FOREST_POINTS; ++i) {
+    if (i % 3 == 0)
+      continue;
+    r = kd_tree_remove(tree, &points[i * 3], ULONG_TO_PTR(i));
+    if (r < 0)
+      return r;
+  }
+  r = kd_tree_remove(tree, moved, ULONG_TO_PTR(1));
+  if (r < 0 || tree->root)
+    return -1;
+  if (kd_tree_nearest(tree, q, &iterator) != -ENOENT)
+    return -1;
+
+  return kd_tree_unref(tree);
+}
+
+/* inserts in sorted order, then removes every third point */
+int test_forest(const double *points) {
+  KdForest *forest;
+  double q[3], distance, best, d;
+  void *item;
+  size_t i, j, expected;
+  int l, levels, r;
+
+  r = kd_forest_new(3, &forest);
+  if (r < 0)
+    return r;
+
+  for (i = 0; i < FOREST_POINTS; ++i) {
+    r = kd_forest_insert(forest, &points[i * 3], ULONG_TO_PTR(i));
+    if (r < 0)
+      return r;
+  }
+
+  /* one balanced tree per set bit of the point count */
+  levels = 0;
+  for (l = 0; l < KD_FOREST_LEVELS; ++l)
+    if (forest->trees[l])
+      levels++;
+  if (levels != __builtin_popcountl(FOREST_POINTS))
+    return -1;
+
+  for (i = 0; i < FOREST_POINTS; i += 3) {
+    r = kd_forest_remove(forest, &points[i * 3], ULONG_TO_PTR(i));
+    if (r < 0)
+      return r;
+  }
+  if (kd_forest_remove(forest, &points[0], ULONG_TO_PTR(0)) != -ENOENT)
+    return -1;
+  if (forest->size != FOREST_POINTS - (FOREST_POINTS + 2) / 3)
+    return -1;
+
+  for (i = 0; i < 300; ++i) {
+    q[0] = (i * 7907) % FOREST_POINTS - 0.4;
+    q[1] = (i * 37) % 100 + 0.45;
+    q[2] = (i * 17) % 20 - 0.3;
+
+    best = INFINITY;
+    expected = 0;
+    for (j = 1; j < FOREST_POINTS; j += (j % 3 == 1) ? 1 : 2) {
+      d = SQUARE(points[j * 3] - q[0]) + SQUARE(points[j * 3 + 1] - q[1]) +
+          SQUARE(points[j * 3 + 2] - q[2]);
+      if (d < best) {
+        best = d;
+        expected = j;
+      }
+    }
+
+    r = kd_forest_nearest(forest, q, &item, &distance);
+    if (r < 0)
+      return r;
+    if (PTR_TO_ULONG(item) != expected) {
+      output("   [!] forest nearest mismatch: %zu != %zu", PTR_TO_ULONG(item),
+             expected);
+      return -1;
+    }
+  }
+
+  /* dead points outnumbering live ones trigger a full rebuild */
+  for (i = 1; i < FOREST_POINTS; i += 3) {
+    r = kd_forest_remove(forest, &points[i * 3], ULONG_TO_PTR(i));
+    if (r < 0)
+      return r;
+  }
+  if (forest->dead >= forest->size || forest->size != FOREST_POINTS / 3)
+    return -1;
+
+  r = kd_forest_nearest(forest, q, &item, &distance);
+  if (r < 0 || PTR_TO_ULONG(item) % 3 != 2)
+    return -1;
+
+  return kd_forest_unref(forest);
+}
+
+/* sorted input used to degrade `kd_tree_insert` into a list */
+int test_build(void) {
+  KdFlatTree *flat;
+  KdTree *tree;
+  KdIterator *iterator;
+  double *points, q[3];
+  void **data, *item;
+  size_t i, expected;
+  int r;
+
+  points = calloc(BUILD_POINTS * 3, sizeof(double));
+  data = calloc(BUILD_POINTS, sizeof(void *));
+  if (!points || !data)
+    return -ENOMEM;
+
+  for (i = 0; i < BUILD_POINTS; ++i) {
+    points[i * 3 + 0] = (double)i;
+    points[i * 3 + 1] = (double)(i % 100);
+    points[i * 3 + 2] = (double)(i / 1000);
+    data[i] = ULONG_TO_PTR(i);
+  }
+
+  r = kd_tree_build(3, points, data, BUILD_POINTS, &tree);
+  output("  [+] balanced build of %d points: %s", BUILD_POINTS, AS_STRING(r));
+  if (r < 0)
+    return r;
+
+  output("   [>] depth: %zu", tree_depth(tree->root));
+  if (tree_depth(tree->root) != 15)
+    return -1;
+
+  for (i = 0; i < 100; ++i) {
+    q[0] = (i * 7919) % BUILD_POINTS + 0.3;
+    q[1] = (i * 31) % 100 - 0.2;
+    q[2] = (i * 13) % 20 + 0.1;
+    expected = brute_nearest(points, BUILD_POINTS, q);
+
+    r = kd_tree_nearest(tree, q, &iterator);
+    if (r < 0)
+      return r;
+    (void)kd_iterator_data(iterator, &item);
+    (void)kd_iterator_free(iterator);
+
+    if (PTR_TO_ULONG(item) != expected) {
+      output("   [!] nearest mismatch: %zu != %zu", PTR_TO_ULONG(item),
+             expected);
+      return -1;
+    }
+  }
+  output1("  [+] nearest on built tree matches brute force: OK");
+
+  r = test_flat(points, data);
+  if (r < 0)
+    return r;
+
+  r = kd_flat_tree_build(3, points, data, BUILD_POINTS, &flat);
+  if (r < 0)
+    return r;
+
+  r = test_knn(tree, flat, points);
+  output("  [+] %d nearest neighbours match brute force: %s", KNN,
+         AS_STRING(r));
+  if (r == 0) {
+    r = test_approx(tree, flat);
+    output("  [+] approximate neighbours within bounds: %s", AS_STRING(r));
+  }
+  (void)kd_flat_tree_unref(flat);
+  if (r < 0)
+    return r;
+
+  r = test_batch(tree);
+  output("  [+] batched queries on a thread pool: %s", AS_STRING(r));
+  if (r < 0)
+    return r;
+
+  r = test_regions(tree, points);
+  output("  [+] box and polytope queries: %s", AS_STRING(r));
+  if (r < 0)
+    return r;
+
+  r = test_result_buffer(tree);
+  output("  [+] queries into a reused result buffer: %s", AS_STRING(r));
+  if (r < 0)
+    return r;
+
+  r = test_remove(points);
+  output("  [+] removal with subtree rebuilds: %s", AS_STRING(r));
+  if (r < 0)
+    return r;
+
+  r = test_forest(points);
+  output("  [+] dynamic forest with removals: %s", AS_STRING(r));
+  if (r < 0)
+    return r;
+
+  r = test_float();
+  output("  [+] float bucket tree matches brute force: %s", AS_STRING(r));
+  if (r < 0)
+    return r;
+
+  free((void *)points);
+  free((void *)data);
+
+  return kd_tree_unref(tree);
+}
 
 int main(int argc, const char *argv[]) {
   size_t c;
@@ -54,5 +763,14 @@ int main(int argc, const char *argv[]) {
   r = kd_iterator_free(iterator);
   output("  [+] iterator free: %s", AS_STRING(r));
 
+  r = test_build();
+  if (r < 0)
+    return r;
+
+  r = test_range_pruned();
+  output(" [+] range search with the far side pruned: %s", AS_STRING(r));
+  if (r < 0)
+    return r;
+
   return 0;
 }
@@ -0,0 +1,528 @@
+#include <tests/common.h>
+#include <prt/runtime/resource_manager.h>
+
+#define AS_STRING(r) (r == 0 ? "OK" : "FAILED")
+
+#define NUM_FILES 2000
+
+struct load {
+  char path[32];
+  WaitHandle wh;
+  size_t index;
+  int result;
+};
+
+static char dir[] = "/tmp/prt-resourcesXXXXXX";
+static struct load loads[NUM_FILES];
+static size_t num_callbacks;
+static pthread_t main_thread;
+
+/* checks every resource of a batch, the last path is missing */
+static void _batch_loaded(FileResource **resources, size_t count,
+                          void *context) {
+  int *result = (int *)context;
+  char expected[32];
+  size_t i;
+  int n;
+
+  *result = count == NUM_FILES + 2 && !resources[NUM_FILES + 1] &&
+                    !pthread_equal(pthread_self(), main_thread)
+                ? 0
+                : -1;
+  for (i = 0; i < NUM_FILES && *result == 0; ++i) {
+    n = snprintf(expected, sizeof(expected), "resource %zu", i);
+    if (!resources[i] || resources[i]->size != (size_t)n ||
+        memcmp(resources[i]->data, expected, n))
+      *result = -1;
+  }
+  if (*result == 0 && (!resources[NUM_FILES] ||
+                       resources[NUM_FILES]->size != 2 * PRT_MAP_THRESHOLD ||
+                       !resources[NUM_FILES]->mapped))
+    *result = -1;
+  __sync_fetch_and_add(&num_callbacks, 1);
+}
+
+#define NUM_SAME 256
+
+struct same {
+  WaitHandle wh;
+  FileResource *fr;
+};
+
+static struct same same[NUM_SAME];
+
+static void _same_loaded(FileResource *fr, void *context) {
+  ((struct same *)context)->fr = fr;
+}
+
+/* every resource of the batch must be the same one */
+static void _same_batch_loaded(FileResource **resources, size_t count,
+                               void *context) {
+  FileResource **out = (FileResource **)context;
+  size_t i;
+
+  *out = resources[0];
+  for (i = 1; i < count; ++i)
+    if (resources[i] != resources[0])
+      *out = NULL;
+}
+
+static void _loaded(FileResource *fr, void *context) {
+  struct load *load = (struct load *)context;
+  char expected[32];
+  int n;
+
+  n = snprintf(expected, sizeof(expected), "resource %zu", load->index);
+  load->result = fr && fr->size == (size_t)n && !memcmp(fr->data, expected, n)
+                     ? 0
+                     : -1;
+  __sync_fetch_and_add(&num_callbacks, 1);
+}
+
+static int create_files(void) {
+  char path[64];
+  FILE *fd;
+  size_t i;
+
+  if (!mkdtemp(dir))
+    return -errno;
+
+  for (i = 0; i < NUM_FILES; ++i) {
+    snprintf(loads[i].path, sizeof(loads[i].path), "%zu.txt", i);
+    snprintf(path, sizeof(path), "%s/%s", dir, loads[i].path);
+    fd = fopen(path, "wb");
+    if (!fd)
+      return -EIO;
+    fprintf(fd, "resource %zu", i);
+    fclose(fd);
+    loads[i].index = i;
+    loads[i].result = -1;
+  }
+
+  return 0;
+}
+
+static void remove_files(void) {
+  char path[64];
+  size_t i;
+
+  for (i = 0; i < NUM_FILES; ++i) {
+    snprintf(path, sizeof(path), "%s/%s", dir, loads[i].path);
+    unlink(path);
+  }
+  rmdir(dir);
+}
+
+/* large files are mapped, small and empty ones read in one go */
+int test_file_resource(void) {
+  static const size_t sizes[] = {0, 100, PRT_MAP_THRESHOLD - 1,
+                                 PRT_MAP_THRESHOLD, 3 * PRT_MAP_THRESHOLD + 7};
+  FileResource *fr;
+  char path[64];
+  FILE *fd;
+  size_t i, j;
+  int r = 0;
+
+  snprintf(path, sizeof(path), "%s/large.bin", dir);
+
+  for (i = 0; i < COUNT(sizes) && r == 0; ++i) {
+    fd = fopen(path, "wb");
+    if (!fd)
+      return -EIO;
+    for (j = 0; j < sizes[i]; ++j)
+      fputc((int)(j * 31 % 251), fd);
+    fclose(fd);
+
+    r = file_resource_new(path, &fr);
+    if (r < 0)
+      break;
+
+    if (fr->size != sizes[i] || fr->mapped != (sizes[i] >= PRT_MAP_THRESHOLD))
+      r = -1;
+    for (j = 0; j < fr->size && r == 0; ++j)
+      if ((uint8_t)fr->data[j] != j * 31 % 251)
+        r = -1;
+
+    (void)file_resource_unref(fr);
+  }
+
+  unlink(path);
+  return r;
+}
+
+/* many more loads than workers, every callback and handle fires once */
+int test_async(ResourceManager *rm) {
+  FileResource *fr;
+  size_t i;
+  int r;
+
+  for (i = 0; i < NUM_FILES; ++i) {
+    r = resource_manager_load_async(rm, loads[i].path, _loaded, &loads[i],
+                                    &loads[i].wh);
+    if (r < 0)
+      return r;
+  }
+
+  for (i = 0; i < NUM_FILES; ++i) {
+    waithandle_wait(&loads[i].wh);
+    waithandle_unref(&loads[i].wh);
+    if (loads[i].result < 0)
+      return -1;
+  }
+
+  if (num_callbacks != NUM_FILES || rm->workers->num_threads != 4)
+    return -1;
+
+  /* loaded resources are cached */
+  r = resource_manager_load(rm, loads[7].path, &fr);
+  if (r < 0 || fr->size != strlen("resource 7"))
+    return -1;
+
+  return 0;
+}
+
+/* one batch of cached, new, mapped and missing files, then a fully cached
+ * one which still completes off the calling thread
+ */
+int test_batch(ResourceManager *rm) {
+  const char *paths[NUM_FILES + 2];
+  char large[64];
+  FileResource *fr;
+  WaitHandle wh;
+  FILE *fd;
+  size_t i, reads;
+  int r, result = -1;
+
+  snprintf(large, sizeof(large), "%s/large.bin", dir);
+  fd = fopen(large, "wb");
+  if (!fd)
+    return -EIO;
+  for (i = 0; i < 2 * PRT_MAP_THRESHOLD; ++i)
+    fputc('x', fd);
+  fclose(fd);
+
+  for (i = 0; i < NUM_FILES; ++i)
+    paths[i] = loads[i].path;
+  paths[NUM_FILES] = "large.bin";
+  paths[NUM_FILES + 1] = "missing.txt";
+
+  r = resource_manager_load(rm, loads[3].path, &fr);
+  if (r < 0)
+    goto out;
+
+  main_thread = pthread_self();
+  num_callbacks = 0;
+  reads = rm->num_reads;
+  r = resource_manager_load_batch(rm, paths, NUM_FILES + 2, _batch_loaded,
+                                  &result, &wh);
+  if (r < 0)
+    goto out;
+  waithandle_wait(&wh);
+  waithandle_unref(&wh);
+  r = result;
+  if (r < 0)
+    goto out;
+
+  /* every path but the cached one was read once */
+  if (rm->num_reads - reads != NUM_FILES + 1) {
+    r = -1;
+    goto out;
+  }
+
+  /* the batch filled the cache, only the missing file is tried again */
+  result = -1;
+  reads = rm->num_reads;
+  r = resource_manager_load_batch(rm, paths, NUM_FILES + 2, _batch_loaded,
+                                  &result, &wh);
+  if (r < 0)
+    goto out;
+  waithandle_wait(&wh);
+  waithandle_unref(&wh);
+  r = result;
+
+  if (r == 0 && (num_callbacks != 2 || rm->num_reads - reads != 1 ||
+                 resource_manager_load(rm, loads[11].path, &fr) < 0 ||
+                 fr->size != strlen("resource 11")))
+    r = -1;
+
+out:
+  unlink(large);
+  return r;
+}
+
+struct nested {
+  IoLoader *io;
+  WaitHandle outer;
+  WaitHandle inner;
+  char path[64];
+  int result;
+};
+
+static void _inner_loaded(FileResource *fr, int result, size_t index,
+                          void *context) {
+  struct nested *nested = (struct nested *)context;
+
+  nested->result = fr && fr->size == strlen("resource 1") ? 0 : -1;
+  if (fr)
+    (void)file_resource_unref(fr);
+  waithandle_signal(&nested->inner);
+}
+
+/* loads another file through the same ring and blocks until it's loaded */
+static void _outer_loaded(FileResource *fr, int result, size_t index,
+                          void *context) {
+  struct nested *nested = (struct nested *)context;
+  const char *path = nested->path;
+
+  nested->result = -1;
+  if (fr)
+    (void)file_resource_unref(fr);
+  if (result < 0 ||
+      io_loader_submit(nested->io, &path, 1, _inner_loaded, nested) < 0)
+    waithandle_signal(&nested->inner);
+  waithandle_wait(&nested->inner);
+  waithandle_signal(&nested->outer);
+}
+
+/* completions run on the pool, so they may wait for other loads of the
+ * ring that completed them
+ */
+int test_io_completions(void) {
+  struct nested nested;
+  ThreadPool *pool;
+  char path[64];
+  const char *p = path;
+  int r;
+
+  r = thread_pool_new(2, &pool);
+  if (r < 0)
+    return r;
+
+  r = io_loader_new(0, pool, &nested.io);
+  if (r == -ENOSYS) {
+    (void)thread_pool_unref(pool);
+    return 0;
+  }
+  if (r < 0) {
+    (void)thread_pool_unref(pool);
+    return r;
+  }
+
+  snprintf(path, sizeof(path), "%s/%s", dir, loads[0].path);
+  snprintf(nested.path, sizeof(nested.path), "%s/%s", dir, loads[1].path);
+  nested.result = -1;
+  waithandle_init(&nested.outer);
+  waithandle_init(&nested.inner);
+
+  r = io_loader_submit(nested.io, &p, 1, _outer_loaded, &nested);
+  if (r == 0)
+    waithandle_wait(&nested.outer);
+
+  (void)io_loader_unref(nested.io);
+  (void)thread_pool_unref(pool);
+  waithandle_unref(&nested.outer);
+  waithandle_unref(&nested.inner);
+
+  return r < 0 ? r : nested.result;
+}
+
+static void _proc_loaded(FileResource *fr, int result, size_t index,
+                         void *context) {
+  struct same *load = (struct same *)context;
+
+  load->fr = fr;
+  waithandle_signal(&load->wh);
+}
+
+/* files reporting a size of 0 but having contents, like those of procfs,
+ * are read up to EOF by both loaders
+ */
+int test_io_unsized(void) {
+  static const char *const paths[] = {"/proc/version"};
+  struct same load = {0};
+  FileResource *fr;
+  IoLoader *io;
+  int r;
+
+  if (access(paths[0], R_OK) < 0)
+    return 0;
+
+  r = io_loader_new(0, NULL, &io);
+  if (r == -ENOSYS)
+    return 0;
+  if (r < 0)
+    return r;
+
+  waithandle_init(&load.wh);
+  r = io_loader_submit(io, paths, 1, _proc_loaded, &load);
+  if (r == 0)
+    waithandle_wait(&load.wh);
+  (void)io_loader_unref(io);
+  waithandle_unref(&load.wh);
+  if (r < 0)
+    return r;
+
+  r = file_resource_new(paths[0], &fr);
+  if (r == 0) {
+    if (!load.fr || load.fr->size == 0 || load.fr->size != fr->size ||
+        memcmp(load.fr->data, fr->data, fr->size))
+      r = -1;
+    (void)file_resource_unref(fr);
+  }
+  if (load.fr)
+    (void)file_resource_unref(load.fr);
+
+  return r;
+}
+
+/* the cache keeps every resource while it grows, loading again hands out
+ * the same ones
+ */
+int test_reload(ResourceManager *rm) {
+  static FileResource *first[NUM_FILES];
+  FileResource *fr;
+  size_t i;
+  int r;
+
+  for (i = 0; i < NUM_FILES; ++i) {
+    r = resource_manager_load(rm, loads[i].path, &first[i]);
+    if (r < 0)
+      return r;
+  }
+
+  for (i = 0; i < NUM_FILES; ++i) {
+    r = resource_manager_load(rm, loads[i].path, &fr);
+    if (r < 0)
+      return r;
+    if (fr != first[i])
+      return -1;
+  }
+
+  return rm->num_reads == NUM_FILES ? 0 : -1;
+}
+
+/* concurrent asynchronous, batched and synchronous requests of one path
+ * share a single read and all receive the same resource
+ */
+int test_coalesce(ResourceManager *rm) {
+  const char *paths[NUM_SAME];
+  FileResource *fr, *batch_fr = NULL;
+  WaitHandle wh;
+  size_t i, reads;
+  int r;
+
+  for (i = 0; i < NUM_SAME; ++i)
+    paths[i] = loads[5].path;
+  reads = rm->num_reads;
+
+  for (i = 0; i < NUM_SAME; ++i) {
+    same[i].fr = NULL;
+    r = resource_manager_load_async(rm, loads[5].path, _same_loaded, &same[i],
+                                    &same[i].wh);
+    if (r < 0)
+      return r;
+  }
+
+  r = resource_manager_load_batch(rm, paths, NUM_SAME, _same_batch_loaded,
+                                  &batch_fr, &wh);
+  if (r < 0)
+    return r;
+
+  r = resource_manager_load(rm, loads[5].path, &fr);
+  if (r < 0)
+    return r;
+
+  waithandle_wait(&wh);
+  waithandle_unref(&wh);
+  for (i = 0; i < NUM_SAME; ++i) {
+    waithandle_wait(&same[i].wh);
+    waithandle_unref(&same[i].wh);
+    if (same[i].fr != fr)
+      r = -1;
+  }
+
+  /* the file was read by a single request */
+  if (r == 0 && (rm->num_reads - reads != 1 || batch_fr != fr || fr->size != strlen("resource 5") ||
+                 memcmp(fr->data, "resource 5", fr->size)))
+    r = -1;
+
+  return r;
+}
+
+int main(int argc, const char *argv[]) {
+  ResourceManager *rm;
+  int r;
+
+  output1("[!] " PRD_HEADER " - resource manager test");
+
+  r = create_files();
+  output(" [+] files created: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_file_resource();
+  output(" [+] mapped and read file resources: %s", AS_STRING(r));
+  if (r < 0) {
+    remove_files();
+    return 1;
+  }
+
+  r = resource_manager_new(dir, 4, &rm);
+  if (r == 0) {
+    r = test_async(rm);
+    (void)resource_manager_unref(rm);
+  }
+  output(" [+] asynchronous loads on 4 workers: %s", AS_STRING(r));
+  if (r < 0) {
+    remove_files();
+    return 1;
+  }
+
+  r = resource_manager_new(dir, 4, &rm);
+  if (r == 0) {
+    r = test_reload(rm);
+    (void)resource_manager_unref(rm);
+  }
+  output(" [+] cached resources reused: %s", AS_STRING(r));
+  if (r < 0) {
+    remove_files();
+    return 1;
+  }
+
+  r = resource_manager_new(dir, 4, &rm);
+  if (r == 0) {
+    r = test_batch(rm);
+    (void)resource_manager_unref(rm);
+  }
+  output(" [+] batched loads: %s", AS_STRING(r));
+  if (r < 0) {
+    remove_files();
+    return 1;
+  }
+
+  r = test_io_unsized();
+  output(" [+] io_uring loads of unsized files: %s", AS_STRING(r));
+  if (r < 0) {
+    remove_files();
+    return 1;
+  }
+
+  r = test_io_completions();
+  output(" [+] io_uring completions on the pool: %s", AS_STRING(r));
+  if (r < 0) {
+    remove_files();
+    return 1;
+  }
+
+  r = resource_manager_new(dir, 4, &rm);
+  if (r == 0) {
+    r = test_coalesce(rm);
+    (void)resource_manager_unref(rm);
+  }
+  output(" [+] coalesced loads of one path: %s", AS_STRING(r));
+  remove_files();
+  if (r < 0)
+    return 1;
+
+  return 0;
+}
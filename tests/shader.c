@@ -0,0 +1,395 @@
+#include <tests/common.h>
+#include <prt/graphics/shader.h>
+#include <prt/graphics/effect_cache.h>
+#include <dirent.h>
+#include <GLES3/gl31.h>
+
+#define AS_STRING(r) (r == 0 ? "OK" : "FAILED")
+
+/* the driver is stubbed, every object is a counter and every compilation
+ * succeeds, program binaries are rejected on demand
+ */
+#define MAX_OBJECTS 256
+#define BINARY_FORMAT 0x8741
+
+static const char binary[] = "\x01\x02\x00\x03 not really a program";
+static GLint linked[MAX_OBJECTS];
+static GLuint num_objects;
+static size_t num_compiles;
+static size_t num_binaries;
+static bool reject_binaries;
+/* changes when the driver is updated */
+static GLenum binary_format = BINARY_FORMAT;
+
+void glGetIntegerv(GLenum pname, GLint *data) {
+  *data = pname == GL_NUM_EXTENSIONS ? 1 : 0;
+}
+
+const GLubyte *glGetStringi(GLenum name, GLuint index) {
+  return (const GLubyte *)"GL_KHR_parallel_shader_compile";
+}
+
+GLuint glCreateShader(GLenum type) {
+  return num_objects < MAX_OBJECTS - 1 ? ++num_objects : 0;
+}
+
+void glShaderSource(GLuint shader, GLsizei count, const GLchar *const *string,
+                    const GLint *length) {}
+
+void glCompileShader(GLuint shader) { num_compiles++; }
+
+void glGetShaderiv(GLuint shader, GLenum pname, GLint *params) {
+  *params = pname == GL_COMPILE_STATUS ? GL_TRUE : 0;
+}
+
+void glGetShaderInfoLog(GLuint shader, GLsizei size, GLsizei *length,
+                        GLchar *log) {}
+
+void glDeleteShader(GLuint shader) {}
+
+GLuint glCreateProgram(void) {
+  if (num_objects >= MAX_OBJECTS - 1)
+    return 0;
+  linked[++num_objects] = GL_FALSE;
+  return num_objects;
+}
+
+void glAttachShader(GLuint program, GLuint shader) {}
+
+void glBindAttribLocation(GLuint program, GLuint index, const GLchar *name) {}
+
+void glProgramParameteri(GLuint program, GLenum pname, GLint value) {}
+
+void glLinkProgram(GLuint program) { linked[program] = GL_TRUE; }
+
+void glGetProgramiv(GLuint program, GLenum pname, GLint *params) {
+  switch (pname) {
+  case GL_LINK_STATUS:
+    *params = linked[program];
+    break;
+  case GL_PROGRAM_BINARY_LENGTH:
+    *params = sizeof(binary);
+    break;
+  case 0x91B1: /* GL_COMPLETION_STATUS_KHR */
+    *params = GL_TRUE;
+    break;
+  default:
+    *params = 0;
+  }
+}
+
+void glGetProgramInfoLog(GLuint program, GLsizei size, GLsizei *length,
+                         GLchar *log) {}
+
+void glGetProgramBinary(GLuint program, GLsizei size, GLsizei *length,
+                        GLenum *format, void *data) {
+  memcpy(data, binary, sizeof(binary));
+  *length = sizeof(binary);
+  *format = binary_format;
+}
+
+void glProgramBinary(GLuint program, GLenum format, const void *data,
+                     GLsizei length) {
+  num_binaries++;
+  linked[program] = !reject_binaries && format == binary_format &&
+                    length == sizeof(binary) &&
+                    !memcmp(data, binary, sizeof(binary));
+}
+
+void glDeleteProgram(GLuint program) {}
+
+GLint glGetUniformLocation(GLuint program, const GLchar *name) { return 0; }
+
+static char dir[] = "/tmp/prt-shaderXXXXXX";
+static char cachedir[PATH_MAX];
+
+/* the last effect has an unsupported version and fails */
+static const char *const paths[] = {"solid.json", "color.json", "broken.json"};
+
+static const struct {
+  const char *path;
+  const char *data;
+} files[] = {
+    {"solid.json",
+     "{\"version\": 1, \"name\": \"solid-texture\", \"vertex\": \"solid.vs\","
+     " \"fragment\": \"solid.fs\", \"uniforms\": [{\"name\": \"u_texture\","
+     " \"type\": \"texture\"}], \"attributes\": [{\"name\": \"a_position\","
+     " \"type\": \"vec3f\"}, {\"name\": \"a_uv\", \"type\": \"vec2f\"}]}"},
+    {"color.json",
+     "{\"version\": 1, \"name\": \"solid-color\", \"vertex\": \"solid.vs\","
+     " \"fragment\": \"color.fs\", \"uniforms\": [{\"name\": \"u_color\","
+     " \"type\": \"vec4f\"}], \"attributes\": [{\"name\": \"a_position\","
+     " \"type\": \"vec3f\"}]}"},
+    {"broken.json",
+     "{\"version\": 2, \"name\": \"solid-color\", \"vertex\": \"solid.vs\","
+     " \"fragment\": \"color.fs\", \"uniforms\": [], \"attributes\": []}"},
+    {"solid.vs", "void main() { gl_Position = vec4(0.0); }"},
+    {"solid.fs", "void main() { gl_FragColor = vec4(1.0); }"},
+    {"color.fs", "void main() { gl_FragColor = vec4(0.5); }"},
+};
+
+/* removes the files of the test and the cache entries */
+static void _cleanup(void) {
+  char path[PATH_MAX];
+  struct dirent *de;
+  DIR *d;
+  size_t i;
+
+  d = opendir(cachedir);
+  while (d && (de = readdir(d))) {
+    if (de->d_name[0] == '.')
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", cachedir, de->d_name);
+    unlink(path);
+  }
+  if (d)
+    closedir(d);
+  rmdir(cachedir);
+
+  for (i = 0; i < COUNT(files); ++i) {
+    snprintf(path, sizeof(path), "%s/%s", dir, files[i].path);
+    unlink(path);
+  }
+  rmdir(dir);
+}
+
+/* whether `manager` holds the resource of `path` */
+static bool _managed(ResourceManager *manager, const char *path) {
+  const char *p;
+  void *fr;
+
+  p = strjoina(manager->work_dir, "/", path);
+  return hashtable_find(manager->resources, HASH(p), (void *)p, &fr) == 0;
+}
+
+/* @func `test_batch`
+ * @desc Creates the effects of `paths` in a batch and checks every outcome
+ *
+ * @param(compiles) Shaders expected to be compiled, 0 when every valid
+ *                  effect comes from the cache
+ * @param(poll)     Drive the batch with `effect_batch_poll` instead of
+ *                  `effect_batch_wait`
+ */
+int test_batch(ResourceManager *manager, EffectCache *cache,
+               ThreadPool *workers, size_t compiles, bool poll) {
+  Pass *passes[COUNT(paths)];
+  EffectBatch *batch;
+  size_t i, before;
+  int r;
+
+  before = num_compiles;
+  r = create_effects(paths, COUNT(paths), manager, cache, NULL, workers,
+                     passes, &batch);
+  if (r < 0)
+    return r;
+
+  if (poll)
+    while ((r = effect_batch_poll(batch)) == -EAGAIN)
+      sched_yield();
+  else
+    r = effect_batch_wait(batch);
+
+  /* the first failure is reported for the whole batch */
+  r = r == -EINVAL && effect_batch_result(batch, 0) == 0 &&
+              effect_batch_result(batch, 1) == 0 &&
+              effect_batch_result(batch, 2) == -EINVAL && passes[0] &&
+              passes[1] && !passes[2] &&
+              passes[0]->type == ET_SOLID_TEXTURE &&
+              passes[1]->type == ET_SOLID_COLOR &&
+              num_compiles - before == compiles
+          ? 0
+          : -1;
+
+  (void)effect_batch_unref(batch);
+  for (i = 0; i < COUNT(paths); ++i)
+    if (passes[i])
+      (void)shader_pass_unref(passes[i], NULL);
+
+  /* failed descriptions are dropped from the manager */
+  if (r == 0 && manager &&
+      (!_managed(manager, paths[0]) || _managed(manager, paths[2])))
+    r = -1;
+  return r;
+}
+
+/* releasing the batch right away resolves everything the workers load */
+int test_unref(ResourceManager *manager, EffectCache *cache,
+               ThreadPool *workers) {
+  Pass *passes[COUNT(paths)];
+  EffectBatch *batch;
+  size_t i;
+  int r;
+
+  r = create_effects(paths, COUNT(paths), manager, cache, NULL, workers,
+                     passes, &batch);
+  if (r < 0)
+    return r;
+
+  r = effect_batch_unref(batch);
+  if (r == 0 && (!passes[0] || !passes[1] || passes[2]))
+    r = -1;
+
+  for (i = 0; i < COUNT(paths); ++i)
+    if (passes[i])
+      (void)shader_pass_unref(passes[i], NULL);
+  return r;
+}
+
+/* @func `test_single`
+ * @desc Creates `solid.json` on its own and checks that `compiles` shaders
+ *       were compiled for it
+ */
+int test_single(EffectCache *cache, size_t compiles) {
+  Pass *pass = NULL;
+  size_t before;
+  int r;
+
+  before = num_compiles;
+  r = create_effect("solid.json", NULL, cache, NULL, &pass);
+  if (r < 0)
+    return r;
+
+  r = pass->type == ET_SOLID_TEXTURE && num_compiles - before == compiles
+          ? 0
+          : -1;
+  (void)shader_pass_unref(pass, NULL);
+  return r;
+}
+
+/* checks the binary format stored for `solid.json` */
+int test_entry(EffectCache *cache, GLenum format) {
+  EffectCacheEntry *entry;
+  int r;
+
+  r = effect_cache_read(cache, "solid.json", &entry);
+  if (r < 0)
+    return r;
+
+  r = entry->format == format ? 0 : -1;
+  effect_cache_entry_unref(entry);
+  return r;
+}
+
+/* editing a shader source invalidates the entry */
+int test_stale(EffectCache *cache) {
+  FILE *fd;
+  int r;
+
+  fd = fopen("solid.fs", "wb");
+  if (!fd)
+    return -errno;
+  fputs("void main() { gl_FragColor = vec4(0.25); }", fd);
+  fclose(fd);
+
+  r = test_single(cache, 2);
+  if (r == 0)
+    r = test_single(cache, 0);
+  return r;
+}
+
+int main(int argc, const char *argv[]) {
+  ResourceManager *manager;
+  EffectCache *cache;
+  ThreadPool *workers;
+  char path[PATH_MAX];
+  FILE *fd;
+  size_t i;
+  int r;
+
+  output1("[!] " PRD_HEADER " - shader effect batch test");
+
+  if (!mkdtemp(dir))
+    return 1;
+
+  for (i = 0; i < COUNT(files); ++i) {
+    snprintf(path, sizeof(path), "%s/%s", dir, files[i].path);
+    fd = fopen(path, "wb");
+    if (!fd)
+      return 1;
+    fputs(files[i].data, fd);
+    fclose(fd);
+  }
+
+  /* effects without a manager are loaded relative to the working directory */
+  if (chdir(dir) < 0)
+    return 1;
+
+  snprintf(cachedir, sizeof(cachedir), "%s/cache", dir);
+  r = effect_cache_new(cachedir, &cache);
+  if (r == 0)
+    r = thread_pool_new(4, &workers);
+  if (r == 0)
+    r = resource_manager_new(dir, 2, &manager);
+  output(" [+] setup: %s", AS_STRING(r));
+  if (r < 0)
+    return 1;
+
+  r = test_batch(NULL, cache, workers, 4, false);
+  output(" [+] batch compiled: %s", AS_STRING(r));
+  if (r < 0)
+    goto out;
+
+  r = test_batch(NULL, cache, workers, 0, true);
+  if (r == 0)
+    r = test_batch(NULL, cache, NULL, 0, false);
+  output(" [+] batch from cache: %s", AS_STRING(r));
+  if (r < 0)
+    goto out;
+
+  /* driver updates invalidate the binaries */
+  reject_binaries = true;
+  i = num_binaries;
+  r = test_batch(NULL, cache, workers, 4, false);
+  if (r == 0)
+    r = test_batch(manager, cache, workers, 4, true);
+  reject_binaries = false;
+  if (r == 0 && num_binaries - i != 4)
+    r = -1;
+  output(" [+] rejected binaries recompiled: %s", AS_STRING(r));
+  if (r < 0)
+    goto out;
+
+  r = test_batch(manager, cache, workers, 0, false);
+  output(" [+] batch through the resource manager: %s", AS_STRING(r));
+  if (r < 0)
+    goto out;
+
+  r = test_unref(NULL, NULL, workers);
+  if (r == 0)
+    r = test_unref(manager, cache, workers);
+  output(" [+] batch released while loading: %s", AS_STRING(r));
+  if (r < 0)
+    goto out;
+
+  i = num_binaries;
+  r = test_single(cache, 0);
+  if (r == 0)
+    r = test_single(cache, 0);
+  if (r == 0 && num_binaries - i != 2)
+    r = -1;
+  output(" [+] effect from cache: %s", AS_STRING(r));
+  if (r < 0)
+    goto out;
+
+  /* binaries of an older driver are replaced by the recompiled program */
+  binary_format = BINARY_FORMAT + 1;
+  r = test_single(cache, 2);
+  if (r == 0)
+    r = test_entry(cache, BINARY_FORMAT + 1);
+  if (r == 0)
+    r = test_single(cache, 0);
+  output(" [+] mismatched binary recompiled: %s", AS_STRING(r));
+  if (r < 0)
+    goto out;
+
+  r = test_stale(cache);
+  output(" [+] stale effect recompiled: %s", AS_STRING(r));
+
+out:
+  (void)thread_pool_unref(workers);
+  (void)resource_manager_unref(manager);
+  (void)effect_cache_unref(cache);
+  _cleanup();
+
+  return r < 0 ? 1 : 0;
+}